@@ -0,0 +1,226 @@
+/* \file
+   \brief Детерминированный генератор тестовых CSV для marty_csv_bench
+
+   Используется собственный генератор псевдослучайных чисел - распределения из <random>
+   на разных стандартных библиотеках дают разные последовательности, а данные должны
+   совпадать от сборки к сборке.
+
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace marty {
+namespace csv {
+namespace bench {
+
+//----------------------------------------------------------------------------
+//! SplitMix64 - простой и переносимый генератор
+class Rng
+{
+    std::uint64_t m_state;
+
+public:
+
+    explicit Rng(std::uint64_t seed) : m_state(seed) {}
+
+    std::uint64_t next()
+    {
+        std::uint64_t z = (m_state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    //! Число в диапазоне [0, n)
+    std::uint64_t below(std::uint64_t n) { return n ? next()%n : 0; }
+
+    //! true с вероятностью percent/100
+    bool chance(unsigned percent) { return below(100)<percent; }
+};
+
+//----------------------------------------------------------------------------
+enum class Dataset
+{
+    Numeric  , //!< Целые и дробные числа, без кавычек
+    Text     , //!< Текст, много полей в кавычках, с запятыми и удвоенными кавычками
+    Multiline, //!< Закавыченные поля с переводами строк внутри
+    Wide     , //!< 1000 колонок
+    Tall       //!< Очень много коротких строк, размер задаётся числом строк
+};
+
+inline
+const char* datasetName(Dataset ds)
+{
+    switch(ds)
+    {
+        case Dataset::Numeric  : return "numeric";
+        case Dataset::Text     : return "text";
+        case Dataset::Multiline: return "multiline";
+        case Dataset::Wide     : return "wide";
+        case Dataset::Tall     : return "tall";
+        default: return "unknown";
+    }
+}
+
+//----------------------------------------------------------------------------
+namespace details {
+
+inline
+const std::vector<std::string>& words()
+{
+    static const std::vector<std::string> w = { "alpha", "beta", "gamma", "delta", "lorem", "ipsum", "dolor", "sit", "amet"
+                                              , "consectetur", "adipiscing", "elit", "sed", "do", "eiusmod", "tempor"
+                                              , "Moscow", "Berlin", "New York", "ACME Corp.", "Ltd", "order", "invoice", "total"
+                                              };
+    return w;
+}
+
+inline
+void appendWords(std::string &out, Rng &rng, unsigned minWords, unsigned maxWords)
+{
+    unsigned n = minWords + (unsigned)rng.below(maxWords-minWords+1);
+    const auto &w = words();
+    for(unsigned i=0; i!=n; ++i)
+    {
+        if (i)
+            out.append(1, ' ');
+        out.append(w[rng.below(w.size())]);
+    }
+}
+
+inline
+void appendNumber(std::string &out, Rng &rng)
+{
+    if (rng.chance(50))
+    {
+        out.append(std::to_string((long long)rng.below(2000000000ull) - 1000000000ll));
+    }
+    else
+    {
+        out.append(std::to_string(rng.below(1000000)));
+        out.append(1, '.');
+        out.append(std::to_string(rng.below(10000)));
+    }
+}
+
+inline
+void appendTextField(std::string &out, Rng &rng, bool allowNewlines)
+{
+    unsigned kind = (unsigned)rng.below(100);
+    if (kind<50)
+    {
+        appendWords(out, rng, 1, 3);
+        return;
+    }
+
+    out.append(1, '\"');
+    appendWords(out, rng, 2, 6);
+    if (kind<70)
+    {
+        out.append(", ");
+        appendWords(out, rng, 1, 3);
+    }
+    else if (kind<85)
+    {
+        out.append(" \"\"");
+        appendWords(out, rng, 1, 2);
+        out.append("\"\" ");
+    }
+    else if (allowNewlines)
+    {
+        out.append(rng.chance(50) ? "\n" : "\r\n");
+        appendWords(out, rng, 1, 4);
+    }
+    out.append(1, '\"');
+}
+
+} // namespace details
+
+//----------------------------------------------------------------------------
+//! Генерирует набор данных. Для Tall размер задаёт tallRows, для остальных - targetBytes
+inline
+std::string generate(Dataset ds, std::size_t targetBytes, std::size_t tallRows, std::uint64_t seed=1)
+{
+    Rng rng(seed + (std::uint64_t)ds);
+    std::string out;
+    out.reserve(ds==Dataset::Tall ? tallRows*16 : targetBytes + 64*1024);
+
+    unsigned numCols = 0;
+    switch(ds)
+    {
+        case Dataset::Numeric  : numCols = 12;   break;
+        case Dataset::Text     : numCols = 8;    break;
+        case Dataset::Multiline: numCols = 6;    break;
+        case Dataset::Wide     : numCols = 1000; break;
+        case Dataset::Tall     : numCols = 3;    break;
+    }
+
+    for(unsigned c=0; c!=numCols; ++c)
+    {
+        if (c)
+            out.append(1, ',');
+        out.append("col");
+        out.append(std::to_string(c));
+    }
+    out.append("\r\n");
+
+    for(std::size_t row=0; ; ++row)
+    {
+        if (ds==Dataset::Tall ? row>=tallRows : out.size()>=targetBytes)
+            break;
+
+        if (ds==Dataset::Tall)
+        {
+            out.append(std::to_string(row));
+            out.append(1, ',');
+            out.append(std::to_string(rng.below(100)));
+            out.append(",x\r\n");
+            continue;
+        }
+
+        for(unsigned c=0; c!=numCols; ++c)
+        {
+            if (c)
+                out.append(1, ',');
+
+            switch(ds)
+            {
+                case Dataset::Numeric:
+                    details::appendNumber(out, rng);
+                    break;
+
+                case Dataset::Text:
+                    details::appendTextField(out, rng, false);
+                    break;
+
+                case Dataset::Multiline:
+                    details::appendTextField(out, rng, true);
+                    break;
+
+                case Dataset::Wide:
+                    if (rng.chance(70))
+                        out.append(std::to_string(rng.below(1000)));
+                    else
+                        details::appendWords(out, rng, 1, 1);
+                    break;
+
+                default:
+                    break;
+            }
+        }
+        out.append("\r\n");
+    }
+
+    return out;
+}
+
+//----------------------------------------------------------------------------
+
+} // namespace bench
+} // namespace csv
+} // namespace marty
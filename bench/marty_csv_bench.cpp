@@ -0,0 +1,391 @@
+/* \file
+   \brief marty_csv_bench - замеры производительности marty_csv на синтетических данных
+
+   Запуск: marty_csv_bench [--size MB] [--tall-rows N] [--iterations N] [--dataset name] [--bench name]
+
+   Для каждого набора данных и каждой функции выводятся MB/s, строк в секунду, количество
+   выделений памяти и пиковый RSS. Пиковый RSS на Linux сбрасывается перед каждым замером,
+   на других системах он накопительный за время работы процесса.
+
+ */
+
+#include "marty_csv.h"
+#include "marty_csv_encoding.h"
+#include "marty_csv_parallel.h"
+#include "marty_csv_writer.h"
+
+#include "csv_generator.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+
+//----------------------------------------------------------------------------
+// Подсчёт выделений памяти
+static std::atomic<std::size_t> g_allocCount(0);
+
+// Результаты детекторов пишутся сюда, чтобы вызовы не были выброшены оптимизатором
+static volatile char g_sink = 0;
+
+// Выделение и освобождение вынесены в невстраиваемые функции - иначе GCC видит free()
+// на указателе от operator new и выдаёт -Wmismatched-new-delete
+#if defined(_MSC_VER)
+    #define MARTY_CSV_BENCH_NOINLINE __declspec(noinline)
+#else
+    #define MARTY_CSV_BENCH_NOINLINE __attribute__((noinline))
+#endif
+
+static MARTY_CSV_BENCH_NOINLINE
+void* benchAlloc(std::size_t size, std::size_t align) noexcept
+{
+    ++g_allocCount;
+    if (!size)
+        size = 1;
+
+    if (align<=alignof(std::max_align_t))
+        return std::malloc(size);
+
+#if defined(_WIN32)
+    return _aligned_malloc(size, align);
+#else
+    void *p = 0;
+    return posix_memalign(&p, align, size)==0 ? p : 0;
+#endif
+}
+
+static MARTY_CSV_BENCH_NOINLINE
+void benchFree(void *p, std::size_t align) noexcept
+{
+#if defined(_WIN32)
+    if (align>alignof(std::max_align_t))
+    {
+        _aligned_free(p);
+        return;
+    }
+#else
+    (void)align;
+#endif
+    std::free(p);
+}
+
+static
+void* benchAllocOrThrow(std::size_t size, std::size_t align)
+{
+    void *p = benchAlloc(size, align);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+static constexpr std::size_t defaultAlign = alignof(std::max_align_t);
+
+void* operator new  (std::size_t size)                                             { return benchAllocOrThrow(size, defaultAlign); }
+void* operator new[](std::size_t size)                                             { return benchAllocOrThrow(size, defaultAlign); }
+void* operator new  (std::size_t size, const std::nothrow_t&) noexcept             { return benchAlloc(size, defaultAlign); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept             { return benchAlloc(size, defaultAlign); }
+void* operator new  (std::size_t size, std::align_val_t al)                        { return benchAllocOrThrow(size, std::size_t(al)); }
+void* operator new[](std::size_t size, std::align_val_t al)                        { return benchAllocOrThrow(size, std::size_t(al)); }
+void* operator new  (std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return benchAlloc(size, std::size_t(al)); }
+void* operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return benchAlloc(size, std::size_t(al)); }
+
+void operator delete  (void *p) noexcept                                           { benchFree(p, defaultAlign); }
+void operator delete[](void *p) noexcept                                           { benchFree(p, defaultAlign); }
+void operator delete  (void *p, std::size_t) noexcept                              { benchFree(p, defaultAlign); }
+void operator delete[](void *p, std::size_t) noexcept                              { benchFree(p, defaultAlign); }
+void operator delete  (void *p, const std::nothrow_t&) noexcept                    { benchFree(p, defaultAlign); }
+void operator delete[](void *p, const std::nothrow_t&) noexcept                    { benchFree(p, defaultAlign); }
+void operator delete  (void *p, std::align_val_t al) noexcept                      { benchFree(p, std::size_t(al)); }
+void operator delete[](void *p, std::align_val_t al) noexcept                      { benchFree(p, std::size_t(al)); }
+void operator delete  (void *p, std::size_t, std::align_val_t al) noexcept         { benchFree(p, std::size_t(al)); }
+void operator delete[](void *p, std::size_t, std::align_val_t al) noexcept         { benchFree(p, std::size_t(al)); }
+void operator delete  (void *p, std::align_val_t al, const std::nothrow_t&) noexcept { benchFree(p, std::size_t(al)); }
+void operator delete[](void *p, std::align_val_t al, const std::nothrow_t&) noexcept { benchFree(p, std::size_t(al)); }
+
+//----------------------------------------------------------------------------
+static
+void resetPeakRss()
+{
+#if defined(__linux__)
+    // Запись "5" в clear_refs сбрасывает VmHWM
+    if (FILE *fp = std::fopen("/proc/self/clear_refs", "w"))
+    {
+        std::fputs("5", fp);
+        std::fclose(fp);
+    }
+#endif
+}
+
+//----------------------------------------------------------------------------
+static
+double peakRssMb()
+{
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+        return double(pmc.PeakWorkingSetSize)/(1024.0*1024.0);
+    return 0;
+#else
+    #if defined(__linux__)
+    if (FILE *fp = std::fopen("/proc/self/status", "r"))
+    {
+        char line[256];
+        double res = -1;
+        while(std::fgets(line, sizeof(line), fp))
+        {
+            if (std::strncmp(line, "VmHWM:", 6)==0)
+            {
+                res = std::atof(line+6)/1024.0; // В килобайтах
+                break;
+            }
+        }
+        std::fclose(fp);
+        if (res>=0)
+            return res;
+    }
+    #endif
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    #if defined(__APPLE__)
+    return double(ru.ru_maxrss)/(1024.0*1024.0);
+    #else
+    return double(ru.ru_maxrss)/1024.0;
+    #endif
+#endif
+}
+
+//----------------------------------------------------------------------------
+struct Options
+{
+    std::size_t  sizeMb      = 16;
+    std::size_t  tallRows    = 1000000;
+    unsigned     iterations  = 3;
+    std::string  datasetFilter;
+    std::string  benchFilter;
+};
+
+//----------------------------------------------------------------------------
+//! Один замер: func возвращает число обработанных строк (0 - не считать); лучшее время из iterations запусков
+static
+void runBench( const Options &opts, const char *datasetName, const char *benchName, std::size_t bytes
+             , const std::function<std::size_t()> &func
+             )
+{
+    if (!opts.benchFilter.empty() && opts.benchFilter!=benchName)
+        return;
+
+    double      bestSec  = 0;
+    std::size_t rows     = 0;
+    std::size_t allocs   = 0;
+
+    resetPeakRss();
+
+    for(unsigned i=0; i!=opts.iterations; ++i)
+    {
+        std::size_t allocsBefore = g_allocCount.load();
+        auto start = std::chrono::steady_clock::now();
+
+        rows = func();
+
+        double sec = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+        allocs = g_allocCount.load() - allocsBefore;
+
+        if (i==0 || sec<bestSec)
+            bestSec = sec;
+    }
+
+    if (bestSec<=0)
+        bestSec = 1e-9;
+
+    char rowsBuf[32] = "-";
+    if (rows)
+        std::snprintf(rowsBuf, sizeof(rowsBuf), "%.0f", double(rows)/bestSec);
+
+    std::printf( "%-10s %-32s %10.1f MB/s %14s rows/s %12zu allocs %10.1f MB peak RSS\n"
+               , datasetName, benchName
+               , double(bytes)/bestSec/1e6
+               , rowsBuf
+               , allocs
+               , peakRssMb()
+               );
+    std::fflush(stdout);
+}
+
+//----------------------------------------------------------------------------
+static
+void usage()
+{
+    std::printf("Usage: marty_csv_bench [--size MB] [--tall-rows N] [--iterations N] [--dataset name] [--bench name]\n");
+    std::printf("Datasets: numeric, text, multiline, wide, tall\n");
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    using namespace marty::csv;
+
+    Options opts;
+
+    for(int i=1; i<argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto nextArg = [&]() -> const char*
+        {
+            if (i+1>=argc)
+            {
+                usage();
+                std::exit(1);
+            }
+            return argv[++i];
+        };
+
+        if (arg=="--size")
+            opts.sizeMb = std::size_t(std::strtoull(nextArg(), 0, 10));
+        else if (arg=="--tall-rows")
+            opts.tallRows = std::size_t(std::strtoull(nextArg(), 0, 10));
+        else if (arg=="--iterations")
+            opts.iterations = unsigned(std::strtoul(nextArg(), 0, 10));
+        else if (arg=="--dataset")
+            opts.datasetFilter = nextArg();
+        else if (arg=="--bench")
+            opts.benchFilter = nextArg();
+        else
+        {
+            usage();
+            return arg=="--help" || arg=="-h" ? 0 : 1;
+        }
+    }
+
+    if (!opts.iterations)
+        opts.iterations = 1;
+
+    const bench::Dataset datasets[] = { bench::Dataset::Numeric, bench::Dataset::Text, bench::Dataset::Multiline, bench::Dataset::Wide, bench::Dataset::Tall };
+
+    for(auto ds : datasets)
+    {
+        const char *dsName = bench::datasetName(ds);
+        if (!opts.datasetFilter.empty() && opts.datasetFilter!=dsName)
+            continue;
+
+        const std::string data = bench::generate(ds, opts.sizeMb*1024*1024, opts.tallRows);
+        const std::size_t bytes = data.size();
+
+        runBench(opts, dsName, "deserializeFieldsFromCsvLines", bytes, [&]() { return marty_csv::deserializeFieldsFromCsvLines(data, ',').size(); });
+        runBench(opts, dsName, "parse"                        , bytes, [&]() { return parse(data, ',', '\"', true).data.size(); });
+        {
+            ParseResult reuse;
+            runBench(opts, dsName, "parse (reuse result)"     , bytes, [&]() { parse(data, reuse, ',', '\"', true); return reuse.data.size(); });
+        }
+#if defined(MARTY_CSV_HAS_PMR)
+        {
+            // Начальный буфер переживает release() - между итерациями память не возвращается системе
+            std::vector<char> arena(bytes*4);
+            std::pmr::monotonic_buffer_resource resource(arena.data(), arena.size());
+            runBench(opts, dsName, "parse (pmr monotonic)"    , bytes, [&]()
+            {
+                std::size_t rows = 0;
+                {
+                    PmrParseResult res(&resource);
+                    parse(data, res, ',', '\"', true);
+                    rows = res.data.size();
+                }
+                resource.release();
+                return rows;
+            });
+        }
+#endif
+        runBench(opts, dsName, "parseView"                    , bytes, [&]() { return parseView(data, ',', '\"', true).data.size(); });
+        runBench(opts, dsName, "parseFlat"                    , bytes, [&]() { return parseFlat(data, ',', '\"', true).data.size(); });
+        runBench(opts, dsName, "parseFlat (runtime dialect)"  , bytes, [&]() { return details::CsvParser(',', '\"', true).parseFlat(data).data.size(); });
+        runBench(opts, dsName, "parseFlat (3 columns)"        , bytes, [&]() { return parseFlat(data, ColumnProjection::byIndices({0, 1, 2}), ',', '\"', true).data.size(); });
+        runBench(opts, dsName, "parseFlat (row filter)"       , bytes, [&]()
+        {
+            // Оставляет примерно десятую часть строк
+            RowFilter filter({0}, [](const std::vector<std::string_view> &v) { return !v[0].empty() && v[0].back()=='7'; });
+            return parseFlat(data, filter, ',', '\"', true).data.size();
+        });
+        {
+            // Каждый седьмой разделитель заменён пробелом - почти в каждой строке ошибка InconsistentColumns
+            std::string broken = data;
+            std::size_t numDelims = 0;
+            for(char &ch : broken)
+            {
+                if (ch==',' && ++numDelims%7==0)
+                    ch = ' ';
+            }
+
+            runBench(opts, dsName, "parseFlat (broken rows)"          , bytes, [&]() { return parseFlat(broken, ',', '\"', true).data.size(); });
+            runBench(opts, dsName, "parseFlat (broken rows, compact)" , bytes, [&]()
+            {
+                ErrorLog log;
+                return parseFlat(broken, ErrorPolicy::compact(), log, ',', '\"', true).data.size();
+            });
+            runBench(opts, dsName, "parseFlat (broken rows, count)"   , bytes, [&]()
+            {
+                ErrorLog log;
+                return parseFlat(broken, ErrorPolicy::countOnly(), log, ',', '\"', true).data.size();
+            });
+        }
+        runBench(opts, dsName, "parseLazy (3 columns read)"   , bytes, [&]()
+        {
+            auto res = parseLazy(data, ',', '\"', true);
+            std::size_t chars = 0;
+            for(auto row : res.data)
+            {
+                for(std::size_t c=0; c<3 && c<row.size(); ++c)
+                    chars += row[c].size();
+            }
+            g_sink = char(chars);
+            return res.data.size();
+        });
+        runBench(opts, dsName, "parseParallel"                , bytes, [&]() { return parseParallel(data, ',', '\"', true).data.size(); });
+        runBench(opts, dsName, "parseEncoded (UTF-8)"         , bytes, [&]() { return parseEncoded(data).data.size(); });
+
+        // Данные генератора - ASCII, UTF-16LE получается расширением байт
+        std::string utf16("\xFF\xFE", 2);
+        utf16.reserve(2 + data.size()*2);
+        for(char ch : data)
+        {
+            utf16.push_back(ch);
+            utf16.push_back('\0');
+        }
+        runBench(opts, dsName, "parseEncoded (UTF-16LE)"      , utf16.size(), [&]() { return parseEncoded(utf16).data.size(); });
+        utf16.clear();
+        utf16.shrink_to_fit();
+
+        runBench(opts, dsName, "detectQuotes"                 , bytes, [&]() { g_sink = detectQuotes(data); return std::size_t(0); });
+        runBench(opts, dsName, "detectSeparators"             , bytes, [&]() { g_sink = detectSeparators(data); return std::size_t(0); });
+
+        const auto rows = marty_csv::deserializeFieldsFromCsvLines(data, ',');
+        runBench(opts, dsName, "serializeToCsv"               , bytes, [&]() { return marty_csv::serializeToCsv(rows, "\r\n", ',').size() ? rows.size() : 0; });
+        runBench(opts, dsName, "CsvWriter"                    , bytes, [&]()
+        {
+            std::FILE *fp = std::tmpfile();
+            if (!fp)
+                return std::size_t(0);
+            {
+                CsvWriter writer(fp, "\r\n", ',');
+                writer.writeRows(rows);
+            }
+            std::fclose(fp);
+            return rows.size();
+        });
+    }
+
+    return 0;
+}
@@ -0,0 +1,544 @@
+/* \file
+   \brief marty_csv_compressed - разбор сжатых CSV (gzip, zstd) без распаковки на диск
+
+   Формат определяется по сигнатуре. Файл читается и распаковывается блоками ограниченного
+   размера в отдельном потоке, блоки через очередь ограниченной длины передаются в CsvPushParser
+   в вызывающем потоке - распаковка и разбор идут одновременно.
+
+   Поддержка форматов включается явно: MARTY_CSV_WITH_ZLIB - gzip (нужен zlib), MARTY_CSV_WITH_ZSTD -
+   zstd (нужен libzstd). Программу при этом нужно компоновать с соответствующей библиотекой -
+   в CMake это делают одноимённые опции. Без них читаются только несжатые файлы.
+
+ */
+
+#pragma once
+
+#include "marty_csv_file.h"
+#include "marty_csv_new.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(MARTY_CSV_WITH_ZLIB)
+    #include <zlib.h>
+    #define MARTY_CSV_HAS_ZLIB
+#endif
+
+#if defined(MARTY_CSV_WITH_ZSTD)
+    #include <zstd.h>
+    #define MARTY_CSV_HAS_ZSTD
+#endif
+
+
+namespace marty {
+namespace csv {
+
+//----------------------------------------------------------------------------
+enum class CompressionFormat
+{
+    None,
+    Gzip,
+    Zstd
+};
+
+inline
+std::string to_string(CompressionFormat cf)
+{
+    switch(cf)
+    {
+        case CompressionFormat::None: return "None";
+        case CompressionFormat::Gzip: return "Gzip";
+        case CompressionFormat::Zstd: return "Zstd";
+        default: return "Unknown";
+    }
+}
+
+//----------------------------------------------------------------------------
+//! Формат по сигнатуре в начале данных
+inline
+CompressionFormat detectCompression(const char *pData, std::size_t size)
+{
+    const unsigned char *p = (const unsigned char*)pData;
+
+    if (size>=2 && p[0]==0x1F && p[1]==0x8B)
+        return CompressionFormat::Gzip;
+
+    if (size>=4 && p[0]==0x28 && p[1]==0xB5 && p[2]==0x2F && p[3]==0xFD)
+        return CompressionFormat::Zstd;
+
+    return CompressionFormat::None;
+}
+
+//----------------------------------------------------------------------------
+//! Поддерживается ли формат в этой сборке
+inline
+bool isCompressionSupported(CompressionFormat cf)
+{
+    switch(cf)
+    {
+        case CompressionFormat::None: return true;
+#if defined(MARTY_CSV_HAS_ZLIB)
+        case CompressionFormat::Gzip: return true;
+#endif
+#if defined(MARTY_CSV_HAS_ZSTD)
+        case CompressionFormat::Zstd: return true;
+#endif
+        default: return false;
+    }
+}
+
+//----------------------------------------------------------------------------
+namespace details {
+
+//----------------------------------------------------------------------------
+//! Потоковая распаковка одного входа; несжатый вход копируется как есть
+class Decompressor
+{
+    CompressionFormat  m_format   = CompressionFormat::None;
+    bool               m_inited   = false;
+    bool               m_frameEnd = true;   // Вход закончился бы на границе потока/кадра
+
+#if defined(MARTY_CSV_HAS_ZLIB)
+    z_stream           m_zs;
+#endif
+#if defined(MARTY_CSV_HAS_ZSTD)
+    ZSTD_DStream      *m_pZstd    = 0;
+#endif
+
+    void release()
+    {
+        if (!m_inited)
+            return;
+
+#if defined(MARTY_CSV_HAS_ZLIB)
+        if (m_format==CompressionFormat::Gzip)
+            inflateEnd(&m_zs);
+#endif
+#if defined(MARTY_CSV_HAS_ZSTD)
+        if (m_format==CompressionFormat::Zstd)
+            ZSTD_freeDStream(m_pZstd);
+        m_pZstd = 0;
+#endif
+        m_inited = false;
+    }
+
+public:
+
+    Decompressor() = default;
+    Decompressor(const Decompressor&) = delete;
+    Decompressor& operator=(const Decompressor&) = delete;
+
+    ~Decompressor()
+    {
+        release();
+    }
+
+    //! false - формат не поддерживается
+    bool init(CompressionFormat format)
+    {
+        release();
+
+        m_format   = format;
+        m_frameEnd = true;
+
+        switch(format)
+        {
+            case CompressionFormat::None:
+                m_inited = true;
+                return true;
+
+#if defined(MARTY_CSV_HAS_ZLIB)
+            case CompressionFormat::Gzip:
+                std::memset(&m_zs, 0, sizeof(m_zs));
+                m_inited = inflateInit2(&m_zs, 15+32)==Z_OK; // +32 - заголовок gzip или zlib определяется автоматически
+                return m_inited;
+#endif
+
+#if defined(MARTY_CSV_HAS_ZSTD)
+            case CompressionFormat::Zstd:
+                m_pZstd  = ZSTD_createDStream();
+                m_inited = m_pZstd && !ZSTD_isError(ZSTD_initDStream(m_pZstd));
+                return m_inited;
+#endif
+
+            default:
+                return false;
+        }
+    }
+
+    //! Распаковывает из [pIn, pIn+inSize) в [pOut, pOut+outCap)
+    /*! pIn/inSize сдвигаются на прочитанное, produced - сколько записано. false - ошибка в данных.
+        Вызов с пустым входом дописывает то, что осталось в распаковщике.
+        Несколько gzip-потоков или zstd-кадров подряд распаковываются как один вход.
+     */
+    bool run(const char *&pIn, std::size_t &inSize, char *pOut, std::size_t outCap, std::size_t &produced)
+    {
+        produced = 0;
+
+        switch(m_format)
+        {
+            case CompressionFormat::None:
+            {
+                produced = inSize<outCap ? inSize : outCap;
+                std::memcpy(pOut, pIn, produced);
+                pIn    += produced;
+                inSize -= produced;
+                return true;
+            }
+
+#if defined(MARTY_CSV_HAS_ZLIB)
+            case CompressionFormat::Gzip:
+            {
+                while(produced<outCap)
+                {
+                    if (m_frameEnd)
+                    {
+                        if (!inSize)
+                            break;
+                        if (inflateReset(&m_zs)!=Z_OK)
+                            return false;
+                    }
+
+                    std::size_t producedBefore = produced;
+
+                    m_zs.next_in   = (Bytef*)const_cast<char*>(pIn);
+                    m_zs.avail_in  = (uInt)(inSize>0x40000000u ? 0x40000000u : inSize);
+                    m_zs.next_out  = (Bytef*)(pOut+produced);
+                    m_zs.avail_out = (uInt)(outCap-produced);
+
+                    std::size_t availIn = m_zs.avail_in;
+                    int res = inflate(&m_zs, Z_NO_FLUSH);
+
+                    std::size_t consumed = availIn - m_zs.avail_in;
+                    pIn      += consumed;
+                    inSize   -= consumed;
+                    produced  = outCap - m_zs.avail_out;
+
+                    if (res==Z_STREAM_END)
+                    {
+                        m_frameEnd = true; // Следующие байты - новый gzip-поток
+                        continue;
+                    }
+
+                    if (res!=Z_OK && res!=Z_BUF_ERROR)
+                        return false;
+
+                    m_frameEnd = false;
+                    if (!consumed && produced==producedBefore)
+                        break; // Нужны ещё входные данные
+                }
+                return true;
+            }
+#endif
+
+#if defined(MARTY_CSV_HAS_ZSTD)
+            case CompressionFormat::Zstd:
+            {
+                ZSTD_inBuffer  in  = { pIn , inSize, 0 };
+                ZSTD_outBuffer out = { pOut, outCap, 0 };
+                while(out.pos<out.size)
+                {
+                    std::size_t inPos = in.pos, outPos = out.pos;
+                    std::size_t res = ZSTD_decompressStream(m_pZstd, &out, &in);
+                    if (ZSTD_isError(res))
+                        return false;
+                    m_frameEnd = res==0;
+                    if (in.pos==inPos && out.pos==outPos)
+                        break; // Нужны ещё входные данные
+                }
+                pIn      += in.pos;
+                inSize   -= in.pos;
+                produced  = out.pos;
+                return true;
+            }
+#endif
+
+            default:
+                return false;
+        }
+    }
+
+    //! Вход закончился на границе потока - иначе он обрезан
+    bool complete() const { return m_format==CompressionFormat::None || m_frameEnd; }
+
+}; // class Decompressor
+
+//----------------------------------------------------------------------------
+//! Очередь ограниченной длины между одним производителем и одним потребителем
+template<typename ItemType>
+class BoundedQueue
+{
+    std::mutex               m_mutex;
+    std::condition_variable  m_cvPush;
+    std::condition_variable  m_cvPop;
+    std::deque<ItemType>     m_items;
+    std::size_t              m_capacity;
+    bool                     m_closed = false;
+
+public:
+
+    explicit BoundedQueue(std::size_t capacity) : m_capacity(capacity ? capacity : 1u) {}
+
+    //! false - очередь закрыта потребителем
+    bool push(ItemType &&item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cvPush.wait(lock, [&]() { return m_closed || m_items.size()<m_capacity; });
+        if (m_closed)
+            return false;
+
+        m_items.emplace_back(std::move(item));
+        m_cvPop.notify_one();
+        return true;
+    }
+
+    //! false - очередь закрыта и пуста
+    bool pop(ItemType &item)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cvPop.wait(lock, [&]() { return m_closed || !m_items.empty(); });
+        if (m_items.empty())
+            return false;
+
+        item = std::move(m_items.front());
+        m_items.pop_front();
+        m_cvPush.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_cvPush.notify_all();
+        m_cvPop.notify_all();
+    }
+
+}; // class BoundedQueue
+
+} // namespace details
+
+//----------------------------------------------------------------------------
+//! Чтение CSV из сжатого или несжатого файла; формат определяется по сигнатуре
+/*! Файл читается и распаковывается в отдельном потоке блоками по blockSize байт, в очереди
+    ждут не больше queueBlocks блоков - память ограничена независимо от размера файла.
+    Нулевые delim/quot определяются по первому распакованному блоку.
+    Ошибки чтения и распаковки добавляются в errors() с типом InputError, line==0 и position -
+    числом байт, распакованных до ошибки.
+ */
+class CompressedCsvReader
+{
+
+public:
+
+    using RowCallback = CsvPushParser::RowCallback;
+
+private:
+
+    char                     m_delim;
+    char                     m_quot;
+    bool                     m_strict;
+    std::size_t              m_blockSize;
+    std::size_t              m_queueBlocks;
+    CompressionFormat        m_format = CompressionFormat::None;
+    std::vector<ParseError>  m_errors;
+
+    //! Поток чтения и распаковки; true - вход прочитан до конца без ошибок
+    bool produce(std::FILE *fp, details::BoundedQueue<std::string> &queue, std::string &inBuf, std::size_t inSize, std::string &errMsg, std::size_t &outTotal)
+    {
+        details::Decompressor decompressor;
+        if (!decompressor.init(m_format))
+        {
+            errMsg = "Unsupported compression format: " + to_string(m_format);
+            return false;
+        }
+
+        bool eof = false;
+        const char *pIn = inBuf.data();
+
+        for(;;)
+        {
+            std::string block(m_blockSize, '\0');
+            std::size_t used = 0;
+
+            while(used<block.size())
+            {
+                if (!inSize && !eof)
+                {
+                    inSize = std::fread(&inBuf[0], 1, inBuf.size(), fp);
+                    pIn    = inBuf.data();
+                    if (inSize<inBuf.size())
+                    {
+                        if (std::ferror(fp))
+                        {
+                            errMsg = "Read error";
+                            return false;
+                        }
+                        eof = true;
+                    }
+                }
+
+                std::size_t produced = 0;
+                if (!decompressor.run(pIn, inSize, &block[used], block.size()-used, produced))
+                {
+                    errMsg = "Invalid " + to_string(m_format) + " data";
+                    return false;
+                }
+                used += produced;
+
+                // Вход кончился, и распаковщик больше ничего не отдаёт
+                if (!produced && !inSize && eof)
+                    break;
+            }
+
+            if (!used)
+                break;
+
+            block.resize(used);
+            outTotal += used;
+            if (!queue.push(std::move(block)))
+                return true;
+        }
+
+        if (!decompressor.complete())
+        {
+            errMsg = "Unexpected end of " + to_string(m_format) + " data";
+            return false;
+        }
+
+        return true;
+    }
+
+public:
+
+    explicit CompressedCsvReader(char delim=0, char quot=0, bool strict=true, std::size_t blockSize=256*1024, std::size_t queueBlocks=4)
+    : m_delim(delim)
+    , m_quot(quot)
+    , m_strict(strict)
+    , m_blockSize(blockSize ? blockSize : 1u)
+    , m_queueBlocks(queueBlocks)
+    {}
+
+    //! Читает весь fp, на каждую строку вызывает rowCallback; false - формат не поддерживается
+    bool read(std::FILE *fp, const RowCallback &rowCallback)
+    {
+        m_errors.clear();
+
+        std::string inBuf(m_blockSize, '\0');
+        std::size_t inSize = std::fread(&inBuf[0], 1, inBuf.size(), fp);
+
+        m_format = detectCompression(inBuf.data(), inSize);
+        if (!isCompressionSupported(m_format))
+            return false;
+
+        details::BoundedQueue<std::string> queue(m_queueBlocks);
+
+        std::string  errMsg;
+        std::size_t  outTotal = 0;
+        bool         ok       = true;
+
+        std::thread producer([&]()
+        {
+            ok = produce(fp, queue, inBuf, inSize, errMsg, outTotal);
+            queue.close();
+        });
+
+        // Если rowCallback бросит исключение - очередь закрывается, поток распаковки останавливается
+        // на следующем push и присоединяется до выхода из read
+        struct ProducerJoiner
+        {
+            details::BoundedQueue<std::string>  &queue;
+            std::thread                         &producer;
+
+            ~ProducerJoiner()
+            {
+                if (!producer.joinable())
+                    return;
+                queue.close();
+                producer.join();
+            }
+
+        } producerJoiner{queue, producer};
+
+        std::unique_ptr<CsvPushParser> pParser;
+        std::string block;
+        while(queue.pop(block))
+        {
+            if (!pParser)
+            {
+                char delim = m_delim, quot = m_quot;
+                details::resolveDialect(block, delim, quot);
+                pParser.reset(new CsvPushParser(rowCallback, delim, quot, m_strict));
+            }
+            pParser->feed(block);
+        }
+
+        producer.join();
+
+        if (pParser)
+        {
+            pParser->finish();
+            m_errors = pParser->errors();
+        }
+
+        if (!ok)
+            m_errors.push_back({ ParseErrorType::InputError, errMsg, 0, outTotal });
+
+        return true;
+    }
+
+    //! Открывает и читает файл; false - файл не открыт или формат не поддерживается
+    bool read(const std::string &path, const RowCallback &rowCallback)
+    {
+        std::FILE *fp = std::fopen(path.c_str(), "rb");
+        if (!fp)
+            return false;
+
+        // Файл закрывается и тогда, когда rowCallback бросает исключение
+        struct FileCloser
+        {
+            std::FILE *fp;
+            ~FileCloser() { std::fclose(fp); }
+
+        } fileCloser{fp};
+
+        return read(fp, rowCallback);
+    }
+
+    //! Формат последнего прочитанного входа
+    CompressionFormat format() const { return m_format; }
+
+    const std::vector<ParseError>& errors() const { return m_errors; }
+
+}; // class CompressedCsvReader
+
+//----------------------------------------------------------------------------
+//! Разбор файла, возможно сжатого (.csv.gz, .csv.zst). Нулевые delim/quot определяются автоматически
+/*! false - файл не удалось открыть или его формат сжатия не поддерживается
+ */
+inline
+bool parseCompressedFile(const std::string &path, ParseResult &result, char delim=0, char quot=0, bool strict=true)
+{
+    result = ParseResult();
+
+    CompressedCsvReader reader(delim, quot, strict);
+    if (!reader.read(path, [&](const std::vector<std::string> &row) { result.data.push_back(row); }))
+        return false;
+
+    result.errors = reader.errors();
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+} // namespace csv
+} // namespace marty
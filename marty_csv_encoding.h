@@ -0,0 +1,579 @@
+/* \file
+   \brief marty_csv_encoding - входная кодировка: BOM, проверка UTF-8, перекодирование UTF-16 и CP1251 в UTF-8
+
+   Декодер работает кусками и стоит перед CsvPushParser - отдельного прохода по всему файлу
+   и отдельной копии перекодированного файла не требуется. Корректный UTF-8 передаётся в парсер
+   указателями во входной кусок и разбирается на месте; копируются только поля записи, не
+   завершённой на конце куска. UTF-16 и CP1251 перекодируются в переиспользуемый буфер.
+   ASCII-участки проверяются векторно, многобайтовые - векторно при наличии SSSE3, иначе
+   ASCII и двухбайтовые последовательности проверяются коротким скалярным циклом.
+
+ */
+
+#pragma once
+
+#include "marty_csv_new.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+namespace marty {
+namespace csv {
+
+//----------------------------------------------------------------------------
+enum class TextEncoding
+{
+    Utf8   ,
+    Utf16LE,
+    Utf16BE,
+    Cp1251     //!< Windows-1251, BOM не имеет - задаётся как кодировка по умолчанию
+};
+
+inline
+std::string to_string(TextEncoding enc)
+{
+    switch(enc)
+    {
+        case TextEncoding::Utf8   : return "UTF-8";
+        case TextEncoding::Utf16LE: return "UTF-16LE";
+        case TextEncoding::Utf16BE: return "UTF-16BE";
+        case TextEncoding::Cp1251 : return "CP1251";
+        default: return "Unknown";
+    }
+}
+
+//----------------------------------------------------------------------------
+//! Определяет кодировку по BOM; возвращает длину BOM, 0 - BOM нет (enc не меняется)
+inline
+std::size_t detectBom(const char *pData, std::size_t size, TextEncoding &enc)
+{
+    const unsigned char *p = (const unsigned char*)pData;
+
+    if (size>=3 && p[0]==0xEF && p[1]==0xBB && p[2]==0xBF)
+    {
+        enc = TextEncoding::Utf8;
+        return 3;
+    }
+
+    if (size>=2 && p[0]==0xFF && p[1]==0xFE)
+    {
+        enc = TextEncoding::Utf16LE;
+        return 2;
+    }
+
+    if (size>=2 && p[0]==0xFE && p[1]==0xFF)
+    {
+        enc = TextEncoding::Utf16BE;
+        return 2;
+    }
+
+    return 0;
+}
+
+//----------------------------------------------------------------------------
+namespace details {
+
+//----------------------------------------------------------------------------
+//! Символы CP1251 0x80-0xFF; 0x98 в кодировке не определён
+inline
+const std::uint16_t* cp1251HighTable()
+{
+    static const std::uint16_t t[128] =
+    {
+        0x0402, 0x0403, 0x201A, 0x0453, 0x201E, 0x2026, 0x2020, 0x2021,
+        0x20AC, 0x2030, 0x0409, 0x2039, 0x040A, 0x040C, 0x040B, 0x040F,
+        0x0452, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+        0xFFFD, 0x2122, 0x0459, 0x203A, 0x045A, 0x045C, 0x045B, 0x045F,
+        0x00A0, 0x040E, 0x045E, 0x0408, 0x00A4, 0x0490, 0x00A6, 0x00A7,
+        0x0401, 0x00A9, 0x0404, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x0407,
+        0x00B0, 0x00B1, 0x0406, 0x0456, 0x0491, 0x00B5, 0x00B6, 0x00B7,
+        0x0451, 0x2116, 0x0454, 0x00BB, 0x0458, 0x0405, 0x0455, 0x0457,
+        0x0410, 0x0411, 0x0412, 0x0413, 0x0414, 0x0415, 0x0416, 0x0417,
+        0x0418, 0x0419, 0x041A, 0x041B, 0x041C, 0x041D, 0x041E, 0x041F,
+        0x0420, 0x0421, 0x0422, 0x0423, 0x0424, 0x0425, 0x0426, 0x0427,
+        0x0428, 0x0429, 0x042A, 0x042B, 0x042C, 0x042D, 0x042E, 0x042F,
+        0x0430, 0x0431, 0x0432, 0x0433, 0x0434, 0x0435, 0x0436, 0x0437,
+        0x0438, 0x0439, 0x043A, 0x043B, 0x043C, 0x043D, 0x043E, 0x043F,
+        0x0440, 0x0441, 0x0442, 0x0443, 0x0444, 0x0445, 0x0446, 0x0447,
+        0x0448, 0x0449, 0x044A, 0x044B, 0x044C, 0x044D, 0x044E, 0x044F
+    };
+    return t;
+}
+
+//----------------------------------------------------------------------------
+inline
+void appendUtf8(std::string &out, std::uint32_t cp)
+{
+    if (cp<0x80)
+    {
+        out.push_back(char(cp));
+    }
+    else if (cp<0x800)
+    {
+        out.push_back(char(0xC0 | (cp>>6)));
+        out.push_back(char(0x80 | (cp&0x3F)));
+    }
+    else if (cp<0x10000)
+    {
+        out.push_back(char(0xE0 | (cp>>12)));
+        out.push_back(char(0x80 | ((cp>>6)&0x3F)));
+        out.push_back(char(0x80 | (cp&0x3F)));
+    }
+    else
+    {
+        out.push_back(char(0xF0 | (cp>>18)));
+        out.push_back(char(0x80 | ((cp>>12)&0x3F)));
+        out.push_back(char(0x80 | ((cp>>6)&0x3F)));
+        out.push_back(char(0x80 | (cp&0x3F)));
+    }
+}
+
+//----------------------------------------------------------------------------
+//! Проверка одной неASCII последовательности UTF-8
+/*! Возвращает число байт последовательности, если она корректна; с признаком invalid - длину
+    максимальной корректной части (не меньше 1), которую нужно заменить на U+FFFD.
+    0 - данных не хватает, а то, что есть, может быть началом корректной последовательности.
+ */
+inline
+std::size_t checkUtf8Sequence(const unsigned char *p, std::size_t size, bool &invalid)
+{
+    invalid = false;
+
+    unsigned char lead = p[0];
+    std::size_t   len  = 0;
+    unsigned char lo   = 0x80, hi = 0xBF; // Допустимый диапазон второго байта
+
+    if      (lead>=0xC2 && lead<=0xDF) { len = 2; }
+    else if (lead==0xE0)               { len = 3; lo = 0xA0; }
+    else if (lead>=0xE1 && lead<=0xEC) { len = 3; }
+    else if (lead==0xED)               { len = 3; hi = 0x9F; } // Без суррогатов
+    else if (lead>=0xEE && lead<=0xEF) { len = 3; }
+    else if (lead==0xF0)               { len = 4; lo = 0x90; }
+    else if (lead>=0xF1 && lead<=0xF3) { len = 4; }
+    else if (lead==0xF4)               { len = 4; hi = 0x8F; } // Не больше U+10FFFF
+    else
+    {
+        invalid = true;
+        return 1;
+    }
+
+    for(std::size_t i=1; i!=len; ++i)
+    {
+        if (i>=size)
+            return 0;
+
+        unsigned char b = p[i];
+        bool ok = i==1 ? (b>=lo && b<=hi) : (b>=0x80 && b<=0xBF);
+        if (!ok)
+        {
+            invalid = true;
+            return i;
+        }
+    }
+
+    return len;
+}
+
+} // namespace details
+
+//----------------------------------------------------------------------------
+//! Потоковый декодер входа в UTF-8
+/*! BOM, если разрешено его определение, задаёт кодировку и в выход не попадает; без BOM используется
+    кодировка, заданная в конструкторе. Выход отдаётся кусками в sink(const char*, std::size_t):
+    корректный UTF-8 - указателями прямо во входной кусок, остальное - через внутренний буфер.
+    Некорректные последовательности заменяются на U+FFFD и отмечаются ошибкой InvalidEncoding,
+    у которой line==0, а position - смещение байта во входе (с нуля).
+    Последовательности и пары суррогатов, разрезанные границей кусков, собираются между вызовами.
+ */
+class TextDecoder
+{
+    TextEncoding             m_encoding;
+    bool                     m_detectBom;
+    bool                     m_started       = false;  // Проверка BOM уже выполнена
+    std::size_t              m_inputOffset   = 0;      // Позиция во входе начала следующего куска
+    std::string              m_carry;                  // Незавершённая последовательность с конца предыдущего куска
+    std::size_t              m_carryOffset   = 0;      // Позиция m_carry[0] во входе
+    std::uint32_t            m_highSurrogate = 0;      // UTF-16: старший суррогат, ждущий пару
+    std::size_t              m_highOffset    = 0;
+    std::string              m_out;                    // Выход для перекодирования, переиспользуется
+    std::vector<ParseError>  m_errors;
+
+    static const char* replacementChar() { return "\xEF\xBF\xBD"; }
+
+    void addError(const std::string &msg, std::size_t offset)
+    {
+        m_errors.push_back({ ParseErrorType::InvalidEncoding, msg, 0, offset });
+    }
+
+    //----------------------------------------------------------------------------
+    template<typename Sink>
+    void decodeUtf8(const char *pData, std::size_t size, bool bFinal, Sink &sink)
+    {
+        const unsigned char *p = (const unsigned char*)pData;
+        std::size_t pos = 0;
+
+        // Дописываем незавершённую последовательность предыдущего куска - побайтно, их не больше трёх
+        while(!m_carry.empty())
+        {
+            if (pos==size && !bFinal)
+                return;
+
+            if (pos<size)
+                m_carry.push_back(pData[pos++]);
+
+            bool invalid = false;
+            std::size_t len = details::checkUtf8Sequence((const unsigned char*)m_carry.data(), m_carry.size(), invalid);
+            if (!len && pos==size && bFinal)
+            {
+                invalid = true;
+                len     = m_carry.size();
+            }
+
+            if (!len)
+                continue;
+
+            if (invalid)
+            {
+                addError("Invalid UTF-8 sequence", m_carryOffset);
+                sink(replacementChar(), 3);
+            }
+            else
+            {
+                sink(m_carry.data(), len);
+            }
+
+            // Байты после разобранной части пришли из текущего куска - возвращаем их
+            pos -= m_carry.size()-len;
+            m_carry.clear();
+        }
+
+        std::size_t runStart = pos;
+        while(pos<size)
+        {
+            pos += details::simd::asciiPrefixLength(pData+pos, size-pos);
+            if (pos==size)
+                break;
+
+            // Многобайтовые участки проверяются блоками; побайтно - только ошибки и границы блоков
+            pos += details::simd::utf8ValidPrefixLength(pData+pos, size-pos);
+            if (pos==size)
+                break;
+
+            bool invalid = false;
+            std::size_t len = details::checkUtf8Sequence(p+pos, size-pos, invalid);
+            if (!len)
+            {
+                if (bFinal)
+                {
+                    sink(pData+runStart, pos-runStart);
+                    addError("Truncated UTF-8 sequence at end of input", m_inputOffset+pos);
+                    sink(replacementChar(), 3);
+                    runStart = pos = size;
+                    break;
+                }
+
+                // Конец куска посреди последовательности - остаток ждёт следующий кусок
+                sink(pData+runStart, pos-runStart);
+                m_carry.assign(pData+pos, size-pos);
+                m_carryOffset = m_inputOffset+pos;
+                return;
+            }
+
+            if (invalid)
+            {
+                sink(pData+runStart, pos-runStart);
+                addError("Invalid UTF-8 sequence", m_inputOffset+pos);
+                sink(replacementChar(), 3);
+                runStart = pos + len;
+            }
+
+            pos += len;
+        }
+
+        sink(pData+runStart, pos-runStart);
+    }
+
+    //----------------------------------------------------------------------------
+    void putUtf16Unit(std::uint32_t u, std::size_t offset)
+    {
+        if (m_highSurrogate)
+        {
+            if (u>=0xDC00 && u<=0xDFFF)
+            {
+                details::appendUtf8(m_out, 0x10000 + ((m_highSurrogate-0xD800)<<10) + (u-0xDC00));
+                m_highSurrogate = 0;
+                return;
+            }
+
+            addError("Unpaired UTF-16 high surrogate", m_highOffset);
+            m_out.append(replacementChar(), 3);
+            m_highSurrogate = 0;
+        }
+
+        if (u>=0xD800 && u<=0xDBFF)
+        {
+            m_highSurrogate = u;
+            m_highOffset    = offset;
+        }
+        else if (u>=0xDC00 && u<=0xDFFF)
+        {
+            addError("Unpaired UTF-16 low surrogate", offset);
+            m_out.append(replacementChar(), 3);
+        }
+        else
+        {
+            details::appendUtf8(m_out, u);
+        }
+    }
+
+    template<typename Sink>
+    void decodeUtf16(const char *pData, std::size_t size, bool bFinal, Sink &sink)
+    {
+        const unsigned char *p = (const unsigned char*)pData;
+        const bool bigEndian = m_encoding==TextEncoding::Utf16BE;
+
+        m_out.clear();
+        m_out.reserve(size + size/2);
+
+        std::size_t pos = 0;
+        if (!m_carry.empty() && size)
+        {
+            // Нечётный байт с конца предыдущего куска
+            unsigned char b0 = (unsigned char)m_carry[0], b1 = p[0];
+            putUtf16Unit(bigEndian ? (std::uint32_t(b0)<<8 | b1) : (std::uint32_t(b1)<<8 | b0), m_carryOffset);
+            m_carry.clear();
+            pos = 1;
+        }
+
+        for(; pos+2<=size; pos+=2)
+        {
+            std::uint32_t u = bigEndian ? (std::uint32_t(p[pos])<<8 | p[pos+1]) : (std::uint32_t(p[pos+1])<<8 | p[pos]);
+            if (u<0x80 && !m_highSurrogate)
+                m_out.push_back(char(u));
+            else
+                putUtf16Unit(u, m_inputOffset+pos);
+        }
+
+        if (pos<size)
+        {
+            m_carry.assign(pData+pos, 1);
+            m_carryOffset = m_inputOffset+pos;
+        }
+
+        if (bFinal && (m_highSurrogate || !m_carry.empty()))
+        {
+            // Старший суррогат и нечётный байт в конце - одна оборванная последовательность
+            if (m_highSurrogate)
+                addError(m_carry.empty() ? "Unpaired UTF-16 high surrogate" : "Truncated UTF-16 input", m_highOffset);
+            else
+                addError("Odd number of bytes in UTF-16 input", m_carryOffset);
+
+            m_out.append(replacementChar(), 3);
+            m_highSurrogate = 0;
+            m_carry.clear();
+        }
+
+        sink(m_out.data(), m_out.size());
+    }
+
+    //----------------------------------------------------------------------------
+    template<typename Sink>
+    void decodeCp1251(const char *pData, std::size_t size, Sink &sink)
+    {
+        const std::uint16_t *table = details::cp1251HighTable();
+
+        m_out.clear();
+        m_out.reserve(size*2);
+
+        std::size_t pos = 0;
+        while(pos<size)
+        {
+            std::size_t asciiLen = details::simd::asciiPrefixLength(pData+pos, size-pos);
+            m_out.append(pData+pos, asciiLen);
+            pos += asciiLen;
+
+            for(; pos<size && (unsigned char)pData[pos]>=0x80u; ++pos)
+            {
+                std::uint16_t cp = table[(unsigned char)pData[pos]-0x80u];
+                if (cp==0xFFFD)
+                    addError("Undefined CP1251 character", m_inputOffset+pos);
+                details::appendUtf8(m_out, cp);
+            }
+        }
+
+        sink(m_out.data(), m_out.size());
+    }
+
+public:
+
+    explicit TextDecoder(TextEncoding defaultEncoding=TextEncoding::Utf8, bool detectBom=true)
+    : m_encoding(defaultEncoding)
+    , m_detectBom(detectBom)
+    {}
+
+    //! Декодирует очередной кусок; bFinal - это последний кусок входа
+    template<typename Sink>
+    void decode(const char *pData, std::size_t size, bool bFinal, Sink &&sink)
+    {
+        if (!m_started)
+        {
+            if (m_detectBom)
+            {
+                // Для проверки BOM нужны первые три байта - короткие первые куски копим
+                if (m_carry.size()+size<3 && !bFinal)
+                {
+                    m_carry.append(pData, size);
+                    m_inputOffset += size;
+                    return;
+                }
+
+                std::string head = m_carry;
+                head.append(pData, std::min(size, std::size_t(3)));
+                std::size_t bomSize = detectBom(head.data(), head.size(), m_encoding);
+
+                std::size_t carried = m_carry.size();
+                m_carry.clear();
+                m_started = true;
+
+                // Входные байты, которые были накоплены, но не вошли в BOM, декодируются отдельно
+                if (bomSize<carried)
+                {
+                    std::size_t offset = m_inputOffset;
+                    m_inputOffset = offset - carried + bomSize;
+                    std::string rest = head.substr(bomSize, carried-bomSize);
+                    decode(rest.data(), rest.size(), bFinal && !size, sink);
+                    m_inputOffset = offset;
+                }
+
+                std::size_t skip = bomSize>carried ? bomSize-carried : 0;
+                pData += skip;
+                size  -= skip;
+                m_inputOffset += skip;
+            }
+
+            m_started = true;
+        }
+
+        switch(m_encoding)
+        {
+            case TextEncoding::Utf8   : decodeUtf8(pData, size, bFinal, sink); break;
+            case TextEncoding::Utf16LE:
+            case TextEncoding::Utf16BE: decodeUtf16(pData, size, bFinal, sink); break;
+            case TextEncoding::Cp1251 : decodeCp1251(pData, size, sink); break;
+        }
+
+        m_inputOffset += size;
+    }
+
+    //! Кодировка входа - после первого куска учитывает BOM
+    TextEncoding encoding() const { return m_encoding; }
+
+    const std::vector<ParseError>& errors() const { return m_errors; }
+
+}; // class TextDecoder
+
+//----------------------------------------------------------------------------
+//! CsvPushParser с декодером входа - принимает UTF-8 (с BOM и без), UTF-16 и CP1251
+/*! Строки и позиции ошибок разбора - в UTF-8, ошибки кодировки - отдельно, в encodingErrors().
+    Корректный UTF-8 не копируется ни декодером, ни парсером - кроме полей записи, которую
+    разрезала граница куска.
+ */
+class DecodingCsvPushParser
+{
+
+public:
+
+    using RowCallback = CsvPushParser::RowCallback;
+
+private:
+
+    TextDecoder     m_decoder;
+    CsvPushParser   m_parser;
+
+    void feedDecoded(const char *pData, std::size_t size, bool bFinal)
+    {
+        m_decoder.decode(pData, size, bFinal, [&](const char *pOut, std::size_t outSize)
+        {
+            m_parser.feed(pOut, outSize);
+        });
+    }
+
+public:
+
+    explicit DecodingCsvPushParser(TextEncoding defaultEncoding=TextEncoding::Utf8, char delim=',', char quot='\"', bool strict=true)
+    : m_decoder(defaultEncoding)
+    , m_parser(delim, quot, strict)
+    {}
+
+    DecodingCsvPushParser(RowCallback rowCallback, TextEncoding defaultEncoding=TextEncoding::Utf8, char delim=',', char quot='\"', bool strict=true)
+    : m_decoder(defaultEncoding)
+    , m_parser(std::move(rowCallback), delim, quot, strict)
+    {}
+
+    void feed(const char *pData, std::size_t size)
+    {
+        if (size)
+            feedDecoded(pData, size, false);
+    }
+
+    void feed(std::string_view data)
+    {
+        feed(data.data(), data.size());
+    }
+
+    void finish()
+    {
+        feedDecoded("", 0, true);
+        m_parser.finish();
+    }
+
+    bool popRow(std::vector<std::string> &row) { return m_parser.popRow(row); }
+
+    std::size_t rowsPending() const { return m_parser.rowsPending(); }
+
+    const std::vector<ParseError>& errors() const { return m_parser.errors(); }
+
+    const std::vector<ParseError>& encodingErrors() const { return m_decoder.errors(); }
+
+    TextEncoding encoding() const { return m_decoder.encoding(); }
+
+}; // class DecodingCsvPushParser
+
+//----------------------------------------------------------------------------
+//! Разбор входа в кодировке из BOM или defaultEncoding; строки результата - в UTF-8
+/*! Вход декодируется кусками по chunkSize байт прямо перед разбором. В errors сначала
+    ошибки кодировки (line==0, position - смещение во входе), затем ошибки разбора.
+ */
+inline
+ParseResult parseEncoded( std::string_view content, TextEncoding defaultEncoding=TextEncoding::Utf8
+                        , char delim=',', char quot='\"', bool strict=true, std::size_t chunkSize=256*1024
+                        )
+{
+    ParseResult result;
+
+    DecodingCsvPushParser parser([&](const std::vector<std::string> &row) { result.data.push_back(row); }, defaultEncoding, delim, quot, strict);
+
+    if (!chunkSize)
+        chunkSize = content.size();
+
+    for(std::size_t pos=0; pos<content.size(); pos+=chunkSize)
+        parser.feed(content.data()+pos, std::min(chunkSize, content.size()-pos));
+
+    parser.finish();
+
+    result.errors = parser.encodingErrors();
+    result.errors.insert(result.errors.end(), parser.errors().begin(), parser.errors().end());
+
+    return result;
+}
+
+//----------------------------------------------------------------------------
+
+} // namespace csv
+} // namespace marty
@@ -0,0 +1,275 @@
+/* \file
+   \brief marty_csv_file - разбор CSV файлов через отображение в память
+
+ */
+
+#pragma once
+
+#include "marty_csv_new.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX // Иначе макросы min/max из windows.h ломают std::min/std::max
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+
+namespace marty {
+namespace csv {
+
+//----------------------------------------------------------------------------
+//! Файл, отображённый в память только для чтения
+class MappedFile
+{
+
+public:
+
+    static const unsigned HintSequential = 0x01; //!< Файл читается последовательно - агрессивное упреждающее чтение
+    static const unsigned HintRandom     = 0x02; //!< Произвольный доступ - упреждающее чтение не нужно
+    static const unsigned HintHugePages  = 0x04; //!< Попросить ядро использовать большие страницы, если это возможно
+
+private:
+
+    const char   *m_pData = 0;
+    std::size_t   m_size  = 0;
+
+#if defined(_WIN32)
+    HANDLE        m_hFile    = INVALID_HANDLE_VALUE;
+    HANDLE        m_hMapping = 0;
+#else
+    int           m_fd       = -1;
+#endif
+
+    void swap(MappedFile &other)
+    {
+        std::swap(m_pData   , other.m_pData   );
+        std::swap(m_size    , other.m_size    );
+#if defined(_WIN32)
+        std::swap(m_hFile   , other.m_hFile   );
+        std::swap(m_hMapping, other.m_hMapping);
+#else
+        std::swap(m_fd      , other.m_fd      );
+#endif
+    }
+
+public:
+
+    MappedFile() = default;
+
+    explicit MappedFile(const std::string &path, unsigned hints=HintSequential|HintHugePages)
+    {
+        open(path, hints);
+    }
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile &&other)
+    {
+        swap(other);
+    }
+
+    MappedFile& operator=(MappedFile &&other)
+    {
+        if (this!=&other)
+        {
+            close();
+            swap(other);
+        }
+        return *this;
+    }
+
+    //! Открывает и отображает файл. Пустой файл открывается успешно, но data() возвращает 0
+    bool open(const std::string &path, unsigned hints=HintSequential|HintHugePages)
+    {
+        close();
+
+#if defined(_WIN32)
+
+        m_hFile = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING
+                             , (hints&HintRandom) ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN
+                             , 0
+                             );
+        if (m_hFile==INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(m_hFile, &fileSize))
+        {
+            close();
+            return false;
+        }
+
+        m_size = std::size_t(fileSize.QuadPart);
+        if (!m_size)
+            return true;
+
+        m_hMapping = CreateFileMappingA(m_hFile, 0, PAGE_READONLY, 0, 0, 0);
+        if (!m_hMapping)
+        {
+            close();
+            return false;
+        }
+
+        m_pData = (const char*)MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+        if (!m_pData)
+        {
+            close();
+            return false;
+        }
+
+#else
+
+        m_fd = ::open(path.c_str(), O_RDONLY);
+        if (m_fd<0)
+            return false;
+
+        struct stat st;
+        if (::fstat(m_fd, &st)!=0)
+        {
+            close();
+            return false;
+        }
+
+        m_size = std::size_t(st.st_size);
+        if (!m_size)
+            return true;
+
+        void *p = ::mmap(0, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+        if (p==MAP_FAILED)
+        {
+            m_size = 0;
+            close();
+            return false;
+        }
+
+        m_pData = (const char*)p;
+
+        // Подсказки ядру - ошибки не критичны, просто игнорируем
+        if (hints&HintSequential)
+            ::madvise(p, m_size, MADV_SEQUENTIAL);
+        if (hints&HintRandom)
+            ::madvise(p, m_size, MADV_RANDOM);
+    #if defined(MADV_HUGEPAGE)
+        if (hints&HintHugePages)
+            ::madvise(p, m_size, MADV_HUGEPAGE);
+    #endif
+
+#endif
+
+        return true;
+    }
+
+    void close()
+    {
+#if defined(_WIN32)
+        if (m_pData)
+            UnmapViewOfFile(m_pData);
+        if (m_hMapping)
+            CloseHandle(m_hMapping);
+        if (m_hFile!=INVALID_HANDLE_VALUE)
+            CloseHandle(m_hFile);
+        m_hMapping = 0;
+        m_hFile    = INVALID_HANDLE_VALUE;
+#else
+        if (m_pData)
+            ::munmap((void*)m_pData, m_size);
+        if (m_fd>=0)
+            ::close(m_fd);
+        m_fd = -1;
+#endif
+        m_pData = 0;
+        m_size  = 0;
+    }
+
+    bool isOpen() const
+    {
+#if defined(_WIN32)
+        return m_hFile!=INVALID_HANDLE_VALUE;
+#else
+        return m_fd>=0;
+#endif
+    }
+
+    const char* data() const { return m_pData; }
+    std::size_t size() const { return m_size; }
+
+    std::string_view view() const
+    {
+        return m_pData ? std::string_view(m_pData, m_size) : std::string_view();
+    }
+
+}; // class MappedFile
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+namespace details {
+
+//----------------------------------------------------------------------------
+//! Нулевые delim/quot определяются по данным
+inline
+void resolveDialect(std::string_view data, char &delim, char &quot)
+{
+    if (!quot)
+    {
+        // Кавычки и разделитель - за один проход по нескольким окнам файла
+        Dialect dialect = detectDialectSampled(data);
+        quot = dialect.quot ? dialect.quot : '\"';
+        if (!delim)
+            delim = dialect.delim; // Без найденных кавычек разделитель определён для '"'
+    }
+
+    if (!delim)
+        delim = detectSeparators(data.begin(), data.end(), std::string("\t;,:|#"), quot);
+}
+
+} // namespace details
+
+//----------------------------------------------------------------------------
+//! Разбор файла. Нулевые delim/quot определяются автоматически. false - файл не удалось открыть
+inline
+bool parseFile(const std::string &path, ParseResult &result, char delim=0, char quot=0, bool strict=true)
+{
+    MappedFile file;
+    if (!file.open(path))
+        return false;
+
+    details::resolveDialect(file.view(), delim, quot);
+
+    auto parser = details::CsvParser(delim, quot, strict);
+    result = parser.parse(file.view());
+    return true;
+}
+
+//----------------------------------------------------------------------------
+//! Разбор отображённого файла без копирования - результат ссылается на file и должен жить не дольше него
+inline
+ViewParseResult parseFileView(const MappedFile &file, char delim=0, char quot=0, bool strict=true)
+{
+    details::resolveDialect(file.view(), delim, quot);
+    return parseView(file.view(), delim, quot, strict);
+}
+
+//----------------------------------------------------------------------------
+
+} // namespace csv
+} // namespace marty
@@ -0,0 +1,691 @@
+/* \file
+   \brief marty_csv_index - индексы для произвольного доступа к большим CSV файлам
+
+   RowIndex хранит смещение начала каждой step-ой записи и сохраняется в файл рядом с исходным
+   (по умолчанию - путь исходного файла плюс ".idx"). KeyIndex - хеш-индекс по ключевой колонке,
+   хранится на диске в виде таблицы с открытой адресацией, которая отображается в память
+   (по умолчанию - путь исходного файла плюс ".kidx"). Оба индекса привязаны к размеру и времени
+   модификации исходного файла и при их изменении считаются устаревшими.
+
+   Формат файла RowIndex - заголовок IndexFileHeader, затем entriesCount пар (смещение, номер строки).
+   Формат файла KeyIndex - заголовок KeyIndexFileHeader, затем capacity слотов KeyIndexSlot.
+   Всё хранится в виде 64-битных чисел в порядке байт машины, на которой индекс построен.
+
+ */
+
+#pragma once
+
+#include "marty_csv_file.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/stat.h>
+#endif
+
+
+namespace marty {
+namespace csv {
+
+namespace details {
+
+//----------------------------------------------------------------------------
+//! Размер и время модификации файла - по ним проверяется актуальность индекса
+inline
+bool getFileStamp(const std::string &path, std::uint64_t &size, std::uint64_t &mtime)
+{
+#if defined(_WIN32)
+    WIN32_FILE_ATTRIBUTE_DATA fad;
+    if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &fad))
+        return false;
+
+    size  = (std::uint64_t(fad.nFileSizeHigh)<<32) | fad.nFileSizeLow;
+    mtime = (std::uint64_t(fad.ftLastWriteTime.dwHighDateTime)<<32) | fad.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat st;
+    if (::stat(path.c_str(), &st)!=0)
+        return false;
+
+    size  = std::uint64_t(st.st_size);
+    #if defined(__APPLE__)
+    mtime = std::uint64_t(st.st_mtimespec.tv_sec)*1000000000ull + std::uint64_t(st.st_mtimespec.tv_nsec);
+    #else
+    mtime = std::uint64_t(st.st_mtim.tv_sec)*1000000000ull + std::uint64_t(st.st_mtim.tv_nsec);
+    #endif
+#endif
+    return true;
+}
+
+//----------------------------------------------------------------------------
+struct IndexFileHeader
+{
+    char           magic[8];      //!< "MCSVRIDX"
+    std::uint32_t  version;
+    std::uint32_t  step;
+    std::uint64_t  sourceSize;
+    std::uint64_t  sourceMtime;
+    std::uint64_t  rowsCount;
+    std::uint64_t  columnsCount;  //!< Колонок в первой строке - для проверки строк при разборе с середины
+    std::uint64_t  entriesCount;
+    char           delim;
+    char           quot;
+    char           strict;
+    char           reserved[5];
+};
+
+//----------------------------------------------------------------------------
+struct KeyIndexFileHeader
+{
+    char           magic[8];      //!< "MCSVKIDX"
+    std::uint32_t  version;
+    std::uint32_t  keyColumn;
+    std::uint64_t  sourceSize;
+    std::uint64_t  sourceMtime;
+    std::uint64_t  capacity;      //!< Число слотов, степень двойки
+    std::uint64_t  keysCount;
+    char           delim;
+    char           quot;
+    char           hasHeader;
+    char           reserved[5];
+};
+
+//----------------------------------------------------------------------------
+struct KeyIndexSlot
+{
+    std::uint64_t  hash;
+    std::uint64_t  offset;        //!< Смещение записи плюс один; 0 - слот пуст
+};
+
+//----------------------------------------------------------------------------
+//! FNV-1a - хеш не зависит от платформы, индекс можно переносить вместе с файлом
+inline
+std::uint64_t hashKey(std::string_view key)
+{
+    std::uint64_t h = 0xCBF29CE484222325ull;
+    for(auto ch : key)
+    {
+        h ^= (unsigned char)ch;
+        h *= 0x100000001B3ull;
+    }
+    return h;
+}
+
+//----------------------------------------------------------------------------
+//! Разбирает одну запись, начинающуюся с позиции offset; false - записи там нет
+inline
+bool parseRowAt(std::string_view content, std::size_t offset, char delim, char quot, std::vector<std::string> &row)
+{
+    if (offset>=content.size())
+        return false;
+
+    std::size_t window = 4096;
+    for(;;)
+    {
+        std::size_t len = (std::min)(window, content.size()-offset);
+        bool bFinal = offset+len==content.size();
+        bool found  = false;
+
+        std::vector<ParseError> errors;
+        auto parser = CsvParser(delim, quot, false);
+        parser.resetState();
+        parser.parseChunk(content.data()+offset, len, offset, bFinal, errors, [&](const FieldSpan *pFields, std::size_t numFields)
+        {
+            if (!found)
+            {
+                row.clear();
+                spansToStrings(pFields, numFields, parser.quot(), row);
+                found = true;
+            }
+        });
+
+        if (found || bFinal)
+            return found;
+
+        window *= 2; // Запись не поместилась в окно
+    }
+}
+
+} // namespace details
+
+//----------------------------------------------------------------------------
+//! Индекс смещений строк CSV
+/*! Хранит смещение начала каждой step-ой записи (строки в смысле ParseResult::data) и номер строки,
+    с которым её видит последовательный разбор. Построение - один проход CsvParser по всему входу,
+    с учётом кавычек, так что записи с переводами строки внутри полей не ломают индекс.
+ */
+class RowIndex
+{
+public:
+
+    struct Entry
+    {
+        std::uint64_t offset; //!< Смещение начала записи
+        std::uint64_t line;   //!< Номер строки записи, как в ParseError::line
+    };
+
+    static const std::uint32_t version = 1;
+
+protected:
+
+    std::vector<Entry>  m_entries;
+    std::uint32_t       m_step         = 1024;
+    std::uint64_t       m_rowsCount    = 0;
+    std::uint64_t       m_columnsCount = 0;
+    std::uint64_t       m_sourceSize   = 0;
+    std::uint64_t       m_sourceMtime  = 0;
+    char                m_delim        = ';';
+    char                m_quot         = '\"';
+    bool                m_strict       = true;
+
+public:
+
+    RowIndex() = default;
+
+    std::uint32_t step        () const { return m_step; }
+    std::size_t   rowsCount   () const { return std::size_t(m_rowsCount); }
+    std::size_t   columnsCount() const { return std::size_t(m_columnsCount); }
+    char          delimiter   () const { return m_delim; }
+    char          quot        () const { return m_quot; }
+    bool          strict      () const { return m_strict; }
+
+    const std::vector<Entry>& entries() const { return m_entries; }
+
+    //! Строит индекс по content; step - через сколько записей сохранять смещение
+    void build(std::string_view content, char delim=',', char quot='\"', bool strict=true, std::uint32_t step=1024)
+    {
+        auto parser = details::CsvParser(delim, quot, strict);
+
+        m_delim        = parser.delimiter();
+        m_quot         = parser.quot();
+        m_strict       = strict;
+        m_step         = step ? step : 1u;
+        m_rowsCount    = 0;
+        m_columnsCount = 0;
+        m_sourceSize   = content.size();
+        m_sourceMtime  = 0;
+        m_entries.clear();
+
+        std::vector<ParseError> errors; // Ошибки здесь не нужны - их вернёт readRows
+        parser.parseSpans(content.data(), content.size(), errors, [&](const details::FieldSpan*, std::size_t numFields)
+        {
+            if (!m_rowsCount)
+                m_columnsCount = numFields;
+
+            if (m_rowsCount%m_step==0)
+                m_entries.push_back(Entry{ std::uint64_t(parser.rowStartPos()), std::uint64_t(parser.currentLine()) });
+
+            ++m_rowsCount;
+        });
+    }
+
+    //! Разбирает только строки [first, first+count) - от ближайшей предшествующей точки индекса
+    /*! content - тот же вход, по которому построен индекс. Номера строк и позиции в ошибках
+        совпадают с последовательным разбором всего входа; возвращаются только ошибки
+        запрошенных строк.
+     */
+    ParseResult readRows(std::string_view content, std::size_t first, std::size_t count) const
+    {
+        ParseResult result;
+
+        if (first>=m_rowsCount || !count || m_entries.empty())
+            return result;
+
+        if (count>m_rowsCount-first)
+            count = std::size_t(m_rowsCount-first);
+
+        std::size_t firstEntry = first/m_step;
+        std::size_t lastEntry  = (first+count-1)/m_step;
+
+        std::size_t begin = std::size_t(m_entries[firstEntry].offset);
+        std::size_t end   = lastEntry+1<m_entries.size() ? std::size_t(m_entries[lastEntry+1].offset) : content.size();
+        if (begin>end || end>content.size())
+            return result;
+
+        std::size_t lineBase = std::size_t(m_entries[firstEntry].line) - 1;
+        std::size_t rowIdx   = firstEntry*m_step;
+        std::size_t firstLine = 0, lastLine = 0;
+
+        auto parser = details::CsvParser(m_delim, m_quot, m_strict);
+        parser.resetState(details::lineStartForBoundary(content, begin), firstEntry ? std::size_t(m_columnsCount) : 0u);
+
+        std::vector<ParseError> errors;
+        result.data.reserve(count);
+
+        parser.parseChunk(content.data()+begin, end-begin, begin, true, errors, [&](const details::FieldSpan *pFields, std::size_t numFields)
+        {
+            if (rowIdx>=first && rowIdx<first+count)
+            {
+                if (rowIdx==first)
+                    firstLine = parser.currentLine();
+                lastLine = parser.currentLine();
+
+                result.data.emplace_back();
+                details::spansToStrings(pFields, numFields, m_quot, result.data.back());
+            }
+            ++rowIdx;
+        });
+
+        for(auto &e : errors)
+        {
+            if (e.line<firstLine || e.line>lastLine)
+                continue;
+            e.line += lineBase;
+            result.errors.emplace_back(std::move(e));
+        }
+
+        return result;
+    }
+
+    //! Сохраняет индекс, привязывая его к текущим размеру и времени модификации sourcePath
+    bool save(const std::string &indexPath, const std::string &sourcePath)
+    {
+        std::uint64_t size = 0;
+        if (!details::getFileStamp(sourcePath, size, m_sourceMtime) || size!=m_sourceSize)
+            return false;
+
+        details::IndexFileHeader hdr;
+        std::memset(&hdr, 0, sizeof(hdr));
+        std::memcpy(hdr.magic, "MCSVRIDX", 8);
+        hdr.version      = version;
+        hdr.step         = m_step;
+        hdr.sourceSize   = m_sourceSize;
+        hdr.sourceMtime  = m_sourceMtime;
+        hdr.rowsCount    = m_rowsCount;
+        hdr.columnsCount = m_columnsCount;
+        hdr.entriesCount = m_entries.size();
+        hdr.delim        = m_delim;
+        hdr.quot         = m_quot;
+        hdr.strict       = m_strict ? 1 : 0;
+
+        std::FILE *fp = std::fopen(indexPath.c_str(), "wb");
+        if (!fp)
+            return false;
+
+        bool ok = std::fwrite(&hdr, sizeof(hdr), 1, fp)==1;
+        if (ok && !m_entries.empty())
+            ok = std::fwrite(m_entries.data(), sizeof(Entry), m_entries.size(), fp)==m_entries.size();
+
+        ok = std::fclose(fp)==0 && ok;
+        if (!ok)
+            std::remove(indexPath.c_str());
+
+        return ok;
+    }
+
+    //! Загружает индекс; false - файла нет, он повреждён или не соответствует текущему sourcePath
+    bool load(const std::string &indexPath, const std::string &sourcePath)
+    {
+        std::uint64_t size = 0, mtime = 0, indexSize = 0, indexMtime = 0;
+        if (!details::getFileStamp(sourcePath, size, mtime) || !details::getFileStamp(indexPath, indexSize, indexMtime))
+            return false;
+
+        if (indexSize<sizeof(details::IndexFileHeader))
+            return false;
+
+        std::FILE *fp = std::fopen(indexPath.c_str(), "rb");
+        if (!fp)
+            return false;
+
+        details::IndexFileHeader hdr;
+        bool ok = std::fread(&hdr, sizeof(hdr), 1, fp)==1
+               && std::memcmp(hdr.magic, "MCSVRIDX", 8)==0
+               && hdr.version==version
+               && hdr.step!=0
+               && hdr.sourceSize==size
+               && hdr.sourceMtime==mtime
+               && hdr.entriesCount==(hdr.rowsCount+hdr.step-1)/hdr.step
+               // Размер проверяется до resize - иначе испорченный rowsCount приведёт к огромному выделению
+               && hdr.entriesCount==(indexSize-sizeof(details::IndexFileHeader))/sizeof(Entry)
+               && indexSize==sizeof(details::IndexFileHeader) + hdr.entriesCount*sizeof(Entry);
+
+        std::vector<Entry> entries;
+        if (ok)
+        {
+            entries.resize(std::size_t(hdr.entriesCount));
+            if (!entries.empty())
+                ok = std::fread(entries.data(), sizeof(Entry), entries.size(), fp)==entries.size();
+        }
+
+        std::fclose(fp);
+
+        // Смещения точек входа должны возрастать и не выходить за исходный файл
+        for(std::size_t i=0; ok && i!=entries.size(); ++i)
+            ok = entries[i].offset<=size && (!i || entries[i-1].offset<entries[i].offset);
+
+        if (!ok)
+            return false;
+
+        m_entries.swap(entries);
+        m_step         = hdr.step;
+        m_rowsCount    = hdr.rowsCount;
+        m_columnsCount = hdr.columnsCount;
+        m_sourceSize   = hdr.sourceSize;
+        m_sourceMtime  = hdr.sourceMtime;
+        m_delim        = hdr.delim;
+        m_quot         = hdr.quot;
+        m_strict       = hdr.strict!=0;
+
+        return true;
+    }
+
+}; // class RowIndex
+
+//----------------------------------------------------------------------------
+//! CSV файл с индексом строк - открывается один раз, дальше строки читаются по номерам
+/*! При открытии загружается индекс из indexPath (по умолчанию path+".idx"). Если его нет,
+    он устарел или построен для другого диалекта - индекс строится заново и сохраняется.
+    Нулевые delim/quot - взять из сохранённого индекса, а при построении - определить по данным.
+ */
+class IndexedCsvFile
+{
+    MappedFile  m_file;
+    RowIndex    m_index;
+
+public:
+
+    IndexedCsvFile() = default;
+
+    bool open(const std::string &path, char delim=0, char quot=0, bool strict=true, std::uint32_t step=1024, std::string indexPath=std::string())
+    {
+        m_file.close();
+
+        if (indexPath.empty())
+            indexPath = path + ".idx";
+
+        bool loaded = m_index.load(indexPath, path)
+                   && (!delim || delim==m_index.delimiter())
+                   && (!quot  || quot ==m_index.quot())
+                   && strict==m_index.strict();
+
+        if (!loaded)
+        {
+            MappedFile scanFile;
+            if (!scanFile.open(path, MappedFile::HintSequential|MappedFile::HintHugePages))
+                return false;
+
+            details::resolveDialect(scanFile.view(), delim, quot);
+            m_index.build(scanFile.view(), delim, quot, strict, step);
+            m_index.save(indexPath, path); // Не удалось сохранить - не страшно, индекс есть в памяти
+        }
+
+        return m_file.open(path, MappedFile::HintRandom);
+    }
+
+    bool isOpen() const { return m_file.isOpen(); }
+
+    const RowIndex& index() const { return m_index; }
+
+    std::size_t rowsCount() const { return m_index.rowsCount(); }
+
+    //! Строки [first, first+count); разбирается только нужный участок файла
+    ParseResult readRows(std::size_t first, std::size_t count) const
+    {
+        return m_index.readRows(m_file.view(), first, count);
+    }
+
+}; // class IndexedCsvFile
+
+//----------------------------------------------------------------------------
+//! Хеш-индекс по ключевой колонке для поиска записей по ключу
+/*! Строится за один проход по файлу и записывается на диск как таблица с открытой адресацией
+    (линейное пробирование, заполнение не больше половины). Для поиска файл индекса отображается
+    в память - в памяти процесса нет ничего, кроме страниц индекса, которых коснулся поиск.
+    По ключу хранится только хеш и смещение записи; совпадение ключа проверяется разбором записи.
+ */
+class KeyIndex
+{
+public:
+
+    static const std::uint32_t version = 1;
+
+protected:
+
+    MappedFile                            m_indexFile;
+    const details::KeyIndexFileHeader    *m_pHeader = 0;
+    const details::KeyIndexSlot          *m_pSlots  = 0;
+
+public:
+
+    KeyIndex() = default;
+
+    //! Строит индекс по content - содержимому sourcePath - и записывает его в indexPath
+    /*! Записи, в которых нет колонки keyColumn, в индекс не попадают. Если hasHeader - первая запись
+        считается заголовком и тоже не индексируется.
+     */
+    static
+    bool build( std::string_view content, const std::string &indexPath, const std::string &sourcePath
+              , std::size_t keyColumn, char delim=',', char quot='\"', bool hasHeader=false
+              )
+    {
+        std::uint64_t size = 0, mtime = 0;
+        if (!details::getFileStamp(sourcePath, size, mtime) || size!=content.size())
+            return false;
+
+        auto parser = details::CsvParser(delim, quot, false);
+
+        std::vector<details::KeyIndexSlot> keys;
+        std::string unescapeBuf;
+        bool headerPending = hasHeader;
+
+        std::vector<ParseError> errors;
+        parser.parseSpans(content.data(), content.size(), errors, [&](const details::FieldSpan *pFields, std::size_t numFields)
+        {
+            if (headerPending)
+            {
+                headerPending = false;
+                return;
+            }
+
+            if (keyColumn>=numFields)
+                return;
+
+            const auto &fs = pFields[keyColumn];
+            auto key = details::trimFieldSpan(fs);
+            if (fs.escaped())
+            {
+                unescapeBuf.clear();
+                details::appendUnescaped(unescapeBuf, key, parser.quot());
+                key = std::string_view(unescapeBuf);
+            }
+
+            keys.push_back(details::KeyIndexSlot{ details::hashKey(key), std::uint64_t(parser.rowStartPos())+1u });
+        });
+
+        std::uint64_t capacity = 16;
+        while(capacity<keys.size()*2)
+            capacity *= 2;
+
+        // Записи вставляются по порядку - при повторах ключа раньше по пробированию стоит первая запись
+        std::vector<details::KeyIndexSlot> slots(std::size_t(capacity), details::KeyIndexSlot{0, 0});
+        for(const auto &k : keys)
+        {
+            std::size_t idx = std::size_t(k.hash&(capacity-1));
+            while(slots[idx].offset)
+                idx = std::size_t((idx+1)&(capacity-1));
+            slots[idx] = k;
+        }
+
+        details::KeyIndexFileHeader hdr;
+        std::memset(&hdr, 0, sizeof(hdr));
+        std::memcpy(hdr.magic, "MCSVKIDX", 8);
+        hdr.version     = version;
+        hdr.keyColumn   = std::uint32_t(keyColumn);
+        hdr.sourceSize  = size;
+        hdr.sourceMtime = mtime;
+        hdr.capacity    = capacity;
+        hdr.keysCount   = keys.size();
+        hdr.delim       = parser.delimiter();
+        hdr.quot        = parser.quot();
+        hdr.hasHeader   = hasHeader ? 1 : 0;
+
+        std::FILE *fp = std::fopen(indexPath.c_str(), "wb");
+        if (!fp)
+            return false;
+
+        bool ok = std::fwrite(&hdr, sizeof(hdr), 1, fp)==1
+               && std::fwrite(slots.data(), sizeof(details::KeyIndexSlot), slots.size(), fp)==slots.size();
+
+        ok = std::fclose(fp)==0 && ok;
+        if (!ok)
+            std::remove(indexPath.c_str());
+
+        return ok;
+    }
+
+    //! Открывает индекс; false - файла нет, он повреждён или не соответствует текущему sourcePath
+    bool open(const std::string &indexPath, const std::string &sourcePath)
+    {
+        close();
+
+        std::uint64_t size = 0, mtime = 0;
+        if (!details::getFileStamp(sourcePath, size, mtime))
+            return false;
+
+        if (!m_indexFile.open(indexPath, MappedFile::HintRandom) || m_indexFile.size()<sizeof(details::KeyIndexFileHeader))
+        {
+            close();
+            return false;
+        }
+
+        auto pHeader = reinterpret_cast<const details::KeyIndexFileHeader*>(m_indexFile.data());
+        bool ok = std::memcmp(pHeader->magic, "MCSVKIDX", 8)==0
+               && pHeader->version==version
+               && pHeader->sourceSize==size
+               && pHeader->sourceMtime==mtime
+               && pHeader->capacity!=0
+               && (pHeader->capacity&(pHeader->capacity-1))==0
+               && pHeader->capacity==(m_indexFile.size()-sizeof(details::KeyIndexFileHeader))/sizeof(details::KeyIndexSlot)
+               && m_indexFile.size()==sizeof(details::KeyIndexFileHeader) + pHeader->capacity*sizeof(details::KeyIndexSlot)
+               && pHeader->keysCount<=pHeader->capacity/2; // build оставляет не меньше половины слотов пустыми
+
+        if (!ok)
+        {
+            close();
+            return false;
+        }
+
+        m_pHeader = pHeader;
+        m_pSlots  = reinterpret_cast<const details::KeyIndexSlot*>(m_indexFile.data() + sizeof(details::KeyIndexFileHeader));
+        return true;
+    }
+
+    void close()
+    {
+        m_indexFile.close();
+        m_pHeader = 0;
+        m_pSlots  = 0;
+    }
+
+    bool isOpen() const { return m_pHeader!=0; }
+
+    std::size_t keyColumn() const { return m_pHeader ? std::size_t(m_pHeader->keyColumn) : 0u; }
+    std::size_t keysCount() const { return m_pHeader ? std::size_t(m_pHeader->keysCount) : 0u; }
+    char        delimiter() const { return m_pHeader ? m_pHeader->delim : char(0); }
+    char        quot     () const { return m_pHeader ? m_pHeader->quot  : char(0); }
+    bool        hasHeader() const { return m_pHeader && m_pHeader->hasHeader!=0; }
+
+    //! Ищет первую запись с ключом key; content - тот же файл, по которому построен индекс. Разбирается только найденная запись
+    bool lookup(std::string_view content, std::string_view key, std::vector<std::string> &row) const
+    {
+        if (!m_pHeader)
+            return false;
+
+        const std::uint64_t mask = m_pHeader->capacity-1;
+        const std::uint64_t hash = details::hashKey(key);
+
+        // Число проб ограничено ёмкостью - на испорченной таблице без пустых слотов цикл не зациклится
+        std::uint64_t idx = hash&mask;
+        for(std::uint64_t probe=0; probe!=m_pHeader->capacity && m_pSlots[idx].offset; ++probe, idx=(idx+1)&mask)
+        {
+            if (m_pSlots[idx].hash!=hash)
+                continue;
+
+            if ( details::parseRowAt(content, std::size_t(m_pSlots[idx].offset-1), m_pHeader->delim, m_pHeader->quot, row)
+              && m_pHeader->keyColumn<row.size()
+              && row[m_pHeader->keyColumn]==key
+               )
+                return true;
+        }
+
+        row.clear();
+        return false;
+    }
+
+}; // class KeyIndex
+
+//----------------------------------------------------------------------------
+//! CSV файл с хеш-индексом по ключевой колонке
+/*! При открытии индекс берётся из indexPath (по умолчанию path+".kidx"); если его нет, он устарел
+    или построен для другой колонки либо диалекта - строится заново. Нулевые delim/quot - взять
+    из сохранённого индекса, а при построении - определить по данным.
+ */
+class KeyIndexedCsvFile
+{
+    MappedFile  m_file;
+    KeyIndex    m_index;
+
+public:
+
+    KeyIndexedCsvFile() = default;
+
+    bool open( const std::string &path, std::size_t keyColumn, char delim=0, char quot=0, bool hasHeader=false
+             , std::string indexPath=std::string()
+             )
+    {
+        m_file.close();
+
+        if (indexPath.empty())
+            indexPath = path + ".kidx";
+
+        bool loaded = m_index.open(indexPath, path)
+                   && keyColumn==m_index.keyColumn()
+                   && hasHeader==m_index.hasHeader()
+                   && (!delim || delim==m_index.delimiter())
+                   && (!quot  || quot ==m_index.quot());
+
+        if (!loaded)
+        {
+            m_index.close();
+
+            MappedFile scanFile;
+            if (!scanFile.open(path, MappedFile::HintSequential|MappedFile::HintHugePages))
+                return false;
+
+            details::resolveDialect(scanFile.view(), delim, quot);
+            if (!KeyIndex::build(scanFile.view(), indexPath, path, keyColumn, delim, quot, hasHeader))
+                return false;
+
+            if (!m_index.open(indexPath, path))
+                return false;
+        }
+
+        return m_file.open(path, MappedFile::HintRandom);
+    }
+
+    bool isOpen() const { return m_file.isOpen() && m_index.isOpen(); }
+
+    const KeyIndex& index() const { return m_index; }
+
+    //! Первая запись с ключом key
+    bool lookup(std::string_view key, std::vector<std::string> &row) const
+    {
+        return m_index.lookup(m_file.view(), key, row);
+    }
+
+}; // class KeyIndexedCsvFile
+
+//----------------------------------------------------------------------------
+
+} // namespace csv
+} // namespace marty
+
@@ -6,9 +6,27 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iterator>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
+#if !defined(MARTY_CSV_NO_PMR) && defined(__has_include)
+    #if __has_include(<memory_resource>)
+        #include <memory_resource>
+        #define MARTY_CSV_HAS_PMR
+    #endif
+#endif
+
+#include "simd.h"
+
 
 namespace marty {
 namespace csv {
@@ -23,7 +41,10 @@ enum class ParseErrorType
     UnclosedQuote,
     InvalidCharAfterQuote,
     InconsistentColumns,
-    InvalidQuoteUsage
+    InvalidQuoteUsage,
+    InvalidValue        , //!< Значение поля не соответствует типу колонки (разбор по схеме)
+    InvalidEncoding     , //!< Некорректная последовательность во входной кодировке (см. marty_csv_encoding.h)
+    InputError            //!< Ошибка чтения или распаковки входа (см. marty_csv_compressed.h)
 };
 
 inline
@@ -35,6 +56,9 @@ std::string to_string(ParseErrorType peType)
         case ParseErrorType::InvalidCharAfterQuote: return "InvalidCharAfterQuote";
         case ParseErrorType::InconsistentColumns  : return "InconsistentColumns";
         case ParseErrorType::InvalidQuoteUsage    : return "InvalidQuoteUsage";
+        case ParseErrorType::InvalidValue         : return "InvalidValue";
+        case ParseErrorType::InvalidEncoding      : return "InvalidEncoding";
+        case ParseErrorType::InputError           : return "InputError";
         default: return "Unknown";
     }
 }
@@ -55,640 +79,2503 @@ void printError(StreamType &oss, const ParseError &pe)
     oss << pe.line << ":" << pe.position << ": " << to_string(pe.type) << ": " << pe.message; // << "\n";
 }
 
-struct ParseResult
-{
-    std::vector<std::vector<std::string>> data;
-    std::vector<ParseError>               errors;
-};
-
 //----------------------------------------------------------------------------
+constexpr std::size_t parseErrorTypesCount = std::size_t(ParseErrorType::InputError) + 1;
 
+//----------------------------------------------------------------------------
+//! Статистика разбора и определения диалекта
+/*! Заполняется, только если определён MARTY_CSV_ENABLE_STATS и в текущем потоке действует
+    ParseStatsScope; без MARTY_CSV_ENABLE_STATS сбор статистики не компилируется.
+    Счётчики строк и полей и parseNs заполняет любой разбор через BasicCsvParser - parse, parseFlat,
+    parseLazy, parseColumnar, parseView, CsvPushParser и т.д. convertNs отдельно замеряют только
+    parse и parseInto, в остальных случаях работа обработчика строк входит в parseNs.
+ */
+struct ParseStats
+{
+    std::uint64_t  bytesScanned   = 0; //!< Байт (символов) разобрано
+    std::uint64_t  rows           = 0; //!< Строк передано дальше - без отклонённых фильтром
+    std::uint64_t  filteredRows   = 0; //!< Строк отклонено фильтром
+    std::uint64_t  fields         = 0; //!< Полей в переданных строках
+    std::uint64_t  quotedFields   = 0;
+    std::uint64_t  escapedQuotes  = 0; //!< Удвоенных кавычек внутри закавыченных полей
+    std::uint64_t  trimmedFields  = 0; //!< Полей, у которых были обрезаны пробелы
+    std::uint64_t  maxFieldLength = 0; //!< Максимальная длина поля после обрезки и раскавычивания
+    std::uint64_t  maxRowWidth    = 0; //!< Максимальное число полей в строке
+
+    std::array<std::uint64_t, parseErrorTypesCount> errors = {}; //!< Число ошибок по ParseErrorType
+
+    std::uint64_t  detectBytes    = 0; //!< Байт просмотрено при определении диалекта
+    std::uint64_t  detectNs       = 0; //!< Время определения диалекта
+    std::uint64_t  parseNs        = 0; //!< Время в parseChunk за вычетом convertNs
+    std::uint64_t  convertNs      = 0; //!< Время преобразования полей в строки - только parse/parseInto
+
+    std::uint64_t errorsCount(ParseErrorType type) const
+    {
+        return errors[std::size_t(type)];
+    }
 
+    void merge(const ParseStats &other)
+    {
+        bytesScanned   += other.bytesScanned;
+        rows           += other.rows;
+        filteredRows   += other.filteredRows;
+        fields         += other.fields;
+        quotedFields   += other.quotedFields;
+        escapedQuotes  += other.escapedQuotes;
+        trimmedFields  += other.trimmedFields;
+        maxFieldLength  = std::max(maxFieldLength, other.maxFieldLength);
+        maxRowWidth     = std::max(maxRowWidth, other.maxRowWidth);
+
+        for(std::size_t i=0; i!=errors.size(); ++i)
+            errors[i] += other.errors[i];
+
+        detectBytes    += other.detectBytes;
+        detectNs       += other.detectNs;
+        parseNs        += other.parseNs;
+        convertNs      += other.convertNs;
+    }
+};
 
-//----------------------------------------------------------------------------
 namespace details {
 
-
 //----------------------------------------------------------------------------
-struct CLineCharCounts
-{
-    int counts[128];
-};
+#if defined(MARTY_CSV_ENABLE_STATS)
 
-//----------------------------------------------------------------------------
-struct CVarianceItem
+inline
+ParseStats*& currentStatsRef()
 {
-    int D;
-    int M;
-    unsigned ch;
-    // unsigned tag; // 0/1/2 - Simple/Excel/Ex line split method
-    // static const unsigned usedUnquotedOnly    = 0x10;
-    // static const unsigned lineSplitMethodMask = 0x0F;
-
-    CVarianceItem() : D(100000000), M(0), ch(0) /* , tag(0) */  {}
-    CVarianceItem(char c) : D(100000000), M(0), ch((unsigned)c) /* , tag(0) */  {}
-    CVarianceItem(int d, int m, char c) : D(d), M(m), ch((unsigned)c) /* , tag(0) */  {}
-    CVarianceItem(int d, int m, unsigned c) : D(d), M(m), ch(c)/*, tag(0)*/ {}
-    //CVarianceItem(int d, int m, char c     /* , unsigned t */ ) : D(d), M(m), ch((unsigned)c) /* , tag(t) */  {}
-    //CVarianceItem(int d, int m, unsigned c /* , unsigned t */ ) : D(d), M(m), ch(c) /* , tag(t) */  {}
+    thread_local ParseStats *pStats = nullptr;
+    return pStats;
+}
 
-    bool operator<(const CVarianceItem &v) const { return D<v.D; }
-    bool operator>(const CVarianceItem &v) const { return D>v.D; }
-};
+//! Статистика, собираемая в текущем потоке; nullptr - не собирается
+inline
+ParseStats* currentStats()
+{
+    return currentStatsRef();
+}
 
-//----------------------------------------------------------------------------
+#else
 
+//! Без MARTY_CSV_ENABLE_STATS - всегда nullptr, код сбора статистики выбрасывается компилятором
+constexpr
+ParseStats* currentStats()
+{
+    return nullptr;
+}
 
+#endif
 
 //----------------------------------------------------------------------------
-template< typename CharType>
-unsigned makeIndexFromChar( CharType ch )
+inline
+std::uint64_t statsNowNs()
 {
-    return (unsigned)ch;
+    return std::uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
 }
 
-template<> unsigned makeIndexFromChar<char>( char ch )
+//----------------------------------------------------------------------------
+//! Замер одного вызова разбора: на выходе добавляет в parseNs прошедшее время за вычетом convertNs, накопленного за вызов
+class ParseTimeScope
 {
-    return (unsigned)(unsigned char)ch;
-}
+    ParseStats     *m_pStats;
+    std::uint64_t   m_startNs;
+    std::uint64_t   m_startConvertNs;
 
-template<> unsigned makeIndexFromChar<wchar_t>( wchar_t ch )
-{
-    return (unsigned)ch;
-}
+public:
 
-//----------------------------------------------------------------------------
+    explicit ParseTimeScope(ParseStats *pStats)
+    : m_pStats(pStats)
+    , m_startNs(pStats ? statsNowNs() : 0)
+    , m_startConvertNs(pStats ? pStats->convertNs : 0)
+    {}
+
+    ~ParseTimeScope()
+    {
+        if (m_pStats)
+            m_pStats->parseNs += statsNowNs() - m_startNs - (m_pStats->convertNs - m_startConvertNs);
+    }
 
+    ParseTimeScope(const ParseTimeScope&) = delete;
+    ParseTimeScope& operator=(const ParseTimeScope&) = delete;
+};
 
+} // namespace details
 
 //----------------------------------------------------------------------------
-template<typename StringType>
-void
-calcLineCharCounts( const StringType &str
-                  , CLineCharCounts &lineCharCounts
-                  , CLineCharCounts &totalCharCounts
-                  )
+//! Направляет статистику разбора и определения диалекта в текущем потоке в stats на время жизни объекта
+/*! Области вкладываются - по выходу восстанавливается предыдущий приёмник.
+    Без MARTY_CSV_ENABLE_STATS ничего не делает, stats остаётся нулевой.
+ */
+class ParseStatsScope
 {
-    typedef typename StringType::size_type    size_type ;
-    typedef typename StringType::value_type   value_type;
+#if defined(MARTY_CSV_ENABLE_STATS)
+    ParseStats *m_pPrev;
+#endif
+
+public:
 
-    size_type i = 0, size = str.size();
-    for(; i!=size; ++i)
+    explicit ParseStatsScope(ParseStats &stats)
     {
-        std::size_t idx = (std::size_t)(unsigned char)str[i];
-        if (idx>126) continue;
-        ++lineCharCounts.counts[idx];
-        ++totalCharCounts.counts[idx];
+#if defined(MARTY_CSV_ENABLE_STATS)
+        m_pPrev = details::currentStatsRef();
+        details::currentStatsRef() = &stats;
+#else
+        (void)stats;
+#endif
     }
-}
+
+    ~ParseStatsScope()
+    {
+#if defined(MARTY_CSV_ENABLE_STATS)
+        details::currentStatsRef() = m_pPrev;
+#endif
+    }
+
+    ParseStatsScope(const ParseStatsScope&) = delete;
+    ParseStatsScope& operator=(const ParseStatsScope&) = delete;
+};
 
 //----------------------------------------------------------------------------
-template<typename LinesVectorType, typename LineCharCountsVectorType>
-void calcCharCountsForLines( const LinesVectorType    &lines
-                           , LineCharCountsVectorType &lineCharCounts // new vals wil be pushed to back
-                           , CLineCharCounts          &totalCharCounts
-                           )
+//! Политика обработки ошибок разбора
+/*! keepAll    - все ошибки с сообщениями, как по умолчанию;
+    stopAtFirst - первая ошибка с сообщением, после строки с ней разбор прекращается;
+    countOnly  - ошибки только считаются в ErrorLog;
+    keepFirst  - первые n ошибок с сообщениями, остальные только считаются;
+    compact    - все ошибки в виде компактных записей ErrorRecord в ErrorLog, без сообщений.
+    Сообщение формируется только для ошибок, сохраняемых с сообщениями.
+ */
+class ErrorPolicy
 {
-    //CLineCharCounts
-    lineCharCounts.clear();
-    lineCharCounts.reserve(lines.size());
+public:
 
-    auto lit = lines.begin();
-    for(; lit != lines.end(); ++lit)
+    enum class Mode
     {
-        CLineCharCounts lcc = { 0 };
-        calcLineCharCounts        ( *lit, lcc, totalCharCounts );
-        lineCharCounts.push_back(lcc);
-    }
-}
+        KeepAll,
+        StopAtFirst,
+        CountOnly,
+        KeepFirst,
+        Compact
+    };
+
+private:
+
+    Mode         m_mode        = Mode::KeepAll;
+    std::size_t  m_maxDetailed = std::size_t(-1);
+
+    ErrorPolicy(Mode mode, std::size_t maxDetailed)
+    : m_mode(mode), m_maxDetailed(maxDetailed)
+    {}
+
+public:
+
+    ErrorPolicy() = default;
+
+    static ErrorPolicy keepAll    ()              { return ErrorPolicy(Mode::KeepAll    , std::size_t(-1)); }
+    static ErrorPolicy stopAtFirst()              { return ErrorPolicy(Mode::StopAtFirst, 1u             ); }
+    static ErrorPolicy countOnly  ()              { return ErrorPolicy(Mode::CountOnly  , 0u             ); }
+    static ErrorPolicy keepFirst  (std::size_t n) { return ErrorPolicy(Mode::KeepFirst  , n              ); }
+    static ErrorPolicy compact    ()              { return ErrorPolicy(Mode::Compact    , 0u             ); }
+
+    Mode mode() const { return m_mode; }
+
+    //! Сколько первых ошибок сохраняется с сообщениями
+    std::size_t maxDetailed() const { return m_maxDetailed; }
+
+}; // class ErrorPolicy
 
 //----------------------------------------------------------------------------
-inline
-void calcCharsMathEV( std::size_t           numLines
-                    , const CLineCharCounts &totalCharCounts
-                    , CLineCharCounts       &charsMathEV
-                    )
+//! Компактная запись об ошибке - без сообщения
+/*! line и position - те же, что у ParseError при ErrorPolicy::keepAll (line - номер записи CSV);
+    значения больше 2^32-1 ограничиваются им.
+ */
+struct ErrorRecord
 {
-    for(std::size_t i=0; i<127; ++i)
-        charsMathEV.counts[i] = !numLines ? 0 : 100*totalCharCounts.counts[i] / (int)numLines;
-}
+    std::uint64_t   offset  ; //!< Абсолютная позиция ошибки во входе, в символах
+    std::uint32_t   line    ; //!< Как ParseError::line
+    std::uint32_t   position; //!< Как ParseError::position
+    std::uint32_t   value   ; //!< Для InconsistentColumns - число полей в строке, для прочих - 0
+    ParseErrorType  type    ;
+};
 
 //----------------------------------------------------------------------------
-template<typename LineCharCountsVectorType>
-void calcVariance( const LineCharCountsVectorType &lineCharCounts
-                 , const CLineCharCounts          &charsMathEV
-                 , const CLineCharCounts          &totalCharCounts
-                 , CLineCharCounts                &charsVariance
-                 )
+//! Сводка ошибок разбора - счётчики по типам и, для ErrorPolicy::compact, компактные записи
+struct ErrorLog
 {
-    for(std::size_t i=0; i<127; ++i)
+    std::array<std::uint64_t, parseErrorTypesCount> counts = {}; //!< Число ошибок по ParseErrorType, при любой политике
+    std::vector<ErrorRecord>  records;                           //!< Только для ErrorPolicy::compact
+    std::size_t               expectedColumns = 0;               //!< Ожидаемое число колонок - для сообщений InconsistentColumns
+    bool                      stopped         = false;           //!< Разбор прекращён по ErrorPolicy::stopAtFirst
+
+    std::uint64_t count(ParseErrorType type) const
     {
-        charsVariance.counts[i] = 0;
+        return counts[std::size_t(type)];
     }
 
-    std::size_t lci = 0;
-    std::size_t size = lineCharCounts.size();
-    for(; lci != size; ++lci)
+    std::uint64_t total() const
     {
-        for(std::size_t i=0; i<127; ++i)
-        {
-            int v1 = 100*lineCharCounts[lci].counts[i] - charsMathEV.counts[i];
-            charsVariance.counts[i] += v1*v1;
-        }
+        std::uint64_t res = 0;
+        for(auto c : counts)
+            res += c;
+        return res;
     }
 
-    for(std::size_t i=0; i<127; ++i)
+    void clear()
     {
-        if (totalCharCounts.counts[i]==0) { charsVariance.counts[i] = 100000000; continue; }
-
-        charsVariance.counts[i] = lineCharCounts.empty() ? 0 : charsVariance.counts[i] / (int)lineCharCounts.size();
+        counts.fill(0);
+        records.clear();
+        expectedColumns = 0;
+        stopped         = false;
     }
-}
+};
 
 //----------------------------------------------------------------------------
-template<typename LinesVectorType>
-void calcVariance( const LinesVectorType &lines
-                 , CLineCharCounts       &charsMathEV
-                 , CLineCharCounts       &charsVariance
-                 )
+//! Сообщение об ошибке разбора; value и expectedColumns используются только для InconsistentColumns
+inline
+std::string errorMessage(ParseErrorType type, std::size_t expectedColumns=0, std::size_t value=0)
 {
-    std::vector<CLineCharCounts> lineCharCounts;
-    CLineCharCounts totalCharCounts = { 0 };
-    //CLineCharCounts charsVariance   = { 0 };
-    calcCharCountsForLines( lines, lineCharCounts, totalCharCounts);
-
-    //CLineCharCounts charsMathEV = { 0 };
-    calcCharsMathEV( (unsigned)lines.size(), totalCharCounts, charsMathEV );
+    using std::to_string;
 
-    calcVariance( lineCharCounts, charsMathEV, totalCharCounts, charsVariance );
+    switch(type)
+    {
+        case ParseErrorType::UnclosedQuote        : return "Unclosed quotes at end of input";
+        case ParseErrorType::InvalidCharAfterQuote: return "Invalid character after closing quote";
+        case ParseErrorType::InconsistentColumns  : return "Columns count mismatch. Expected: " + to_string(expectedColumns) + ", got: " + to_string(value);
+        case ParseErrorType::InvalidQuoteUsage    : return "Quote appears in middle of field";
+        case ParseErrorType::InvalidValue         : return "Invalid value";
+        case ParseErrorType::InvalidEncoding      : return "Invalid encoding";
+        case ParseErrorType::InputError           : return "Input error";
+        default: return "Unknown error";
+    }
 }
 
 //----------------------------------------------------------------------------
+//! Полная ошибка из компактной записи - такая же, какую сохранил бы разбор с ErrorPolicy::keepAll
 inline
-void getCharVarianceOrderedVectorRequestedChars( const std::vector< CVarianceItem > &vvFrom
-                                               , std::vector< CVarianceItem > &vvTo
-                                               , const char *pRequestedChars
-                                               )
-{
-    if (!pRequestedChars) return;
-    vvTo.clear();
-    std::vector< CVarianceItem >::const_iterator vvIt = vvFrom.begin();
-    for(; vvIt != vvFrom.end(); ++vvIt)
-       {
-        for(const char *pCh = pRequestedChars; *pCh; ++pCh)
-           {
-            if ( vvIt->ch==makeIndexFromChar(*pCh) ) 
-               vvTo.push_back(*vvIt);
-           }
-       }
+ParseError toParseError(const ErrorLog &log, const ErrorRecord &rec)
+{
+    return ParseError{ rec.type, errorMessage(rec.type, log.expectedColumns, rec.value), std::size_t(rec.line), std::size_t(rec.position) };
 }
 
-inline
-void buildCharVarianceOrderedVector( const CLineCharCounts &charsMathEV
-                                   , const CLineCharCounts &charsVariance
-                                   , std::vector< CVarianceItem > &vv
-                                   //, unsigned    tag
-                                   , const char *pRequestedChars = 0
-                                   )
+//----------------------------------------------------------------------------
+//! Печать компактной записи - сообщение формируется только здесь
+template<typename StreamType>
+void printError(StreamType &oss, const ErrorLog &log, const ErrorRecord &rec)
 {
-    //vv.clear(); 
-    vv.reserve(127);
-    for(unsigned i=0; i<127; ++i)
-       {
-        vv.push_back( CVarianceItem(charsVariance.counts[i], charsMathEV.counts[i], i /* , tag */  ) );
-       }
-
-    std::vector< CVarianceItem >::iterator vvIt0 = vv.begin();
-    for(; vvIt0 != vv.end(); ++vvIt0)
-       {
-        if ( vvIt0->M < 100 ) vvIt0->D = 100000000;
-       }
+    printError(oss, toParseError(log, rec));
+}
 
-    //std::sort(vv.begin(), vv.end(), std::less<CVarianceItem>() );
-    std::sort(vv.begin(), vv.end() );
-    if (!pRequestedChars) return;
+//----------------------------------------------------------------------------
+//! Результат разбора; CharType - тип символов входа (char, wchar_t, char16_t, char32_t)
+template<typename CharType>
+struct BasicParseResult
+{
+    std::vector<std::vector<std::basic_string<CharType>>> data;
+    std::vector<ParseError>                               errors;
+};
 
-    std::vector< CVarianceItem > requestedItemsOnly;
-    getCharVarianceOrderedVectorRequestedChars( vv, requestedItemsOnly, pRequestedChars );
+using ParseResult     = BasicParseResult<char>;
+using WideParseResult = BasicParseResult<wchar_t>;
 
-/*
-    std::vector< CVarianceItem >::const_iterator vvIt = vv.begin();
-    for(; vvIt != vv.end(); ++vvIt)
-       {
-        for(const char *pCh = pRequestedChars; *pCh; ++pCh)
-           {
-            if ( vvIt->ch==(unsigned)(unsigned char)*pCh ) requestedItemsOnly.push_back(*vvIt);
-           }
-       }
-*/
-    vv.swap(requestedItemsOnly);
-}
+#if defined(MARTY_CSV_HAS_PMR)
 
-template<typename StringVectorType>
-void getCsvSeparatorVariances( std::vector< CVarianceItem > &vv
-                             , const StringVectorType       &lines
-                             , const char                   *pRequestedChars = 0
-                             )
+//! Результат разбора, строки и поля которого выделяются из memory_resource
+/*! Обычное использование - monotonic_buffer_resource, который сбрасывается (release) между файлами,
+    после уничтожения результата. Ошибки редки и хранятся в обычном std::vector.
+ */
+template<typename CharType>
+struct BasicPmrParseResult
 {
+    std::pmr::vector<std::pmr::vector<std::pmr::basic_string<CharType>>> data;
+    std::vector<ParseError>                                              errors;
 
-    //if (linesSimple.size()>1)
-       {
-          {
-            CLineCharCounts charsMathEV, charsVariance;
-            calcVariance( lines, charsMathEV, charsVariance );
-            buildCharVarianceOrderedVector( charsMathEV, charsVariance, vv, pRequestedChars );
-          }
-       }
+    explicit BasicPmrParseResult(std::pmr::memory_resource *pResource=std::pmr::get_default_resource())
+    : data(pResource)
+    {}
 
-}
+    std::pmr::memory_resource* resource() const
+    {
+        return data.get_allocator().resource();
+    }
+};
+
+using PmrParseResult = BasicPmrParseResult<char>;
+
+#endif
+
+//! Результат разбора без копирования полей
+/*! Поля ссылаются на исходный буфер, переданный в parseView, и валидны, пока жив этот буфер.
+    Копируются только поля с удвоенными кавычками - они хранятся в unescaped.
+    Копирование запрещено - скопированные view ссылались бы на unescaped оригинала.
+ */
+struct ViewParseResult
+{
+    std::vector<std::vector<std::string_view>> data;
+    std::vector<ParseError>                    errors;
+    std::deque<std::string>                    unescaped; //!< Элементы deque не перемещаются при добавлении и при перемещении самого deque
+
+    ViewParseResult() = default;
+    ViewParseResult(const ViewParseResult&) = delete;
+    ViewParseResult& operator=(const ViewParseResult&) = delete;
+    ViewParseResult(ViewParseResult&&) = default;
+    ViewParseResult& operator=(ViewParseResult&&) = default;
+};
 
 //----------------------------------------------------------------------------
-//! Разделяет входной текст на строки, разделитель CR LF или LF - для CSV сойдёт
-template<typename IterType, typename StringVectorType>
-void splitToLinesBasicImpl(IterType b, IterType e, StringVectorType &lines)
+//! Итератор по индексу для контейнеров, которые отдают элементы по значению (view)
+template<typename OwnerType, typename ValueType>
+class IndexIterator
 {
-    using StringType = typename StringVectorType::value_type;
-    StringType buf;
+    const OwnerType *m_pOwner = 0;
+    std::size_t      m_idx    = 0;
 
-    // for(auto ch : str)
-    for(; b!=e; ++b)
-    {
-        auto ch = *b;
+public:
 
-        if (ch=='\r')
-            continue; // Просто игнорим
+    using iterator_category = std::forward_iterator_tag;
+    using value_type        = ValueType;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = void;
+    using reference         = ValueType;
 
-        if (ch=='\n')
-        {
-            lines.emplace_back(buf);
-            buf.clear();
-            continue;
-        }    
+    IndexIterator() = default;
+    IndexIterator(const OwnerType *pOwner, std::size_t idx) : m_pOwner(pOwner), m_idx(idx) {}
 
-        buf.append(1, ch);
-    }
+    ValueType operator*() const { return (*m_pOwner)[m_idx]; }
 
-    if (!buf.empty())
-         lines.emplace_back(buf);
-}
+    IndexIterator& operator++()    { ++m_idx; return *this; }
+    IndexIterator  operator++(int) { IndexIterator tmp = *this; ++m_idx; return tmp; }
+
+    bool operator==(const IndexIterator &other) const { return m_idx==other.m_idx; }
+    bool operator!=(const IndexIterator &other) const { return m_idx!=other.m_idx; }
+};
 
 //----------------------------------------------------------------------------
-//! Разделяет входной текст на строки, разделитель CR LF или LF - для CSV сойдёт
-//! Символ кавычек уже должен быть продетекчен
-template<typename IterType, typename StringVectorType>
-void splitToLines(IterType b, IterType e, StringVectorType &lines, char quot=0)
+//! Таблица в плоском представлении - все символы полей в одном буфере и массивы смещений
+/*! На поле расходуется одно смещение его конца (начало - конец предыдущего поля),
+    на строку - индекс её первого поля. Поля отдаются как std::string_view, валидные
+    до изменения таблицы.
+ */
+class FlatTable
 {
-    using StringType = typename StringVectorType::value_type;
+    std::string               m_chars     ; // Символы всех полей подряд
+    std::vector<std::size_t>  m_fieldEnds ; // Конец каждого поля в m_chars
+    std::vector<std::size_t>  m_rowStarts ; // Индекс первого поля каждой строки, последний элемент - общее число полей
 
-    splitToLinesBasicImpl(b, e, lines);
+public:
 
-    StringVectorType tmp; tmp.reserve(lines.size());
+    //! Строка таблицы - лёгкий view
+    class Row
+    {
+        const FlatTable *m_pTable     = 0;
+        std::size_t      m_firstField = 0;
+        std::size_t      m_numFields  = 0;
 
-    // На коленке детектим поля с переносом строки. Нам это нужно, чтобы более корректно детектить разделители, не более того,
-    // так что возможные неверные детекты не будут проблемой
+    public:
 
-    static const std::string seps   = "\t;,:|#";
-    // constexpr static const std::string quotes = "\"\'`";
+        using iterator       = IndexIterator<Row, std::string_view>;
+        using const_iterator = iterator;
 
-    if (quot==0)
-        quot = '\"';
+        Row() = default;
+        Row(const FlatTable *pTable, std::size_t firstField, std::size_t numFields) : m_pTable(pTable), m_firstField(firstField), m_numFields(numFields) {}
 
-    for(auto &&l : lines)
-    {
-        auto sepPos  = l.find_first_of(seps);
-        
-        if (sepPos==l.npos)
-        {
-            // Разделитель не найден, не важно, есть ли кавычки - считаем,
-            // что это либо середина, либо окончание разделённой на несколько строк ячейки
-            if (tmp.empty())
-            {
-                tmp.push_back(l);
-            }
-            else
-            {
-                tmp.back().append(StringType("\n"));
-                tmp.back().append(l);
-            }
-        }
-        else // есть разделитель
+        std::size_t size () const { return m_numFields; }
+        bool        empty() const { return m_numFields==0; }
+
+        std::string_view operator[](std::size_t idx) const { return m_pTable->fieldByIndex(m_firstField+idx); }
+
+        iterator begin() const { return iterator(this, 0); }
+        iterator end  () const { return iterator(this, m_numFields); }
+
+        std::vector<std::string> toVector() const
         {
-            auto quotPos = l.find(quot);
-            if (quotPos==l.npos)
-            {
-                // а кавычки нет - обычная строка?
-                tmp.push_back(l);
-            }
-            else
-            {
-                // есть разделитель и кавычка
-                if (quotPos<sepPos) // Кавычка раньше разделителя
-                {
-                    if (tmp.empty())
-                    {
-                        tmp.push_back(l);
-                    }
-                    else
-                    {
-                        tmp.back().append(StringType("\n"));
-                        tmp.back().append(l);
-                    }
-                }
-                else // Разделитель раньше - тут может быть косяк, например, с запятой, но ничего не поделать
-                {
-                    tmp.push_back(l);
-                }
-            }
+            std::vector<std::string> res; res.reserve(m_numFields);
+            for(std::size_t i=0u; i!=m_numFields; ++i)
+                res.emplace_back((*this)[i]);
+            return res;
         }
+    };
+
+    using iterator       = IndexIterator<FlatTable, Row>;
+    using const_iterator = iterator;
+
+    FlatTable() : m_rowStarts(1, 0) {}
+
+    std::size_t size       () const { return m_rowStarts.size()-1; }
+    bool        empty      () const { return size()==0; }
+    std::size_t fieldsCount() const { return m_fieldEnds.size(); }
+
+    std::size_t rowSize(std::size_t rowIdx) const { return m_rowStarts[rowIdx+1] - m_rowStarts[rowIdx]; }
+
+    //! Поле по сквозному индексу
+    std::string_view fieldByIndex(std::size_t fieldIdx) const
+    {
+        std::size_t b = fieldIdx ? m_fieldEnds[fieldIdx-1] : 0;
+        return std::string_view(m_chars.data()+b, m_fieldEnds[fieldIdx]-b);
+    }
+
+    std::string_view field(std::size_t rowIdx, std::size_t colIdx) const
+    {
+        return fieldByIndex(m_rowStarts[rowIdx]+colIdx);
     }
 
-    swap(tmp, lines);
+    Row row(std::size_t rowIdx) const { return Row(this, m_rowStarts[rowIdx], rowSize(rowIdx)); }
+    Row operator[](std::size_t rowIdx) const { return row(rowIdx); }
 
-}
+    iterator begin() const { return iterator(this, 0); }
+    iterator end  () const { return iterator(this, size()); }
 
-//----------------------------------------------------------------------------
+    void clear()
+    {
+        m_chars.clear();
+        m_fieldEnds.clear();
+        m_rowStarts.assign(1, 0);
+    }
 
-template<typename IterType>
-IterType getChunkForDetections(IterType b, IterType e, std::size_t chunkSize=1000*1000)
-{
-    for(std::size_t i=0u; b!=e && i!=chunkSize; ++b) {}
+    void reserve(std::size_t numChars, std::size_t numFields=0, std::size_t numRows=0)
+    {
+        m_chars.reserve(numChars);
+        m_fieldEnds.reserve(numFields);
+        m_rowStarts.reserve(numRows+1);
+    }
 
-    if (b==e)
-        return b;
+    //! Добавляет поле в текущую (последнюю, ещё не завершённую) строку
+    void appendField(std::string_view f)
+    {
+        m_chars.append(f.data(), f.size());
+        m_fieldEnds.push_back(m_chars.size());
+    }
 
-    // Хотим найти перевод строки, но ищем его не очень далеко
+    //! Завершает текущую строку
+    void endRow()
+    {
+        m_rowStarts.push_back(m_fieldEnds.size());
+    }
 
-    for(std::size_t i=0u; b!=e && i!=1000; ++b)
+    template<typename RowType>
+    void appendRow(const RowType &row)
     {
-        if (*b=='\n' || *b=='\r')
-            break;
+        for(const auto &f : row)
+            appendField(std::string_view(f));
+        endRow();
     }
 
-    return b;
-}
+    //! Преобразование в старое представление
+    std::vector<std::vector<std::string>> toVector() const
+    {
+        std::vector<std::vector<std::string>> res; res.reserve(size());
+        for(std::size_t r=0u; r!=size(); ++r)
+            res.emplace_back(row(r).toVector());
+        return res;
+    }
+
+}; // class FlatTable
 
 //----------------------------------------------------------------------------
+struct FlatParseResult
+{
+    FlatTable                 data;
+    std::vector<ParseError>   errors;
 
+    //! Преобразование в результат старого вида
+    ParseResult toParseResult() const
+    {
+        return ParseResult{ data.toVector(), errors };
+    }
+};
 
+//----------------------------------------------------------------------------
+//! Что делать при колоночном разборе со строками, в которых число полей отличается от первой строки
+/*! Сами такие строки в строгом режиме по-прежнему отмечаются ошибкой ParseErrorType::InconsistentColumns
+ */
+enum class RaggedRowsPolicy
+{
+    PadOrTruncate, //!< Недостающие поля - пустые, лишние отбрасываются
+    SkipRow      , //!< Строка целиком пропускается
+    AddColumns     //!< Лишние поля образуют новые колонки, в предыдущих строках они пустые; недостающие - пустые
+};
 
 //----------------------------------------------------------------------------
-class CsvParser
+//! Таблица по колонкам - у каждой колонки свой буфер символов и массив смещений
+class ColumnarTable
 {
-    char m_delimiter      = 0;
-    char m_quot           = 0;
-    bool m_strictMode     = false;
-    size_t m_currentLine  = 1;
-    size_t m_currentPos   = 0;
-    size_t m_lineStartPos = 0;
 
-    void addError(ParseResult& result, ParseErrorType type, const std::string& msg)
+public:
+
+    //! Колонка - значения подряд в одном буфере, плюс конец каждого значения
+    class Column
     {
-        using std::to_string;
+        std::string               m_chars;
+        std::vector<std::size_t>  m_ends ;
 
-        auto linePos = m_currentPos - m_lineStartPos + 1;
+    public:
 
-        result.errors.push_back(
-            {
-                type,
-                msg // + " (line: " + to_string(m_currentLine) + 
-                    // ", pos: " + to_string(linePos) + ")"
-                    ,
-                m_currentLine,
-                linePos
-            });
-    }
+        using iterator       = IndexIterator<Column, std::string_view>;
+        using const_iterator = iterator;
 
-    static
-    std::string trimRight(const std::string &str)
+        std::size_t size () const { return m_ends.size(); }
+        bool        empty() const { return m_ends.empty(); }
+
+        std::string_view operator[](std::size_t idx) const
+        {
+            std::size_t b = idx ? m_ends[idx-1] : 0;
+            return std::string_view(m_chars.data()+b, m_ends[idx]-b);
+        }
+
+        iterator begin() const { return iterator(this, 0); }
+        iterator end  () const { return iterator(this, size()); }
+
+        void append(std::string_view v)
+        {
+            m_chars.append(v.data(), v.size());
+            m_ends.push_back(m_chars.size());
+        }
+
+        void appendEmpty(std::size_t count)
+        {
+            m_ends.insert(m_ends.end(), count, m_chars.size());
+        }
+
+        void reserve(std::size_t numChars, std::size_t numValues)
+        {
+            m_chars.reserve(numChars);
+            m_ends.reserve(numValues);
+        }
+    };
+
+private:
+
+    std::vector<Column>  m_columns;
+    std::size_t          m_rowsCount = 0;
+
+public:
+
+    std::size_t columnsCount() const { return m_columns.size(); }
+    std::size_t rowsCount   () const { return m_rowsCount; }
+
+    const Column& column    (std::size_t colIdx) const { return m_columns[colIdx]; }
+    const Column& operator[](std::size_t colIdx) const { return m_columns[colIdx]; }
+
+    std::string_view value(std::size_t rowIdx, std::size_t colIdx) const { return m_columns[colIdx][rowIdx]; }
+
+    const std::vector<Column>& columns() const { return m_columns; }
+
+    //! Задаёт число колонок; новые колонки заполняются пустыми значениями для уже добавленных строк
+    void setColumnsCount(std::size_t numColumns)
     {
-        size_t lastNonSpace = str.find_last_not_of(" \t");
-        if (lastNonSpace!=std::string::npos)
-            return str.substr(0, lastNonSpace + 1);
-        return str;
+        std::size_t oldCount = m_columns.size();
+        m_columns.resize(numColumns);
+        for(std::size_t i=oldCount; i<numColumns; ++i)
+            m_columns[i].appendEmpty(m_rowsCount);
     }
 
-    static
-    std::string trimLeft(const std::string &str)
+    void reserve(std::size_t numCharsPerColumn, std::size_t numRows)
     {
-        size_t firstrNonSpace = str.find_first_not_of(" \t");
-        if (firstrNonSpace!=std::string::npos)
-            return str.substr(firstrNonSpace, str.npos);
-        return std::string(); // Непробельные символы не найдены - у нас пустая строка
+        for(auto &c : m_columns)
+            c.reserve(numCharsPerColumn, numRows);
     }
 
-    static
-    std::string trim(const std::string &str)
+    //! Значение очередной строки для колонки colIdx; строка завершается вызовом endRow
+    void appendValue(std::size_t colIdx, std::string_view v)
     {
-        return trimLeft(trimRight(str));
+        m_columns[colIdx].append(v);
     }
 
-
-public:
-
-    CsvParser(char delim=',', char quot='\"', bool strict=true)
-    : m_delimiter(delim)
-    , m_quot(quot)
-    , m_strictMode(strict)
-          // m_currentLine(1),
-          // m_currentPos(0)
+    //! Завершает строку - колонки, в которые ничего не добавили, получают пустое значение
+    void endRow()
     {
-        if (!m_delimiter)
-            m_delimiter = ';';
-
-        if (!m_quot)
-             m_quot = '\"';
+        ++m_rowsCount;
+        for(auto &c : m_columns)
+        {
+            if (c.size()<m_rowsCount)
+                c.appendEmpty(m_rowsCount-c.size());
+        }
     }
 
-    ParseResult parse(const std::string& content)
+    //! Преобразование в старое построчное представление
+    std::vector<std::vector<std::string>> toVector() const
     {
-        using std::to_string;
+        std::vector<std::vector<std::string>> res(m_rowsCount);
+        for(std::size_t r=0u; r!=m_rowsCount; ++r)
+        {
+            res[r].reserve(m_columns.size());
+            for(const auto &c : m_columns)
+                res[r].emplace_back(c[r]);
+        }
+        return res;
+    }
 
-        ParseResult result;
-        std::vector<std::string> currentRow;
-        std::string field;
-        bool inQuotes = false;
-        bool wasQuoted = false;
-        size_t columnsCount = 0;
-        bool lastCharDelimiter = false;
+}; // class ColumnarTable
 
+//----------------------------------------------------------------------------
+struct ColumnarParseResult
+{
+    ColumnarTable             data;
+    std::vector<ParseError>   errors;
+    std::size_t               skippedRows = 0; //!< Строки, пропущенные по RaggedRowsPolicy::SkipRow
+};
 
-        // m_currentLine = 1;
-        // m_currentPos = 0;
-        //size_t 
-        m_lineStartPos = 0;
+//----------------------------------------------------------------------------
 
-        auto addCol = [&]()
-        {
-            if (!wasQuoted)
-                field = trim(field);
-            currentRow.push_back(field);
-            field.clear();
-            inQuotes = false;
-            wasQuoted = false;
-        };
 
-        auto handleRowEnd = [&](bool force = false)
-        {
-            if (force || !inQuotes)
-            {
-                if (wasQuoted)
-                {
-                    // size_t lastNonSpace = field.find_last_not_of(" \t");
-                    // if (lastNonSpace != std::string::npos)
-                    // {
-                    //     field = field.substr(0, lastNonSpace + 1);
-                    // }
 
-                    field = trimRight(field);
-                }
+//----------------------------------------------------------------------------
+namespace details {
 
-                if (!field.empty() || lastCharDelimiter || wasQuoted)
-                {
-                    // if (!wasQuoted)
-                    //     field = trim(field);
-                    // currentRow.push_back(field);
-                    addCol();
-                }
 
-                if (!currentRow.empty())
-                {
-                    if (columnsCount == 0)
-                    {
-                        columnsCount = currentRow.size();
-                    }
-                    else if (m_strictMode && currentRow.size() != columnsCount)
-                    {
-                        addError(result, ParseErrorType::InconsistentColumns,
-                            "Columns count mismatch. Expected: " + 
-                            to_string(columnsCount) + 
-                            ", got: " + to_string(currentRow.size()));
-                    }
-                    result.data.push_back(currentRow);
-                }
+//----------------------------------------------------------------------------
+//! Среднее и дисперсия, накапливаемые на лету (алгоритм Уэлфорда)
+struct RunningStats
+{
+    std::size_t n    = 0;
+    double      mean = 0;
+    double      m2   = 0; //!< Сумма квадратов отклонений от среднего
 
-                currentRow.clear();
-                field.clear();
-                inQuotes = false;
-                wasQuoted = false;
-                m_currentLine++;
-                m_lineStartPos = m_currentPos + 1;
-                return true;
-            }
-            return false;
-        };
+    void add(double x)
+    {
+        ++n;
+        double delta = x - mean;
+        mean += delta/double(n);
+        m2   += delta*(x - mean);
+    }
+
+    double variance() const { return n ? m2/double(n) : 0; }
+
+    //! Объединение с накопленным по другой выборке (формула Чана)
+    void merge(const RunningStats &other)
+    {
+        if (!other.n)
+            return;
 
-        for (m_currentPos = 0; m_currentPos < content.size(); ++m_currentPos)
+        if (!n)
         {
-            char c = content[m_currentPos];
-            
-            if (inQuotes)
-            {
-                if (c == m_quot)
-                {
-                    if (m_currentPos + 1 < content.size() && content[m_currentPos + 1] == m_quot)
-                    {
-                        field += m_quot;
-                        m_currentPos++;
-                    }
+            *this = other;
+            return;
+        }
+
+        std::size_t total = n + other.n;
+        double delta = other.mean - mean;
+        mean += delta*double(other.n)/double(total);
+        m2   += other.m2 + delta*delta*double(n)*double(other.n)/double(total);
+        n     = total;
+    }
+};
+
+//----------------------------------------------------------------------------
+//! Однопроходное определение кавычек и разделителя по ограниченной выборке
+/*! Символы подаются по одному через put/sniff, входные данные не копируются.
+
+    Кавычки определяются по соседству с разделителями и переводами строк - кавычка,
+    стоящая вплотную к ним, засчитывается.
+
+    Для каждого варианта кавычек отдельно отслеживается состояние "внутри кавычек"
+    и границы записей. По каждой записи для каждого кандидата в разделители на лету
+    (по Уэлфорду) накапливаются среднее и дисперсия числа его вхождений вне кавычек.
+    Разделитель - кандидат с наименьшей дисперсией среди тех, что встречаются
+    в среднем хотя бы раз на запись; при равенстве - с большим средним, затем первый
+    по порядку в seps. Используется статистика для найденных кавычек, если кавычки
+    не найдены - для '"'.
+
+    Выборка ограничена maxBytes символами и maxRecords строками, после этого full()
+    возвращает true. Незаконченная запись на обрезанной выборке не учитывается.
+ */
+class DialectSniffer
+{
+public:
+
+    static const std::size_t maxCandidates = 16;
+
+protected:
+
+    static const unsigned char noIdx = 0xFFu;
+
+    std::string    m_seps;
+    std::string    m_quotes;               // Варианты кавычек; последним может быть добавлен '"' для статистики по умолчанию
+    std::size_t    m_numDetectQuotes = 0;  // Сколько первых вариантов кавычек участвуют в определении; 0 - кавычки заданы
+    std::size_t    m_maxBytes;
+    std::size_t    m_maxRecords;
+
+    unsigned char  m_sepIdx [256];
+    unsigned char  m_quotIdx[256];
+    bool           m_special[256];         // Разделитель, кавычка или перевод строки
+
+    std::size_t    m_bytes          = 0;
+    std::size_t    m_lines          = 0;
+    std::size_t    m_nonNewlines    = 0;   // Символов, не являющихся переводом строки
+    bool           m_prevNewline    = true;
+    bool           m_truncated      = false;
+
+    // Для определения кавычек
+    bool           m_prevSep        = false;
+    unsigned char  m_prevQuotIdx    = noIdx;
+    std::size_t    m_quotesCount[maxCandidates] = { 0 };
+
+    // Для определения разделителя - по каждому варианту кавычек
+    bool           m_inQuotes   [maxCandidates] = { false };
+    bool           m_skipRecord [maxCandidates] = { false };  // Первая запись окна неполная и не учитывается
+    std::size_t    m_recordStart[maxCandidates] = { 0 };  // m_nonNewlines на начале текущей записи
+    std::size_t    m_records    [maxCandidates] = { 0 };
+    unsigned       m_counts     [maxCandidates][maxCandidates] = { { 0 } };
+    RunningStats   m_stats      [maxCandidates][maxCandidates];
+
+    template<typename StringType>
+    static std::string toCandidates(const StringType &str)
+    {
+        std::string res;
+        for(auto ch : str)
+        {
+            auto code = (typename std::make_unsigned<typename StringType::value_type>::type)ch;
+            if (code<256u && res.size()<maxCandidates && res.find(char(code))==res.npos)
+                res.append(1, char(code));
+        }
+        return res;
+    }
+
+    void endRecord(std::size_t q)
+    {
+        if (m_skipRecord[q])
+        {
+            for(std::size_t s=0; s!=m_seps.size(); ++s)
+                m_counts[q][s] = 0;
+            m_skipRecord[q] = false;
+        }
+        else if (m_nonNewlines!=m_recordStart[q])
+        {
+            for(std::size_t s=0; s!=m_seps.size(); ++s)
+            {
+                m_stats[q][s].add(double(m_counts[q][s]));
+                m_counts[q][s] = 0;
+            }
+            ++m_records[q];
+        }
+        m_recordStart[q] = m_nonNewlines;
+    }
+
+    std::size_t statsIndex() const
+    {
+        auto pos = m_quotes.find(quot());
+        return pos==m_quotes.npos ? m_quotes.size()-1 : pos;
+    }
+
+public:
+
+    //! quot==0 - кавычки определяются из quotes, иначе заданы и не определяются
+    template<typename StringType>
+    DialectSniffer( const StringType &seps, const StringType &quotes, char quot=0
+                  , std::size_t maxBytes=1000*1000, std::size_t maxRecords=1000
+                  )
+    : m_seps(toCandidates(seps))
+    , m_maxBytes(maxBytes)
+    , m_maxRecords(maxRecords)
+    {
+        if (quot)
+        {
+            m_quotes.assign(1, quot);
+        }
+        else
+        {
+            m_quotes = toCandidates(quotes);
+            m_numDetectQuotes = m_quotes.size();
+            if (m_quotes.find('\"')==m_quotes.npos)
+            {
+                if (m_quotes.size()==maxCandidates)
+                    m_quotes.pop_back();
+                m_quotes.append(1, '\"');
+            }
+        }
+
+        std::memset(m_sepIdx , noIdx, sizeof(m_sepIdx ));
+        std::memset(m_quotIdx, noIdx, sizeof(m_quotIdx));
+        std::memset(m_special, 0    , sizeof(m_special));
+
+        for(std::size_t i=0; i!=m_seps.size(); ++i)
+            m_sepIdx[(unsigned char)m_seps[i]] = (unsigned char)i;
+        for(std::size_t i=0; i!=m_quotes.size(); ++i)
+            m_quotIdx[(unsigned char)m_quotes[i]] = (unsigned char)i;
+
+        for(unsigned i=0; i!=256u; ++i)
+            m_special[i] = m_sepIdx[i]!=noIdx || m_quotIdx[i]!=noIdx || i=='\n' || i=='\r';
+    }
+
+    bool full() const { return m_bytes>=m_maxBytes || m_lines>=m_maxRecords; }
+
+    //! Выборка начинается с произвольной позиции: первая (неполная) запись отбрасывается, inQuotes - предполагаемое состояние кавычек
+    void startFromMiddle(bool inQuotes)
+    {
+        for(std::size_t q=0; q!=m_quotes.size(); ++q)
+        {
+            m_inQuotes  [q] = inQuotes;
+            m_skipRecord[q] = true;
+        }
+    }
+
+    template<typename CharType>
+    void put(CharType ch)
+    {
+        ++m_bytes;
+
+        auto code = (typename std::make_unsigned<CharType>::type)ch;
+        if (code>=256u || !m_special[code])
+        {
+            ++m_nonNewlines;
+            m_prevNewline = false;
+            m_prevSep     = false;
+            m_prevQuotIdx = noIdx;
+            return;
+        }
+
+        bool          isNewline = code=='\n' || code=='\r';
+        unsigned char sepIdx    = m_sepIdx [code];
+        unsigned char quotIdx   = m_quotIdx[code];
+
+        if (m_numDetectQuotes)
+        {
+            // Кавычка засчитывается, если стоит после разделителя, перед разделителем или перед переводом строки
+            if (quotIdx>=m_numDetectQuotes)
+                quotIdx = noIdx;
+
+            if (sepIdx==noIdx)
+            {
+                if (quotIdx!=noIdx)
+                {
+                    if (m_prevSep)
+                        ++m_quotesCount[quotIdx];
+                }
+                else if (m_prevQuotIdx!=noIdx && isNewline)
+                {
+                    ++m_quotesCount[m_prevQuotIdx];
+                }
+
+                m_prevSep = false;
+            }
+            else
+            {
+                if (m_prevQuotIdx!=noIdx)
+                    ++m_quotesCount[m_prevQuotIdx];
+
+                m_prevSep = true;
+            }
+
+            m_prevQuotIdx = quotIdx;
+            quotIdx = m_quotIdx[code];
+        }
+
+        if (isNewline)
+        {
+            if (!m_prevNewline)
+                ++m_lines;
+            m_prevNewline = true;
+
+            for(std::size_t q=0; q!=m_quotes.size(); ++q)
+            {
+                if (!m_inQuotes[q])
+                    endRecord(q);
+            }
+            return;
+        }
+
+        ++m_nonNewlines;
+        m_prevNewline = false;
+
+        if (quotIdx!=noIdx)
+            m_inQuotes[quotIdx] = !m_inQuotes[quotIdx];
+
+        if (sepIdx!=noIdx)
+        {
+            for(std::size_t q=0; q!=m_quotes.size(); ++q)
+            {
+                if (!m_inQuotes[q])
+                    ++m_counts[q][sepIdx];
+            }
+        }
+    }
+
+    //! Подаёт символы диапазона, пока выборка не заполнится
+    template<typename InputIter>
+    void sniff(InputIter b, InputIter e)
+    {
+        ParseStats *pStats = currentStats();
+        const std::uint64_t startNs = pStats ? statsNowNs() : 0;
+        std::uint64_t count = 0;
+
+        for(; b!=e; ++b, ++count)
+        {
+            if (full())
+            {
+                m_truncated = true;
+                break;
+            }
+            put(*b);
+        }
+
+        if (pStats)
+        {
+            pStats->detectBytes += count;
+            pStats->detectNs    += statsNowNs() - startNs;
+        }
+    }
+
+    //! Завершает выборку; endOfData - данные закончились, а не были обрезаны
+    void finish(bool endOfData=true)
+    {
+        if (!endOfData || m_truncated)
+            return;
+
+        for(std::size_t q=0; q!=m_quotes.size(); ++q)
+        {
+            if (!m_inQuotes[q])
+                endRecord(q);
+        }
+    }
+
+    //! Найденные кавычки; 0 - не найдены
+    char quot() const
+    {
+        if (!m_numDetectQuotes)
+            return m_quotes[0];
+
+        std::size_t bestIdx = 0;
+        for(std::size_t i=1; i<m_numDetectQuotes; ++i)
+        {
+            if (m_quotesCount[i]>m_quotesCount[bestIdx])
+                bestIdx = i;
+        }
+
+        return m_quotesCount[bestIdx] ? m_quotes[bestIdx] : char(0);
+    }
+
+    //! Найденный разделитель; 0 - только если seps пуст
+    char delim() const
+    {
+        if (m_seps.empty())
+            return 0;
+
+        const auto &stats = m_stats[statsIndex()];
+
+        std::size_t bestIdx = m_seps.size();
+        for(std::size_t s=0; s!=m_seps.size(); ++s)
+        {
+            if (stats[s].mean<1.0)
+                continue;
+
+            if ( bestIdx==m_seps.size()
+              || stats[s].variance()<stats[bestIdx].variance()
+              || (stats[s].variance()==stats[bestIdx].variance() && stats[s].mean>stats[bestIdx].mean)
+               )
+                bestIdx = s;
+        }
+
+        if (bestIdx!=m_seps.size())
+            return m_seps[bestIdx];
+
+        // Ни один кандидат не встречается в каждой записи - берём самый частый
+        bestIdx = 0;
+        for(std::size_t s=1; s!=m_seps.size(); ++s)
+        {
+            if (stats[s].mean>stats[bestIdx].mean)
+                bestIdx = s;
+        }
+
+        return m_seps[bestIdx];
+    }
+
+    //! Уверенность в найденном разделителе, от 0 до 1
+    /*! Учитывает стабильность числа вхождений разделителя на запись и объём выборки.
+        0 - разделитель не встречается хотя бы раз на запись в среднем.
+     */
+    double confidence() const
+    {
+        auto sepPos = m_seps.find(delim());
+        if (sepPos==m_seps.npos)
+            return 0;
+
+        const auto &stats = m_stats[statsIndex()][sepPos];
+        if (stats.mean<1.0)
+            return 0;
+
+        double stability = 1.0/(1.0+stats.variance());
+        double support   = stats.n>=20u ? 1.0 : double(stats.n)/20.0;
+        return stability*support;
+    }
+
+    //! Добавляет статистику другой выборки с теми же кандидатами - например, другого окна того же файла
+    void merge(const DialectSniffer &other)
+    {
+        m_bytes += other.m_bytes;
+        m_lines += other.m_lines;
+
+        for(std::size_t q=0; q!=m_quotes.size(); ++q)
+        {
+            m_quotesCount[q] += other.m_quotesCount[q];
+            m_records[q]     += other.m_records[q];
+            for(std::size_t s=0; s!=m_seps.size(); ++s)
+                m_stats[q][s].merge(other.m_stats[q][s]);
+        }
+    }
+
+    std::size_t bytesSniffed() const { return m_bytes; }
+
+}; // class DialectSniffer
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+//! Сырое поле, найденное парсером - диапазон во входном буфере плюс флаги
+/*! Для закавыченного поля begin/end указывают на содержимое между кавычками,
+    удвоенные кавычки в нём ещё не схлопнуты. Для незакавыченного - на поле
+    целиком, без обрезки пробелов.
+ */
+template<typename CharType>
+struct BasicFieldSpan
+{
+    using char_type = CharType;
+
+    static constexpr unsigned Quoted    = 0x01; //!< Поле было в кавычках
+    static constexpr unsigned Escaped   = 0x02; //!< Внутри закавыченного поля есть удвоенные кавычки
+    static constexpr unsigned TrimRight = 0x04; //!< Закавыченное поле в конце строки - обрезаем пробелы справа
+
+    const CharType *begin;
+    const CharType *end;
+    unsigned        flags;
+
+    bool quoted () const { return (flags&Quoted )!=0; }
+    bool escaped() const { return (flags&Escaped)!=0; }
+};
+
+using FieldSpan = BasicFieldSpan<char>;
+
+//----------------------------------------------------------------------------
+template<typename CharType>
+bool isTrimSpace(CharType ch)
+{
+    return ch==CharType(' ') || ch==CharType('\t');
+}
+
+//----------------------------------------------------------------------------
+//! Обрезка поля так, как это делает CsvParser - незакавыченные поля с обеих сторон, закавыченные - только в конце строки
+template<typename CharType>
+std::basic_string_view<CharType> trimFieldSpan(const BasicFieldSpan<CharType> &fs)
+{
+    const CharType *b = fs.begin;
+    const CharType *e = fs.end;
+
+    if (!fs.quoted() || (fs.flags&BasicFieldSpan<CharType>::TrimRight)!=0)
+    {
+        const CharType *te = e;
+        while (te!=b && isTrimSpace(te[-1]))
+            --te;
+
+        if (te!=b) // Если поле состоит только из пробелов, trimRight его не трогает
+            e = te;
+    }
+
+    if (!fs.quoted())
+    {
+        while (b!=e && isTrimSpace(*b))
+            ++b;
+    }
+
+    return std::basic_string_view<CharType>(b, std::size_t(e-b));
+}
+
+//----------------------------------------------------------------------------
+//! Схлопывает удвоенные кавычки, результат дописывается в конец str
+template<typename StringType, typename CharType>
+void appendUnescaped(StringType &str, std::basic_string_view<CharType> raw, typename BasicFieldSpan<CharType>::char_type quot)
+{
+    std::size_t i = 0;
+    while(i<raw.size())
+    {
+        auto qPos = raw.find(quot, i);
+        if (qPos==raw.npos)
+        {
+            str.append(raw.data()+i, raw.size()-i);
+            break;
+        }
+
+        str.append(raw.data()+i, qPos+1-i); // Включая первую кавычку пары
+        i = qPos + 2; // Вторую пропускаем
+    }
+}
+
+//----------------------------------------------------------------------------
+//! Итоговое значение поля; поле с удвоенными кавычками раскавычивается в unescapeBuf
+template<typename CharType>
+std::basic_string_view<CharType> fieldSpanValue(const BasicFieldSpan<CharType> &fs, typename BasicFieldSpan<CharType>::char_type quot, std::basic_string<CharType> &unescapeBuf)
+{
+    auto fieldView = trimFieldSpan(fs);
+    if (!fs.escaped())
+        return fieldView;
+
+    unescapeBuf.clear();
+    appendUnescaped(unescapeBuf, fieldView, quot);
+    return std::basic_string_view<CharType>(unescapeBuf);
+}
+
+//----------------------------------------------------------------------------
+//! Заполняет row строками из найденных парсером полей; строки row переиспользуются
+/*! RowType - вектор строк, в том числе std::pmr::vector<std::pmr::string>
+ */
+template<typename CharType, typename RowType>
+void spansToStrings(const BasicFieldSpan<CharType> *pFields, std::size_t numFields, typename BasicFieldSpan<CharType>::char_type quot, RowType &row)
+{
+    row.resize(numFields);
+
+    for(std::size_t i=0u; i!=numFields; ++i)
+    {
+        const auto &fs = pFields[i];
+        auto fieldView = trimFieldSpan(fs);
+        if (fs.escaped())
+        {
+            row[i].clear();
+            appendUnescaped(row[i], fieldView, quot);
+        }
+        else
+        {
+            row[i].assign(fieldView.data(), fieldView.size());
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+//! Добавляет в stats счётчики строки из найденных парсером полей
+template<typename CharType>
+void accumulateRowStats(ParseStats &stats, const BasicFieldSpan<CharType> *pFields, std::size_t numFields, typename BasicFieldSpan<CharType>::char_type quot)
+{
+    ++stats.rows;
+    stats.fields     += numFields;
+    stats.maxRowWidth = std::max(stats.maxRowWidth, std::uint64_t(numFields));
+
+    for(std::size_t i=0u; i!=numFields; ++i)
+    {
+        const auto &fs = pFields[i];
+        auto fieldView = trimFieldSpan(fs);
+
+        if (fieldView.size()!=std::size_t(fs.end-fs.begin))
+            ++stats.trimmedFields;
+
+        std::size_t length = fieldView.size();
+        if (fs.quoted())
+        {
+            ++stats.quotedFields;
+            if (fs.escaped())
+            {
+                std::size_t numEscaped = std::size_t(std::count(fieldView.begin(), fieldView.end(), quot))/2u;
+                stats.escapedQuotes += numEscaped;
+                length -= numEscaped;
+            }
+        }
+
+        stats.maxFieldLength = std::max(stats.maxFieldLength, std::uint64_t(length));
+    }
+}
+
+//----------------------------------------------------------------------------
+inline
+bool isNewlineChar(char ch)
+{
+    return ch=='\r' || ch=='\n';
+}
+
+//----------------------------------------------------------------------------
+//! Поиск структурных символов для входа не из char - простой перебор, интерфейс как у simd::StructuralIndexer
+template<typename CharType>
+class ScalarStructuralIndexer
+{
+    const CharType   *m_pData = 0;
+    std::size_t       m_size  = 0;
+    CharType          m_delim = CharType(',');
+    CharType          m_quot  = CharType('\"');
+
+public:
+
+    ScalarStructuralIndexer(const CharType *pData, std::size_t size, CharType delim, CharType quot)
+    : m_pData(pData), m_size(size), m_delim(delim), m_quot(quot)
+    {}
+
+    std::size_t nextStructural(std::size_t pos) const
+    {
+        for(; pos<m_size; ++pos)
+        {
+            CharType ch = m_pData[pos];
+            if (ch==m_quot || ch==m_delim || ch==CharType('\r') || ch==CharType('\n'))
+                break;
+        }
+        return pos;
+    }
+
+    std::size_t nextQuote(std::size_t pos) const
+    {
+        for(; pos<m_size && m_pData[pos]!=m_quot; ++pos) {}
+        return pos;
+    }
+
+}; // class ScalarStructuralIndexer
+
+//----------------------------------------------------------------------------
+//! Векторный поиск - только для char
+template<typename CharType>
+using StructuralIndexerFor = typename std::conditional< std::is_same<CharType, char>::value
+                                                      , simd::StructuralIndexer
+                                                      , ScalarStructuralIndexer<CharType>
+                                                      >::type;
+
+//----------------------------------------------------------------------------
+//! Последовательный разбор считает началом строки символ после первого перевода строки серии, а не после всей серии
+inline
+std::size_t lineStartForBoundary(std::string_view content, std::size_t boundary)
+{
+    std::size_t pos = boundary;
+    while(pos>0 && isNewlineChar(content[pos-1]))
+        --pos;
+
+    return pos==boundary ? boundary : pos+1;
+}
+
+} // namespace details
+
+//----------------------------------------------------------------------------
+//! Таблица с отложенной обработкой полей
+/*! Для каждого поля хранится только найденный парсером диапазон во входном буфере и флаги
+    (в кавычках, есть удвоенные кавычки). Обрезка пробелов и схлопывание кавычек выполняются
+    при первом обращении к полю, результат запоминается. Выгодно для широких таблиц, из которых
+    читается лишь несколько колонок.
+
+    Поля ссылаются на исходный буфер и валидны, пока жив он и сама таблица. Обращение к полям
+    изменяет внутреннее состояние, поэтому одновременное чтение из нескольких потоков недопустимо.
+    Копирование запрещено - как и у ViewParseResult.
+ */
+class LazyTable
+{
+    static const unsigned Resolved = 0x100; // Поле уже обработано, begin/end указывают на итоговое значение
+
+    mutable std::vector<details::FieldSpan>  m_fields    ;
+    std::vector<std::size_t>                 m_rowStarts ; // Индекс первого поля каждой строки, последний элемент - общее число полей
+    mutable std::deque<std::string>          m_unescaped ; // Поля с удвоенными кавычками; элементы deque не перемещаются
+    char                                     m_quot = '\"';
+
+public:
+
+    //! Строка таблицы - лёгкий view
+    class Row
+    {
+        const LazyTable *m_pTable     = 0;
+        std::size_t      m_firstField = 0;
+        std::size_t      m_numFields  = 0;
+
+    public:
+
+        using iterator       = IndexIterator<Row, std::string_view>;
+        using const_iterator = iterator;
+
+        Row() = default;
+        Row(const LazyTable *pTable, std::size_t firstField, std::size_t numFields) : m_pTable(pTable), m_firstField(firstField), m_numFields(numFields) {}
+
+        std::size_t size () const { return m_numFields; }
+        bool        empty() const { return m_numFields==0; }
+
+        std::string_view operator[](std::size_t idx) const { return m_pTable->fieldByIndex(m_firstField+idx); }
+
+        iterator begin() const { return iterator(this, 0); }
+        iterator end  () const { return iterator(this, m_numFields); }
+
+        std::vector<std::string> toVector() const
+        {
+            std::vector<std::string> res; res.reserve(m_numFields);
+            for(std::size_t i=0u; i!=m_numFields; ++i)
+                res.emplace_back((*this)[i]);
+            return res;
+        }
+    };
+
+    using iterator       = IndexIterator<LazyTable, Row>;
+    using const_iterator = iterator;
+
+    explicit LazyTable(char quot='\"') : m_rowStarts(1, 0), m_quot(quot) {}
+
+    LazyTable(const LazyTable&) = delete;
+    LazyTable& operator=(const LazyTable&) = delete;
+    LazyTable(LazyTable&&) = default;
+    LazyTable& operator=(LazyTable&&) = default;
+
+    std::size_t size       () const { return m_rowStarts.size()-1; }
+    bool        empty      () const { return size()==0; }
+    std::size_t fieldsCount() const { return m_fields.size(); }
+
+    std::size_t rowSize(std::size_t rowIdx) const { return m_rowStarts[rowIdx+1] - m_rowStarts[rowIdx]; }
+
+    //! Поле по сквозному индексу - обрабатывается при первом обращении
+    std::string_view fieldByIndex(std::size_t fieldIdx) const
+    {
+        auto &fs = m_fields[fieldIdx];
+        if ((fs.flags&Resolved)==0)
+        {
+            auto fieldView = details::trimFieldSpan(fs);
+            if (fs.escaped())
+            {
+                m_unescaped.emplace_back();
+                auto &str = m_unescaped.back();
+                details::appendUnescaped(str, fieldView, m_quot);
+                fieldView = std::string_view(str);
+            }
+
+            fs.begin  = fieldView.data();
+            fs.end    = fieldView.data()+fieldView.size();
+            fs.flags |= Resolved;
+        }
+
+        return std::string_view(fs.begin, std::size_t(fs.end-fs.begin));
+    }
+
+    std::string_view field(std::size_t rowIdx, std::size_t colIdx) const
+    {
+        return fieldByIndex(m_rowStarts[rowIdx]+colIdx);
+    }
+
+    //! Поле было в кавычках - не требует обработки поля
+    bool isQuoted(std::size_t rowIdx, std::size_t colIdx) const
+    {
+        return m_fields[m_rowStarts[rowIdx]+colIdx].quoted();
+    }
+
+    Row row(std::size_t rowIdx) const { return Row(this, m_rowStarts[rowIdx], rowSize(rowIdx)); }
+    Row operator[](std::size_t rowIdx) const { return row(rowIdx); }
+
+    iterator begin() const { return iterator(this, 0); }
+    iterator end  () const { return iterator(this, size()); }
+
+    void clear()
+    {
+        m_fields.clear();
+        m_rowStarts.assign(1, 0);
+        m_unescaped.clear();
+    }
+
+    //! Добавляет строку из найденных парсером полей, как есть
+    void appendRow(const details::FieldSpan *pFields, std::size_t numFields)
+    {
+        m_fields.insert(m_fields.end(), pFields, pFields+numFields);
+        m_rowStarts.push_back(m_fields.size());
+    }
+
+    //! Преобразование в старое представление
+    std::vector<std::vector<std::string>> toVector() const
+    {
+        std::vector<std::vector<std::string>> res; res.reserve(size());
+        for(std::size_t r=0u; r!=size(); ++r)
+            res.emplace_back(row(r).toVector());
+        return res;
+    }
+
+}; // class LazyTable
+
+//----------------------------------------------------------------------------
+//! Результат разбора с отложенной обработкой полей. Ошибки, включая InvalidCharAfterQuote, находятся при разборе
+struct LazyParseResult
+{
+    LazyTable                 data;
+    std::vector<ParseError>   errors;
+
+    //! Преобразование в результат старого вида
+    ParseResult toParseResult() const
+    {
+        return ParseResult{ data.toVector(), errors };
+    }
+};
+
+//----------------------------------------------------------------------------
+//! Выбор колонок для разбора - по индексам или по именам из строки заголовка
+/*! Колонки результата идут в заданном порядке. Невыбранные поля парсер только проходит,
+    не копируя, не обрезая и не раскавычивая. Отсутствующие в строке поля и колонки
+    с ненайденными в заголовке именами дают пустые значения.
+ */
+class ColumnProjection
+{
+    std::vector<std::size_t>  m_indices;
+    std::vector<std::string>  m_names  ;
+    bool                      m_byNames = false;
+
+public:
+
+    static constexpr std::size_t npos = std::size_t(-1);
+
+    ColumnProjection() = default;
+
+    static ColumnProjection byIndices(std::vector<std::size_t> indices)
+    {
+        ColumnProjection res;
+        res.m_indices = std::move(indices);
+        return res;
+    }
+
+    //! Имена ищутся в первой строке; сама она тоже попадает в результат, как и при обычном разборе
+    static ColumnProjection byNames(std::vector<std::string> names)
+    {
+        ColumnProjection res;
+        res.m_names   = std::move(names);
+        res.m_byNames = true;
+        return res;
+    }
+
+    bool selectsByNames() const { return m_byNames; }
+
+    const std::vector<std::string>& names() const { return m_names; }
+
+    //! Индексы колонок; для выбора по именам - пуст до разбора заголовка
+    const std::vector<std::size_t>& indices() const { return m_indices; }
+
+    //! Индексы колонок по строке заголовка; для ненайденных имён - npos
+    std::vector<std::size_t> resolve(const details::FieldSpan *pFields, std::size_t numFields, char quot) const
+    {
+        if (!m_byNames)
+            return m_indices;
+
+        std::vector<std::size_t> res(m_names.size(), npos);
+        std::string unescapeBuf;
+
+        for(std::size_t i=0u; i!=numFields; ++i)
+        {
+            auto name = details::fieldSpanValue(pFields[i], quot, unescapeBuf);
+            for(std::size_t n=0u; n!=m_names.size(); ++n)
+            {
+                if (res[n]==npos && m_names[n]==name)
+                    res[n] = i;
+            }
+        }
+
+        return res;
+    }
+
+}; // class ColumnProjection
+
+//----------------------------------------------------------------------------
+//! Фильтр строк, применяемый прямо при разборе
+/*! Предикат получает значения колонок columns (в заданном порядке, отсутствующие в строке - пустые)
+    и вызывается, как только эти колонки строки разобраны. Отклонённые строки в результат не попадают,
+    их оставшиеся поля не сохраняются и не обрабатываются. Фильтр применяется ко всем строкам,
+    включая заголовок.
+ */
+class RowFilter
+{
+public:
+
+    using Predicate = std::function<bool(const std::vector<std::string_view>&)>;
+
+private:
+
+    std::vector<std::size_t>                  m_columns;
+    Predicate                                 m_predicate;
+    std::size_t                               m_columnsNeeded = 0;
+
+    mutable std::vector<std::string_view>     m_values;
+    mutable std::vector<std::string>          m_unescapeBufs;
+
+public:
+
+    RowFilter(std::vector<std::size_t> columns, Predicate predicate)
+    : m_columns(std::move(columns))
+    , m_predicate(std::move(predicate))
+    , m_values(m_columns.size())
+    , m_unescapeBufs(m_columns.size())
+    {
+        for(auto c : m_columns)
+            m_columnsNeeded = std::max(m_columnsNeeded, c+1);
+    }
+
+    //! Сколько первых полей строки нужно предикату
+    std::size_t columnsNeeded() const { return m_columnsNeeded; }
+
+    //! Применяет предикат к полям строки; true - строка остаётся
+    bool operator()(const details::FieldSpan *pFields, std::size_t numFields, char quot) const
+    {
+        for(std::size_t i=0u; i!=m_columns.size(); ++i)
+            m_values[i] = m_columns[i]<numFields ? details::fieldSpanValue(pFields[m_columns[i]], quot, m_unescapeBufs[i]) : std::string_view();
+
+        return m_predicate(m_values);
+    }
+
+}; // class RowFilter
+
+//----------------------------------------------------------------------------
+namespace details {
+
+//----------------------------------------------------------------------------
+//! Фильтр строк по умолчанию - пропускает все строки, проверка компилятором выбрасывается
+struct NoRowFilter
+{
+    constexpr std::size_t columnsNeeded() const { return 0; }
+
+    template<typename SpanType>
+    bool operator()(const SpanType*, std::size_t) const { return true; }
+};
+
+//----------------------------------------------------------------------------
+//! Адаптер RowFilter к интерфейсу фильтра парсера
+struct RowFilterAdapter
+{
+    const RowFilter  &filter;
+    char              quot;
+
+    std::size_t columnsNeeded() const { return filter.columnsNeeded(); }
+    bool operator()(const FieldSpan *pFields, std::size_t numFields) const { return filter(pFields, numFields, quot); }
+};
+
+//----------------------------------------------------------------------------
+//! Диалект, заданный при выполнении
+class RuntimeDialect
+{
+    char m_delimiter  = ';';
+    char m_quot       = '\"';
+    bool m_strictMode = true;
+
+public:
+
+    //! Нулевой разделитель заменяется на ';', нулевая кавычка - на '"'
+    explicit RuntimeDialect(char delim=',', char quot='\"', bool strict=true)
+    : m_delimiter(delim ? delim : ';')
+    , m_quot(quot ? quot : '\"')
+    , m_strictMode(strict)
+    {}
+
+    char delimiter() const { return m_delimiter; }
+    char quot()      const { return m_quot; }
+    bool strict()    const { return m_strictMode; }
+};
+
+//----------------------------------------------------------------------------
+//! Диалект, заданный при компиляции - сравнения с разделителем и кавычкой становятся сравнениями с константами
+template<char Delim, char Quot='\"', bool Strict=true>
+struct StaticDialect
+{
+    static_assert(Delim!=0 && Quot!=0 && Delim!=Quot, "Delimiter and quote must be distinct non-zero chars");
+
+    static constexpr char delimiter() { return Delim; }
+    static constexpr char quot()      { return Quot; }
+    static constexpr bool strict()    { return Strict; }
+};
+
+//----------------------------------------------------------------------------
+//! Парсер CSV; DialectType - RuntimeDialect или StaticDialect
+/*! CharType - тип символов входа. Для char, кроме parse, есть parseView, parseFlat, parseLazy,
+    parseColumnar, проекции и фильтры; для прочих типов - parseSpans, parseChunk и parse.
+    Разделитель и кавычка задаются символом char и должны быть из ASCII.
+ */
+template<typename DialectType, typename CharType=char>
+class BasicCsvParser
+{
+public:
+
+    using char_type   = CharType;
+    using SpanType    = BasicFieldSpan<CharType>;
+    using ResultType  = BasicParseResult<CharType>;
+    using StringView  = std::basic_string_view<CharType>;
+
+private:
+
+    DialectType m_dialect;
+    size_t m_currentLine  = 1;
+    size_t m_currentPos   = 0;
+    size_t m_lineStartPos = 0;  // Абсолютная позиция, с учётом m_baseOffset
+    size_t m_baseOffset   = 0;  // Позиция начала текущего куска во всём потоке
+    size_t m_rowStartPos  = 0;  // Абсолютная позиция начала текущей записи
+    size_t m_columnsCount = 0;
+    bool   m_skipNewlines = false; // Предыдущий кусок закончился посреди серии переводов строки
+
+    std::vector<SpanType> m_rowFields; // Поля текущей строки, буфер переиспользуется между строками
+
+    //! Состояние сканера в незавершённой записи между кусками (см. parseChunk)
+    struct ResumeState
+    {
+        bool        active            = false;
+        std::size_t scanPos           = 0;     // Откуда продолжать сканирование - от начала незавершённого поля
+        bool        inQuotes          = false;
+        bool        wasQuoted         = false;
+        bool        escaped           = false;
+        bool        lastCharDelimiter = false;
+        bool        rowRejected       = false;
+        std::size_t rejectedFields    = 0;
+    };
+
+    ResumeState                              m_resume;
+    std::size_t                              m_carriedFields = 0; // Первые поля m_rowFields, уже скопированные в m_carryBlocks
+    std::deque< std::basic_string<CharType> > m_carryBlocks;        // Завершённые поля незавершённой записи; элементы deque не перемещаются
+
+    //! Копирует поля незавершённой записи, ещё ссылающиеся на текущий кусок, в m_carryBlocks
+    void carryRowFields()
+    {
+        if (m_carriedFields==m_rowFields.size())
+            return;
+
+        std::size_t total = 0;
+        for(std::size_t i=m_carriedFields; i!=m_rowFields.size(); ++i)
+            total += std::size_t(m_rowFields[i].end-m_rowFields[i].begin);
+
+        m_carryBlocks.emplace_back();
+        auto &block = m_carryBlocks.back();
+        block.reserve(total);
+        for(std::size_t i=m_carriedFields; i!=m_rowFields.size(); ++i)
+            block.append(m_rowFields[i].begin, m_rowFields[i].end);
+
+        const CharType *p = block.data();
+        for(std::size_t i=m_carriedFields; i!=m_rowFields.size(); ++i)
+        {
+            std::size_t len = std::size_t(m_rowFields[i].end-m_rowFields[i].begin);
+            m_rowFields[i].begin = p;
+            m_rowFields[i].end   = p+len;
+            p += len;
+        }
+
+        m_carriedFields = m_rowFields.size();
+    }
+
+    void clearRowFields()
+    {
+        m_rowFields.clear();
+        m_carriedFields = 0;
+        if (!m_carryBlocks.empty())
+            m_carryBlocks.clear();
+    }
+
+    //! Ошибка текущей записи; в errors она попадает в конце записи, сообщение формируется только тогда
+    struct PendingError
+    {
+        ParseErrorType type;
+        std::size_t    offset;   // Абсолютная позиция
+        std::size_t    value;    // Для InconsistentColumns - число полей
+        std::size_t    line;
+        std::size_t    linePos;
+        std::string    message;  // Пусто - сообщение по умолчанию (см. errorMessage)
+    };
+
+    static std::uint32_t clampToUint32(std::size_t v)
+    {
+        return v>std::size_t(0xFFFFFFFFu) ? 0xFFFFFFFFu : std::uint32_t(v);
+    }
+
+    ErrorPolicy               m_errorPolicy;
+    ErrorLog                 *m_pErrorLog    = nullptr;
+    std::vector<PendingError> m_pendingErrors;         // Буфер переиспользуется между записями
+    std::size_t               m_detailedErrors = 0;    // Сохранено ошибок с сообщениями
+    bool                      m_errorStop      = false; // Разбор прекращён по ErrorPolicy::stopAtFirst
+
+    void addError(ParseErrorType type, std::size_t pos, std::size_t value=0)
+    {
+        m_pendingErrors.push_back(PendingError{ type, m_baseOffset + pos, value, m_currentLine, m_baseOffset + pos - m_lineStartPos + 1, std::string() });
+    }
+
+    //! Переносит ошибки завершённой записи в errors и ErrorLog согласно политике
+    void commitErrors(std::vector<ParseError> &errors)
+    {
+        ParseStats *pStats = currentStats();
+
+        for(auto &pe : m_pendingErrors)
+        {
+            if (m_errorStop)
+                break;
+
+            if (pStats)
+                ++pStats->errors[std::size_t(pe.type)];
+
+            if (m_pErrorLog)
+            {
+                m_pErrorLog->expectedColumns = m_columnsCount;
+                ++m_pErrorLog->counts[std::size_t(pe.type)];
+                if (m_errorPolicy.mode()==ErrorPolicy::Mode::Compact)
+                    m_pErrorLog->records.push_back(ErrorRecord{ std::uint64_t(pe.offset), clampToUint32(pe.line), clampToUint32(pe.linePos), std::uint32_t(pe.value), pe.type });
+            }
+
+            if (m_detailedErrors<m_errorPolicy.maxDetailed())
+            {
+                ++m_detailedErrors;
+                if (pe.message.empty())
+                    pe.message = errorMessage(pe.type, m_columnsCount, pe.value);
+                errors.push_back(ParseError{ pe.type, std::move(pe.message), pe.line, pe.linePos });
+            }
+
+            if (m_errorPolicy.mode()==ErrorPolicy::Mode::StopAtFirst)
+            {
+                m_errorStop = true;
+                if (m_pErrorLog)
+                    m_pErrorLog->stopped = true;
+            }
+        }
+
+        m_pendingErrors.clear();
+    }
+
+    static
+    bool isAllSpaces(const CharType *b, const CharType *e)
+    {
+        for(; b!=e; ++b)
+        {
+            if (*b!=CharType(' '))
+                return false;
+        }
+        return true;
+    }
+
+
+public:
+
+    explicit BasicCsvParser(const DialectType &dialect=DialectType())
+    : m_dialect(dialect)
+    {}
+
+    //! Только для RuntimeDialect
+    BasicCsvParser(char delim, char quot='\"', bool strict=true)
+    : m_dialect(delim, quot, strict)
+    {}
+
+    const DialectType& dialect() const { return m_dialect; }
+
+    char delimiter() const { return m_dialect.delimiter(); }
+    char quot()      const { return m_dialect.quot(); }
+
+    //! Сброс состояния перед разбором нового входа. Счётчик строк, как и раньше, не сбрасывается
+    void resetState()
+    {
+        m_resume = ResumeState();
+        clearRowFields();
+
+        m_pendingErrors.clear();
+        m_detailedErrors = 0;
+        m_errorStop      = false;
+
+        m_currentPos   = 0;
+        m_lineStartPos = 0;
+        m_baseOffset   = 0;
+        m_rowStartPos  = 0;
+        m_columnsCount = 0;
+        m_skipNewlines = false;
+    }
+
+    //! Подготовка к разбору с границы записи в середине входа
+    /*! lineStartPos - позиция, с которой последовательный разбор считал бы начало строки
+        (символ после первого перевода строки предыдущей записи), columnsCount - число
+        колонок первой строки всего входа. Номера строк в ошибках считаются с 1.
+     */
+    void resetState(std::size_t lineStartPos, std::size_t columnsCount)
+    {
+        resetState();
+        m_currentLine  = 1;
+        m_lineStartPos = lineStartPos;
+        m_columnsCount = columnsCount;
+    }
+
+    //! Ошибка в поле строки, переданной в обработчик строк; pos - позиция в текущем куске
+    /*! Вызывается только из обработчика строк - тогда номер строки и её начало соответствуют этой строке.
+        Ошибка попадает в errors, переданный в разбор, по завершении строки, согласно политике ошибок.
+        makeMessage() -> std::string вызывается, только если ошибка будет сохранена с сообщением -
+        после исчерпания лимита политики сообщение не строится.
+     */
+    template<typename MessageMaker>
+    void reportRowError(ParseErrorType type, std::size_t pos, MessageMaker &&makeMessage)
+    {
+        addError(type, pos);
+        if (m_detailedErrors + m_pendingErrors.size() <= m_errorPolicy.maxDetailed())
+            m_pendingErrors.back().message = makeMessage();
+    }
+
+    //! Политика ошибок; pErrorLog - куда добавлять счётчики и компактные записи, может быть nullptr
+    /*! Действует до следующего вызова; ErrorLog не очищается, expectedColumns в нём обновляется при разборе
+     */
+    void setErrorPolicy(const ErrorPolicy &policy, ErrorLog *pErrorLog=nullptr)
+    {
+        m_errorPolicy = policy;
+        m_pErrorLog   = pErrorLog;
+    }
+
+    const ErrorPolicy& errorPolicy() const { return m_errorPolicy; }
+
+    //! Разбор прекращён по ErrorPolicy::stopAtFirst - дальнейшие куски пропускаются до resetState
+    bool stopped() const { return m_errorStop; }
+
+    //! Номер текущей строки - на единицу больше количества завершённых строк
+    std::size_t currentLine() const { return m_currentLine; }
+
+    //! Абсолютная позиция начала строки; в обработчике строк - начало переданной в него строки
+    std::size_t rowStartPos() const { return m_rowStartPos; }
+
+    //! Последний кусок закончился посреди записи - парсер ждёт её продолжения (см. parseChunk)
+    bool recordPending() const { return m_resume.active; }
+
+    //! Базовый разбор - находит поля, не копируя их; на каждую завершённую строку вызывает rowHandler(const FieldSpan*, std::size_t)
+    template<typename RowHandler>
+    void parseSpans(const CharType *pData, std::size_t size, std::vector<ParseError> &errors, RowHandler &&rowHandler)
+    {
+        resetState();
+        parseChunk(pData, size, 0, true, errors, rowHandler, NoRowFilter());
+    }
+
+    //! Базовый разбор с фильтром строк - отклонённые фильтром строки в rowHandler не передаются
+    template<typename RowHandler, typename RowFilterType>
+    void parseSpans(const CharType *pData, std::size_t size, std::vector<ParseError> &errors, RowHandler &&rowHandler, RowFilterType &&rowFilter)
+    {
+        resetState();
+        parseChunk(pData, size, 0, true, errors, rowHandler, rowFilter);
+    }
+
+    //! Разбор очередного куска потока
+    /*! baseOffset - позиция pData[0] во всём потоке, используется для позиций в ошибках.
+        Если bFinal==false, незавершённая последняя запись не разбирается заново в следующем куске:
+        её завершённые поля копируются в парсер, состояние сканера сохраняется, а возвращается позиция
+        начала её незавершённого поля. Вызывающий передаёт следующим куском данные с этой позиции
+        (всё, что было после неё, плюс новые данные) - сканирование продолжается с того места, где
+        остановилось. Ошибки незавершённой записи попадают в errors, когда запись завершится.
+        Если bFinal==true - конец данных считается концом входа, возвращается size.
+     */
+    template<typename RowHandler>
+    std::size_t parseChunk(const CharType *pData, std::size_t size, std::size_t baseOffset, bool bFinal, std::vector<ParseError> &errors, RowHandler &&rowHandler)
+    {
+        return parseChunk(pData, size, baseOffset, bFinal, errors, rowHandler, NoRowFilter());
+    }
+
+    //! Разбор очередного куска с фильтром строк
+    /*! Фильтр (см. NoRowFilter) вызывается, как только готовы первые rowFilter.columnsNeeded() полей строки,
+        или в конце строки, если полей в ней меньше. Для отклонённой строки поля дальше не сохраняются,
+        только считаются - ошибки, включая InconsistentColumns, остаются теми же, что и без фильтра.
+     */
+    template<typename RowHandler, typename RowFilterType>
+    std::size_t parseChunk(const CharType *pData, std::size_t size, std::size_t baseOffset, bool bFinal, std::vector<ParseError> &errors, RowHandler &&rowHandler, RowFilterType &&rowFilter)
+    {
+        using std::to_string;
+
+        if (m_errorStop)
+            return size;
+
+        ParseStats *pStats = currentStats();
+        ParseTimeScope parseTime(pStats);
+
+        const std::size_t filterColumns = rowFilter.columnsNeeded();
+
+        // Для StaticDialect - константы, для RuntimeDialect - локальные копии, которые не перечитываются после вызовов обработчиков
+        const CharType delim  = CharType(m_dialect.delimiter());
+        const CharType quot   = CharType(m_dialect.quot());
+        const bool strict = m_dialect.strict();
+
+        std::vector<SpanType> &currentRow = m_rowFields;
+
+        m_baseOffset = baseOffset;
+        m_currentPos = 0;
+
+        bool inQuotes = false;
+        bool wasQuoted = false;
+        bool escaped = false;
+        bool lastCharDelimiter = false;
+
+        bool        rowRejected    = false; // Строка отклонена фильтром
+        std::size_t rejectedFields = 0;     // Число полей отклонённой строки
+
+        const bool resumed = m_resume.active;
+        if (resumed)
+        {
+            // Продолжение записи из предыдущего куска - pData начинается с её незавершённого поля
+            m_currentPos      = std::min(m_resume.scanPos, size);
+            inQuotes          = m_resume.inQuotes;
+            wasQuoted         = m_resume.wasQuoted;
+            escaped           = m_resume.escaped;
+            lastCharDelimiter = m_resume.lastCharDelimiter;
+            rowRejected       = m_resume.rowRejected;
+            rejectedFields    = m_resume.rejectedFields;
+            m_resume.active   = false;
+        }
+        else
+        {
+            clearRowFields();
+
+            if (m_skipNewlines)
+            {
+                // Продолжаем пропускать серию переводов строки, начатую в предыдущем куске
+                while (m_currentPos < size && (pData[m_currentPos] == '\r' || pData[m_currentPos] == '\n'))
+                    m_currentPos++;
+
+                if (m_currentPos < size)
+                    m_skipNewlines = false;
+            }
+
+            m_rowStartPos = m_baseOffset + m_currentPos;
+        }
+
+        // При продолжении записи незавершённое поле начинается с pData[0]
+        size_t fieldStart = resumed ? 0 : m_currentPos; // Начало поля; для закавыченного - первый символ после открывающей кавычки
+        size_t fieldEnd   = fieldStart;                 // Конец закавыченного поля - позиция закрывающей кавычки
+
+        size_t committedPos    = fieldStart;   // Начало первой незавершённой записи
+        size_t suspendPos      = size;         // Позиция, на которой сканирование остановлено до следующего куска
+
+        auto updateStats = [&](std::size_t scannedSize)
+        {
+            if (pStats)
+                pStats->bytesScanned += scannedSize;
+        };
+
+        StructuralIndexerFor<CharType> indexer(pData, size, delim, quot);
+
+        auto addCol = [&](bool lastInRow)
+        {
+            if (rowRejected)
+            {
+                ++rejectedFields;
+            }
+            else if (wasQuoted)
+            {
+                unsigned flags = SpanType::Quoted;
+                if (escaped)
+                    flags |= SpanType::Escaped;
+                if (lastInRow)
+                    flags |= SpanType::TrimRight;
+                currentRow.push_back(SpanType{pData+fieldStart, pData+fieldEnd, flags});
+            }
+            else
+            {
+                currentRow.push_back(SpanType{pData+fieldStart, pData+m_currentPos, 0u});
+            }
+
+            if (filterColumns && !rowRejected && currentRow.size()==filterColumns)
+            {
+                if (!rowFilter(static_cast<const SpanType*>(currentRow.data()), currentRow.size()))
+                {
+                    rowRejected    = true;
+                    rejectedFields = currentRow.size();
+                    currentRow.clear();
+                    m_carriedFields = 0;
+                }
+            }
+
+            inQuotes = false;
+            wasQuoted = false;
+            escaped = false;
+        };
+
+        auto handleRowEnd = [&]()
+        {
+            if (m_currentPos>fieldStart || lastCharDelimiter || wasQuoted)
+            {
+                addCol(true);
+            }
+
+            if (filterColumns && !rowRejected && !currentRow.empty() && currentRow.size()<filterColumns)
+            {
+                // Короткая строка - фильтр получает те поля, что есть
+                if (!rowFilter(static_cast<const SpanType*>(currentRow.data()), currentRow.size()))
+                {
+                    rowRejected    = true;
+                    rejectedFields = currentRow.size();
+                }
+            }
+
+            std::size_t numFields = rowRejected ? rejectedFields : currentRow.size();
+            if (numFields)
+            {
+                if (m_columnsCount == 0)
+                {
+                    m_columnsCount = numFields;
+                }
+                else if (strict && numFields != m_columnsCount)
+                {
+                    addError(ParseErrorType::InconsistentColumns, m_currentPos, numFields);
+                }
+
+                if (!rowRejected)
+                {
+                    if (pStats)
+                        accumulateRowStats(*pStats, static_cast<const SpanType*>(currentRow.data()), currentRow.size(), quot);
+                    rowHandler(static_cast<const SpanType*>(currentRow.data()), currentRow.size());
+                }
+                else if (pStats)
+                {
+                    ++pStats->filteredRows;
+                }
+            }
+
+            clearRowFields();
+            rowRejected    = false;
+            rejectedFields = 0;
+            inQuotes = false;
+            wasQuoted = false;
+            escaped = false;
+            m_currentLine++;
+            m_lineStartPos = m_baseOffset + m_currentPos + 1;
+        };
+
+        for (; m_currentPos < size; ++m_currentPos)
+        {
+            CharType c = pData[m_currentPos];
+            
+            if (inQuotes)
+            {
+                if (c == quot)
+                {
+                    if (!bFinal && m_currentPos + 1 == size)
+                    {
+                        // Удвоенная это кавычка или закрывающая - станет ясно в следующем куске
+                        suspendPos = m_currentPos;
+                        break;
+                    }
+
+                    if (m_currentPos + 1 < size && pData[m_currentPos + 1] == quot)
+                    {
+                        escaped = true;
+                        m_currentPos++;
+                    }
                     else
                     {
                         inQuotes = false;
-                        wasQuoted = true;
+                        fieldEnd = m_currentPos;
                         
                         size_t end = m_currentPos + 1;
-                        while (end < content.size() && 
-                               content[end] != m_delimiter && 
-                               content[end] != '\r' && 
-                               content[end] != '\n')
+                        bool   invalidAfterQuote = false;
+                        while (end < size && 
+                               pData[end] != delim && 
+                               pData[end] != '\r' && 
+                               pData[end] != '\n')
                         {
-                            if (content[end] != ' ' && content[end] != '\t')
+                            if (pData[end] != ' ' && pData[end] != '\t')
                             {
-                                addError(result, ParseErrorType::InvalidCharAfterQuote, "Invalid character after closing quote");
-                                while (end < content.size() && 
-                                       content[end] != m_delimiter && 
-                                       content[end] != '\n' && 
-                                       content[end] != '\r')
+                                invalidAfterQuote = true;
+                                addError(ParseErrorType::InvalidCharAfterQuote, m_currentPos);
+                                while (end < size && 
+                                       pData[end] != delim && 
+                                       pData[end] != '\n' && 
+                                       pData[end] != '\r')
                                 {
                                     end++;
                                 }
-                                m_currentPos = end - 1;
                                 break;
                             }
                             end++;
                         }
+
+                        if (!bFinal && end == size)
+                        {
+                            // Хвост после закавыченного поля не закончился - в следующем куске проверяем его заново с закрывающей кавычки
+                            if (invalidAfterQuote)
+                                m_pendingErrors.pop_back();
+                            inQuotes   = true;
+                            suspendPos = m_currentPos;
+                            break;
+                        }
+
                         m_currentPos = end - 1;
                     }
                 }
                 else
                 {
-                    field += c;
+                    // Прочие символы, включая переводы строк, просто входят в поле - сразу переходим к следующей кавычке
+                    m_currentPos = indexer.nextQuote(m_currentPos + 1) - 1;
                 }
             }
             else
             {
-                if (c == m_quot)
+                if (c == quot)
                 {
-                    if (!field.empty() && field != std::string(field.size(), ' '))
+                    if (!isAllSpaces(pData+fieldStart, pData+m_currentPos))
                     {
-                        addError(result, ParseErrorType::InvalidQuoteUsage, "Quote appears in middle of field");
-                        field += c;
+                        // Кавычка остаётся частью поля
+                        addError(ParseErrorType::InvalidQuoteUsage, m_currentPos);
                     }
                     else
                     {
                         inQuotes = true;
                         wasQuoted = true;
-                        field.clear();
+                        fieldStart = m_currentPos + 1;
+                    }
+
+                    lastCharDelimiter = false;
+                }
+                else if (c == delim)
+                {
+                    addCol(false);
+                    fieldStart = m_currentPos + 1;
+                    lastCharDelimiter = true;
+                }
+                else if (c == '\r' || c == '\n')
+                {
+                    handleRowEnd();
+                    
+                    while (m_currentPos + 1 < size && 
+                          (pData[m_currentPos + 1] == '\r' || 
+                           pData[m_currentPos + 1] == '\n'))
+                    {
+                        m_currentPos++;
+                    }
+                    
+                    fieldStart = m_currentPos + 1;
+                    lastCharDelimiter = false;
+
+                    committedPos    = fieldStart;
+                    m_rowStartPos   = m_baseOffset + committedPos;
+                    if (committedPos == size)
+                        m_skipNewlines = true; // Серия переводов строки может продолжиться в следующем куске
+
+                    if (!m_pendingErrors.empty())
+                    {
+                        commitErrors(errors);
+                        if (m_errorStop)
+                        {
+                            updateStats(committedPos);
+                            return size;
+                        }
                     }
+                }
+                else
+                {
+                    lastCharDelimiter = false;
+                    // Обычные символы только расширяют поле - переходим к следующему структурному символу
+                    m_currentPos = indexer.nextStructural(m_currentPos + 1) - 1;
+                }
+            }
+        }
+
+        if (!bFinal)
+        {
+            if (suspendPos==size && fieldStart==size && currentRow.empty() && !rowRejected && !lastCharDelimiter && !wasQuoted)
+            {
+                // Кусок закончился на границе записи
+                updateStats(committedPos);
+                return committedPos;
+            }
+
+            // Запись не завершена - сохраняем её поля и состояние сканера, незавершённое поле вернётся со следующим куском
+            carryRowFields();
+
+            m_resume.active            = true;
+            m_resume.scanPos           = suspendPos - fieldStart;
+            m_resume.inQuotes          = inQuotes;
+            m_resume.wasQuoted         = wasQuoted;
+            m_resume.escaped           = escaped;
+            m_resume.lastCharDelimiter = lastCharDelimiter;
+            m_resume.rowRejected       = rowRejected;
+            m_resume.rejectedFields    = rejectedFields;
+
+            updateStats(fieldStart);
+            return fieldStart;
+        }
+
+        if (m_currentPos>fieldStart || lastCharDelimiter || wasQuoted || !currentRow.empty() || rowRejected)
+        {
+            if (inQuotes)
+            {
+                fieldEnd = size;
+                addError(ParseErrorType::UnclosedQuote, m_currentPos);
+            }
+            handleRowEnd();
+        }
+
+        commitErrors(errors);
+        updateStats(size);
+        return size;
+    }
+
+    ResultType parse(StringView content)
+    {
+        ResultType result;
+        parseInto(content, result);
+        return result;
+    }
+
+    //! Разбор в существующий результат - BasicParseResult или BasicPmrParseResult
+    /*! Строки, поля и выделенная под них память результата переиспользуются - при разборе
+        файлов близкого размера выделения памяти почти не нужны. Лишние строки удаляются.
+     */
+    template<typename ResultT>
+    void parseInto(StringView content, ResultT &result)
+    {
+        result.errors.clear();
+
+        ParseStats *pStats = currentStats();
+
+        std::size_t numRows = 0;
+        parseSpans(content.data(), content.size(), result.errors, [&](const SpanType *pFields, std::size_t numFields)
+        {
+            const std::uint64_t rowStartNs = pStats ? statsNowNs() : 0;
+
+            if (numRows==result.data.size())
+                result.data.emplace_back();
+            spansToStrings(pFields, numFields, CharType(m_dialect.quot()), result.data[numRows]);
+            ++numRows;
+
+            if (pStats)
+                pStats->convertNs += statsNowNs() - rowStartNs; // parseChunk вычтет это время из parseNs
+        });
+
+        result.data.erase(result.data.begin()+std::ptrdiff_t(numRows), result.data.end());
+    }
+
+    //! Разбор куска (см. parseChunk выше) с добавлением строк в result
+    std::size_t parseChunk(StringView data, std::size_t baseOffset, bool bFinal, ResultType &result)
+    {
+        return parseChunk(data.data(), data.size(), baseOffset, bFinal, result.errors, [&](const SpanType *pFields, std::size_t numFields)
+        {
+            result.data.emplace_back();
+            spansToStrings(pFields, numFields, CharType(m_dialect.quot()), result.data.back());
+        });
+    }
+
+    //! Разбор без копирования - поля ссылаются на content, материализуются только поля с удвоенными кавычками
+    ViewParseResult parseView(std::string_view content)
+    {
+        ViewParseResult result;
+
+        parseSpans(content.data(), content.size(), result.errors, [&](const FieldSpan *pFields, std::size_t numFields)
+        {
+            result.data.emplace_back();
+            auto &row = result.data.back();
+            row.reserve(numFields);
+
+            for(std::size_t i=0u; i!=numFields; ++i)
+            {
+                const auto &fs = pFields[i];
+                auto fieldView = trimFieldSpan(fs);
+                if (fs.escaped())
+                {
+                    result.unescaped.emplace_back();
+                    auto &str = result.unescaped.back();
+                    appendUnescaped(str, fieldView, m_dialect.quot());
+                    fieldView = std::string_view(str);
+                }
+                row.emplace_back(fieldView);
+            }
+        });
+
+        return result;
+    }
+
+    //! Разбор с отложенной обработкой полей - поля обрезаются и раскавычиваются при первом обращении
+    LazyParseResult parseLazy(std::string_view content)
+    {
+        LazyParseResult result{ LazyTable(m_dialect.quot()), {} };
+
+        parseSpans(content.data(), content.size(), result.errors, [&](const FieldSpan *pFields, std::size_t numFields)
+        {
+            result.data.appendRow(pFields, numFields);
+        });
+
+        return result;
+    }
+
+    //! Разбор с фильтром строк
+    ParseResult parse(std::string_view content, const RowFilter &filter)
+    {
+        ParseResult result;
+
+        parseSpans(content.data(), content.size(), result.errors, [&](const FieldSpan *pFields, std::size_t numFields)
+        {
+            result.data.emplace_back();
+            spansToStrings(pFields, numFields, m_dialect.quot(), result.data.back());
+        }, RowFilterAdapter{filter, m_dialect.quot()});
+
+        return result;
+    }
+
+    //! Разбор только выбранных колонок
+    ParseResult parse(std::string_view content, const ColumnProjection &projection)
+    {
+        return parse(content, projection, NoRowFilter());
+    }
+
+    //! Разбор только выбранных колонок строк, прошедших фильтр
+    ParseResult parse(std::string_view content, const ColumnProjection &projection, const RowFilter &filter)
+    {
+        return parse(content, projection, RowFilterAdapter{filter, m_dialect.quot()});
+    }
+
+    template<typename RowFilterType>
+    ParseResult parse(std::string_view content, const ColumnProjection &projection, RowFilterType &&rowFilter)
+    {
+        ParseResult result;
+
+        std::vector<std::size_t> columns = projection.indices();
+        bool resolvePending = projection.selectsByNames();
+        std::string unescapeBuf;
+
+        parseSpans(content.data(), content.size(), result.errors, [&](const FieldSpan *pFields, std::size_t numFields)
+        {
+            if (resolvePending)
+            {
+                columns = projection.resolve(pFields, numFields, m_dialect.quot());
+                resolvePending = false;
+            }
+
+            result.data.emplace_back(columns.size());
+            auto &row = result.data.back();
+
+            for(std::size_t i=0u; i!=columns.size(); ++i)
+            {
+                if (columns[i]<numFields)
+                {
+                    auto fieldView = fieldSpanValue(pFields[columns[i]], m_dialect.quot(), unescapeBuf);
+                    row[i].assign(fieldView.data(), fieldView.size());
+                }
+            }
+        }, rowFilter);
+
+        return result;
+    }
+
+    //! Разбор строк, прошедших фильтр, в плоскую таблицу
+    FlatParseResult parseFlat(std::string_view content, const RowFilter &filter)
+    {
+        FlatParseResult result;
+
+        std::string unescapeBuf;
+
+        parseSpans(content.data(), content.size(), result.errors, [&](const FieldSpan *pFields, std::size_t numFields)
+        {
+            for(std::size_t i=0u; i!=numFields; ++i)
+                result.data.appendField(fieldSpanValue(pFields[i], m_dialect.quot(), unescapeBuf));
+            result.data.endRow();
+        }, RowFilterAdapter{filter, m_dialect.quot()});
+
+        return result;
+    }
+
+    //! Разбор только выбранных колонок в плоскую таблицу
+    FlatParseResult parseFlat(std::string_view content, const ColumnProjection &projection)
+    {
+        FlatParseResult result;
+
+        std::vector<std::size_t> columns = projection.indices();
+        bool resolvePending = projection.selectsByNames();
+        std::string unescapeBuf;
+
+        parseSpans(content.data(), content.size(), result.errors, [&](const FieldSpan *pFields, std::size_t numFields)
+        {
+            if (resolvePending)
+            {
+                columns = projection.resolve(pFields, numFields, m_dialect.quot());
+                resolvePending = false;
+            }
+
+            for(auto colIdx : columns)
+                result.data.appendField(colIdx<numFields ? fieldSpanValue(pFields[colIdx], m_dialect.quot(), unescapeBuf) : std::string_view());
+            result.data.endRow();
+        });
+
+        return result;
+    }
+
+    //! Разбор в плоскую таблицу
+    FlatParseResult parseFlat(std::string_view content)
+    {
+        FlatParseResult result;
+        result.data.reserve(content.size());
 
-                    lastCharDelimiter = false;
-                }
-                else if (c == m_delimiter)
+        std::string unescapeBuf;
+
+        parseSpans(content.data(), content.size(), result.errors, [&](const FieldSpan *pFields, std::size_t numFields)
+        {
+            for(std::size_t i=0u; i!=numFields; ++i)
+            {
+                const auto &fs = pFields[i];
+                auto fieldView = trimFieldSpan(fs);
+                if (fs.escaped())
                 {
-                    // currentRow.push_back(field);
-                    // field.clear();
-                    // wasQuoted = false;
-                    addCol();
-                    lastCharDelimiter = true;
+                    unescapeBuf.clear();
+                    appendUnescaped(unescapeBuf, fieldView, m_dialect.quot());
+                    fieldView = std::string_view(unescapeBuf);
                 }
-                else if (c == '\r' || c == '\n')
-                {
-                    bool lineEndProcessed = handleRowEnd();
-                    
-                    while (m_currentPos + 1 < content.size() && 
-                          (content[m_currentPos + 1] == '\r' || 
-                           content[m_currentPos + 1] == '\n'))
-                    {
-                        m_currentPos++;
-                    }
-                    
-                    if (!lineEndProcessed)
-                    {
-                        addError(result, ParseErrorType::UnclosedQuote, "Unclosed quotes in field. Attempting recovery");
-                        handleRowEnd(true);
-                    }
+                result.data.appendField(fieldView);
+            }
+            result.data.endRow();
+        });
 
-                    lastCharDelimiter = false;
-                }
-                else
+        return result;
+    }
+
+    //! Разбор сразу в колонки. Число колонок задаёт первая строка
+    ColumnarParseResult parseColumnar(std::string_view content, RaggedRowsPolicy raggedPolicy=RaggedRowsPolicy::PadOrTruncate)
+    {
+        ColumnarParseResult result;
+        auto &table = result.data;
+
+        std::string unescapeBuf;
+        bool firstRow = true;
+
+        parseSpans(content.data(), content.size(), result.errors, [&](const FieldSpan *pFields, std::size_t numFields)
+        {
+            if (firstRow)
+            {
+                table.setColumnsCount(numFields);
+                table.reserve(content.size()/numFields, 0); // Грубая оценка - символы входа поровну по колонкам
+                firstRow = false;
+            }
+            else if (numFields!=table.columnsCount())
+            {
+                if (raggedPolicy==RaggedRowsPolicy::SkipRow)
                 {
-                    field += c;
-                    lastCharDelimiter = false;
+                    ++result.skippedRows;
+                    return;
                 }
+
+                if (raggedPolicy==RaggedRowsPolicy::AddColumns && numFields>table.columnsCount())
+                    table.setColumnsCount(numFields);
             }
-        }
 
-        if (!field.empty() || lastCharDelimiter || wasQuoted || !currentRow.empty())
-        {
-            if (inQuotes)
+            std::size_t n = std::min(numFields, table.columnsCount());
+            for(std::size_t i=0u; i!=n; ++i)
             {
-                addError(result, ParseErrorType::UnclosedQuote, "Unclosed quotes at end of input");
+                const auto &fs = pFields[i];
+                auto fieldView = trimFieldSpan(fs);
+                if (fs.escaped())
+                {
+                    unescapeBuf.clear();
+                    appendUnescaped(unescapeBuf, fieldView, m_dialect.quot());
+                    fieldView = std::string_view(unescapeBuf);
+                }
+                table.appendValue(i, fieldView);
             }
-            handleRowEnd(true);
-        }
+
+            table.endRow();
+        });
 
         return result;
     }
-};
+}; // class BasicCsvParser
+
+//----------------------------------------------------------------------------
+using CsvParser = BasicCsvParser<RuntimeDialect>;
+
+//----------------------------------------------------------------------------
+//! Вызывает func(parser) с парсером для StaticDialect<Delim, Quot> в строгом или нестрогом режиме
+template<char Delim, char Quot, typename CharType, typename Func>
+decltype(auto) withStaticParser(bool strict, Func &&func)
+{
+    if (strict)
+    {
+        BasicCsvParser< StaticDialect<Delim, Quot, true>, CharType > parser;
+        return func(parser);
+    }
+
+    BasicCsvParser< StaticDialect<Delim, Quot, false>, CharType > parser;
+    return func(parser);
+}
+
+//----------------------------------------------------------------------------
+//! Вызывает func(parser) с парсером, специализированным при компиляции, если диалект - один из распространённых
+/*! Специализации есть для разделителей ',', ';', '\t' и '|' с кавычкой '"', для остальных диалектов
+    используется CsvParser. func должен возвращать один и тот же тип для любого парсера - обычно это
+    обобщённая лямбда. CharType - тип символов входа.
+ */
+template<typename CharType=char, typename Func>
+decltype(auto) withDialectParser(char delim, char quot, bool strict, Func &&func)
+{
+    const RuntimeDialect dialect(delim, quot, strict);
+    if (dialect.quot()=='\"')
+    {
+        switch(dialect.delimiter())
+        {
+            case ',' : return withStaticParser<',' , '\"', CharType>(strict, func);
+            case ';' : return withStaticParser<';' , '\"', CharType>(strict, func);
+            case '\t': return withStaticParser<'\t', '\"', CharType>(strict, func);
+            case '|' : return withStaticParser<'|' , '\"', CharType>(strict, func);
+            default  : break;
+        }
+    }
+
+    BasicCsvParser<RuntimeDialect, CharType> parser(dialect);
+    return func(parser);
+}
 
 
 
@@ -705,126 +2592,450 @@ public:
 
 //----------------------------------------------------------------------------
 //! Автоопределение кавычек. Учитываются варианты, когда кавычка следует за разделителем полей, и наоборот
-//! Не самый надёжный способ, зато не запарный
+//! Не самый надёжный способ, зато не запарный. Просматривается не больше detectChunkSize символов
 template<typename InputIter, typename StringType>
 char detectQuotes(InputIter b, InputIter e, const StringType &seps="\t;,:|#", const StringType &quotes="\"\'`", std::size_t detectChunkSize=1000*1000)
 {
-    e = details::getChunkForDetections(b, e, detectChunkSize);
+    details::DialectSniffer sniffer(seps, quotes, 0, detectChunkSize);
+    sniffer.sniff(b, e);
+    sniffer.finish();
+    return sniffer.quot();
+}
+
+//----------------------------------------------------------------------------
+template<typename StringType>
+char detectQuotes(const StringType &data, const StringType &seps="\t;,:|#", const StringType &quotes="\"\'`", std::size_t detectChunkSize=1000*1000)
+{
+    return detectQuotes(data.begin(), data.end(), seps, quotes, detectChunkSize);
+}
 
-    std::vector<std::size_t> quotesCount = std::vector<std::size_t>(quotes.size(), 0);
+//----------------------------------------------------------------------------
+//! Автоопределение разделителя - кандидат с самым стабильным числом вхождений на запись
+template<typename IterType, typename StringType>
+char detectSeparators(IterType b, IterType e, const StringType &seps="\t;,:|#", typename StringType::value_type quot=0, std::size_t detectChunkSize=1000*1000)
+{
+    details::DialectSniffer sniffer(seps, seps, quot ? char(quot) : '\"', detectChunkSize);
+    sniffer.sniff(b, e);
+    sniffer.finish();
+    return sniffer.delim();
+}
 
-    bool prevSep            = false;
-    //bool prevQuot           = false;
-    std::size_t prevQuotIdx = StringType::npos;
+//----------------------------------------------------------------------------
+template<typename StringType>
+char detectSeparators(const StringType &data, const StringType &seps="\t;,:|#", typename StringType::value_type quot=0, std::size_t detectChunkSize=1000*1000)
+{
+    return detectSeparators(data.begin(), data.end(), seps, quot, detectChunkSize);
+}
 
-    // for(auto ch : data)
-    for(; b!=e; ++b)
-    {
-        auto ch = *b;
+//----------------------------------------------------------------------------
+struct Dialect
+{
+    char    delim      = 0;
+    char    quot       = 0; //!< 0 - кавычки в данных не найдены
+    double  confidence = 0; //!< Уверенность в разделителе, от 0 до 1
+};
 
-        auto sepIdx  = seps.find(ch);
-        auto quotIdx = quotes.find(ch);
+//----------------------------------------------------------------------------
+//! Определение кавычек и разделителя за один проход по первым detectChunkSize символам
+template<typename InputIter, typename StringType>
+Dialect detectDialect(InputIter b, InputIter e, const StringType &seps, const StringType &quotes, std::size_t detectChunkSize=1000*1000)
+{
+    details::DialectSniffer sniffer(seps, quotes, 0, detectChunkSize);
+    sniffer.sniff(b, e);
+    sniffer.finish();
+
+    Dialect res;
+    res.delim      = sniffer.delim();
+    res.quot       = sniffer.quot();
+    res.confidence = sniffer.confidence();
+    return res;
+}
 
-        if (sepIdx==StringType::npos)
-        {
-            // Разделитель не найден
+//----------------------------------------------------------------------------
+inline
+Dialect detectDialect(std::string_view data, std::string_view seps="\t;,:|#", std::string_view quotes="\"\'`", std::size_t detectChunkSize=1000*1000)
+{
+    return detectDialect(data.begin(), data.end(), seps, quotes, detectChunkSize);
+}
 
-            if (quotIdx!=StringType::npos) // найдена одна из кавычек
-            {
-                if (prevSep) // предыдущий символ - один из разделителей
-                {
-                    if (quotIdx<quotesCount.size())
-                        quotesCount[quotIdx]++;
-                }
-            }
-            else if (prevQuotIdx!=StringType::npos) // Предыдуший символ - кавычка
-            {
-                if (ch=='\n' || ch=='\r')
-                {
-                    if (quotIdx<quotesCount.size())
-                        quotesCount[quotIdx]++;
-                }
-            }
+//----------------------------------------------------------------------------
+//! Определение кавычек и разделителя по numWindows окнам, равномерно разнесённым по входу - от начала до конца
+/*! Для входа с произвольным доступом - например, отображённого в память файла. Помогает, когда в начале
+    файла длинная преамбула или комментарий, а также когда формат меняется по ходу файла.
+
+    Окно, кроме первого, начинается с произвольного места, поэтому его первая запись отбрасывается -
+    выборка синхронизируется на первом переводе строки вне кавычек. Состояние кавычек на начале окна
+    неизвестно, окно просматривается для обоих вариантов, и берётся вариант с большей уверенностью.
+    Статистика окон объединяется. Уверенность дополнительно умножается на долю окон, чей собственный
+    разделитель совпал с итоговым. Вход не больше numWindows*windowSize просматривается целиком,
+    как в detectDialect.
+ */
+template<typename RandomIter, typename StringType>
+Dialect detectDialectSampled( RandomIter b, RandomIter e, const StringType &seps, const StringType &quotes
+                            , std::size_t numWindows=8, std::size_t windowSize=64*1024
+                            )
+{
+    const std::size_t size = std::size_t(e-b);
 
-            prevSep = false;
-            prevQuotIdx = quotIdx;
-        }
-        else // найден один из разделителей
+    if (numWindows<2 || !windowSize || size<=numWindows*windowSize)
+        return detectDialect(b, e, seps, quotes, size);
+
+    details::DialectSniffer total(seps, quotes, 0, windowSize);
+    std::vector<char> windowDelims;
+
+    for(std::size_t i=0; i!=numWindows; ++i)
+    {
+        std::size_t pos = (size-windowSize)/(numWindows-1)*i;
+        std::size_t end = i+1==numWindows ? size : pos+windowSize;
+
+        details::DialectSniffer sniffer(seps, quotes, 0, windowSize);
+        if (i)
+            sniffer.startFromMiddle(false);
+        sniffer.sniff(b+pos, b+end);
+        sniffer.finish(end==size);
+
+        if (i)
         {
-            if (prevQuotIdx!=StringType::npos) // Предыдущий символ - одна из кавычек
-            {
-                if (prevQuotIdx<quotesCount.size())
-                    quotesCount[prevQuotIdx]++;
-            }
+            details::DialectSniffer snifferInQuotes(seps, quotes, 0, windowSize);
+            snifferInQuotes.startFromMiddle(true);
+            snifferInQuotes.sniff(b+pos, b+end);
+            snifferInQuotes.finish(end==size);
 
-            prevSep = true;
-            prevQuotIdx = quotIdx;
+            if (snifferInQuotes.confidence()>sniffer.confidence())
+                sniffer = snifferInQuotes;
         }
+
+        windowDelims.push_back(sniffer.delim());
+        total.merge(sniffer);
     }
 
-    std::size_t maxIdx = std::size_t(-1);
-    std::size_t maxQuotCount = 0;
+    Dialect res;
+    res.delim = total.delim();
+    res.quot  = total.quot();
 
-    
-    for(std::size_t i=0u; i!=quotesCount.size(); ++i)
+    if (!windowDelims.empty())
     {
-        auto cnt = quotesCount[i];
-        if (cnt>maxQuotCount)
-        {
-            maxQuotCount = cnt;
-            maxIdx = i;
-        }
+        auto agreed = std::count(windowDelims.begin(), windowDelims.end(), res.delim);
+        res.confidence = total.confidence()*double(agreed)/double(windowDelims.size());
     }
 
-    if (maxIdx==std::size_t(-1) || maxQuotCount==0 || maxIdx>=quotes.size())
-        return 0;
+    return res;
+}
 
-    return quotes[maxIdx];
+//----------------------------------------------------------------------------
+inline
+Dialect detectDialectSampled( std::string_view data, std::string_view seps="\t;,:|#", std::string_view quotes="\"\'`"
+                            , std::size_t numWindows=8, std::size_t windowSize=64*1024
+                            )
+{
+    return detectDialectSampled(data.begin(), data.end(), seps, quotes, numWindows, windowSize);
+}
 
+//----------------------------------------------------------------------------
+inline
+ParseResult parse(std::string_view content, char delim=',', char quot='\"', bool strict=true)
+{
+    return details::withDialectParser(delim, quot, strict, [&](auto &parser) { return parser.parse(content); });
 }
 
 //----------------------------------------------------------------------------
-template<typename StringType>
-char detectQuotes(const StringType &data, const StringType &seps="\t;,:|#", const StringType &quotes="\"\'`", std::size_t detectChunkSize=1000*1000)
+//! Разбор в существующий результат; строки, поля и их ёмкость переиспользуются между вызовами
+inline
+void parse(std::string_view content, ParseResult &reuse, char delim=',', char quot='\"', bool strict=true)
 {
-    return detectQuotes(data.begin(), data.end(), seps, quotes, detectChunkSize);
+    details::withDialectParser(delim, quot, strict, [&](auto &parser) { parser.parseInto(content, reuse); });
 }
 
 //----------------------------------------------------------------------------
-template<typename IterType, typename StringType>
-char detectSeparators(IterType b, IterType e, const StringType &seps="\t;,:|#", typename StringType::value_type quot=0, std::size_t detectChunkSize=1000*1000)
+//! Разбор с политикой ошибок; log очищается и получает счётчики ошибок, для ErrorPolicy::compact - и записи
+inline
+ParseResult parse(std::string_view content, const ErrorPolicy &errorPolicy, ErrorLog &log, char delim=',', char quot='\"', bool strict=true)
 {
-    e = details::getChunkForDetections(b, e, detectChunkSize);
+    log.clear();
+    return details::withDialectParser(delim, quot, strict, [&](auto &parser)
+    {
+        parser.setErrorPolicy(errorPolicy, &log);
+        return parser.parse(content);
+    });
+}
+
+//----------------------------------------------------------------------------
+//! Плоский разбор с политикой ошибок (см. parse с ErrorPolicy)
+inline
+FlatParseResult parseFlat(std::string_view content, const ErrorPolicy &errorPolicy, ErrorLog &log, char delim=',', char quot='\"', bool strict=true)
+{
+    log.clear();
+    return details::withDialectParser(delim, quot, strict, [&](auto &parser)
+    {
+        parser.setErrorPolicy(errorPolicy, &log);
+        return parser.parseFlat(content);
+    });
+}
 
-    if (quot==0)
-        quot = '\"';
+#if defined(MARTY_CSV_HAS_PMR)
 
-    std::vector<StringType> lines; lines.reserve(std::size_t(std::distance(b,e))/100u);
-    details::splitToLines(b, e, lines, quot);
+//----------------------------------------------------------------------------
+//! Разбор в результат, память которого выделяется из его memory_resource
+inline
+void parse(std::string_view content, PmrParseResult &result, char delim=',', char quot='\"', bool strict=true)
+{
+    details::withDialectParser(delim, quot, strict, [&](auto &parser) { parser.parseInto(content, result); });
+}
 
-    std::vector< details::CVarianceItem > vv;
-    details::getCsvSeparatorVariances(vv, lines, seps.c_str());
-    if (!vv.empty())
-        return char(vv[0].ch);
+#endif
 
-    return char(0);
+//----------------------------------------------------------------------------
+//! Разбор широкой строки без промежуточной узкой таблицы; разделитель и кавычка - из ASCII
+inline
+WideParseResult parse(std::wstring_view content, char delim=',', char quot='\"', bool strict=true)
+{
+    return details::withDialectParser<wchar_t>(delim, quot, strict, [&](auto &parser) { return parser.parse(content); });
 }
 
 //----------------------------------------------------------------------------
-template<typename StringType>
-char detectSeparators(const StringType &data, const StringType &seps="\t;,:|#", typename StringType::value_type quot=0, std::size_t detectChunkSize=1000*1000)
+//! Разбор UTF-16; суррогатные пары проходят без изменений - разделитель и кавычка из ASCII с ними не совпадают
+inline
+BasicParseResult<char16_t> parse(std::u16string_view content, char delim=',', char quot='\"', bool strict=true)
 {
-    return detectSeparators(data.begin(), data.end(), seps, quot, detectChunkSize);
+    return details::withDialectParser<char16_t>(delim, quot, strict, [&](auto &parser) { return parser.parse(content); });
+}
+
+//----------------------------------------------------------------------------
+//! Разбор без копирования - content должен пережить результат
+inline
+ViewParseResult parseView(std::string_view content, char delim=',', char quot='\"', bool strict=true)
+{
+    return details::withDialectParser(delim, quot, strict, [&](auto &parser) { return parser.parseView(content); });
+}
+
+//----------------------------------------------------------------------------
+//! Разбор только выбранных колонок
+inline
+ParseResult parse(std::string_view content, const ColumnProjection &projection, char delim=',', char quot='\"', bool strict=true)
+{
+    auto parser = details::CsvParser(delim, quot, strict);
+    return parser.parse(content, projection);
+}
+
+//----------------------------------------------------------------------------
+//! Разбор с фильтром строк - отклонённые строки не материализуются
+inline
+ParseResult parse(std::string_view content, const RowFilter &filter, char delim=',', char quot='\"', bool strict=true)
+{
+    auto parser = details::CsvParser(delim, quot, strict);
+    return parser.parse(content, filter);
+}
+
+//----------------------------------------------------------------------------
+//! Разбор выбранных колонок строк, прошедших фильтр
+inline
+ParseResult parse(std::string_view content, const ColumnProjection &projection, const RowFilter &filter, char delim=',', char quot='\"', bool strict=true)
+{
+    auto parser = details::CsvParser(delim, quot, strict);
+    return parser.parse(content, projection, filter);
+}
+
+//----------------------------------------------------------------------------
+//! Разбор строк, прошедших фильтр, в плоскую таблицу
+inline
+FlatParseResult parseFlat(std::string_view content, const RowFilter &filter, char delim=',', char quot='\"', bool strict=true)
+{
+    auto parser = details::CsvParser(delim, quot, strict);
+    return parser.parseFlat(content, filter);
 }
 
 //----------------------------------------------------------------------------
+//! Разбор только выбранных колонок в плоскую таблицу
 inline
-ParseResult parse(const std::string& content, char delim=',', char quot='\"', bool strict=true)
+FlatParseResult parseFlat(std::string_view content, const ColumnProjection &projection, char delim=',', char quot='\"', bool strict=true)
 {
     auto parser = details::CsvParser(delim, quot, strict);
-    return parser.parse(content);
+    return parser.parseFlat(content, projection);
 }
 
+//----------------------------------------------------------------------------
+//! Разбор с отложенной обработкой полей - content должен пережить результат
+inline
+LazyParseResult parseLazy(std::string_view content, char delim=',', char quot='\"', bool strict=true)
+{
+    return details::withDialectParser(delim, quot, strict, [&](auto &parser) { return parser.parseLazy(content); });
+}
+
+//----------------------------------------------------------------------------
+//! Разбор в плоскую таблицу - одно выделение памяти на все символы вместо выделения на строку и на поле
+inline
+FlatParseResult parseFlat(std::string_view content, char delim=',', char quot='\"', bool strict=true)
+{
+    return details::withDialectParser(delim, quot, strict, [&](auto &parser) { return parser.parseFlat(content); });
+}
+
+//----------------------------------------------------------------------------
+//! Разбор сразу в колонки - без транспонирования построчного результата
+inline
+ColumnarParseResult parseColumnar(std::string_view content, char delim=',', char quot='\"', bool strict=true, RaggedRowsPolicy raggedPolicy=RaggedRowsPolicy::PadOrTruncate)
+{
+    return details::withDialectParser(delim, quot, strict, [&](auto &parser) { return parser.parseColumnar(content, raggedPolicy); });
+}
+
+namespace details {
+
+//----------------------------------------------------------------------------
+//! Подача потока в парсер кусками произвольного размера
+/*! Куски разбираются на месте, без копирования. Между кусками хранятся только байты незавершённого
+    поля (см. BasicCsvParser::parseChunk), а сканирование продолжается с новых данных, поэтому поле
+    или запись, растянутые на много кусков, разбираются за линейное время.
+ */
+template<typename CharType=char>
+class ChunkFeeder
+{
+    std::basic_string<CharType>  m_buf;            // Незавершённое поле
+    std::size_t                  m_bufOffset = 0;  // Позиция m_buf[0] в потоке
+
+    static constexpr std::size_t minGrow = 4096;
+
+public:
+
+    template<typename ParserType, typename RowHandler>
+    void feed(ParserType &parser, const CharType *pData, std::size_t size, std::vector<ParseError> &errors, RowHandler &&rowHandler)
+    {
+        while(size && !m_buf.empty())
+        {
+            // Дописываем к незавершённому полю порцию, растущую вместе с ним - каждый байт копируется O(1) раз
+            const std::size_t oldSize = m_buf.size();
+            const std::size_t take    = std::min(size, std::max(oldSize, minGrow));
+            m_buf.append(pData, take);
+
+            std::size_t consumed = parser.parseChunk(m_buf.data(), m_buf.size(), m_bufOffset, false, errors, rowHandler);
+            m_bufOffset += consumed;
+
+            if (consumed<oldSize)
+            {
+                // Поле ещё не завершено
+                m_buf.erase(0, consumed);
+                pData += take;
+                size  -= take;
+                continue;
+            }
+
+            // Незавершённое поле теперь начинается в новых данных - остаток разбираем на месте
+            std::size_t skip = consumed - oldSize;
+            m_buf.clear();
+            pData += skip;
+            size  -= skip;
+        }
+
+        if (!size)
+            return;
+
+        std::size_t consumed = parser.parseChunk(pData, size, m_bufOffset, false, errors, rowHandler);
+        m_bufOffset += consumed;
+        m_buf.assign(pData+consumed, size-consumed);
+    }
+
+    template<typename ParserType, typename RowHandler>
+    void finish(ParserType &parser, std::vector<ParseError> &errors, RowHandler &&rowHandler)
+    {
+        parser.parseChunk(m_buf.data(), m_buf.size(), m_bufOffset, true, errors, rowHandler);
+        m_bufOffset += m_buf.size();
+        m_buf.clear();
+        m_buf.shrink_to_fit();
+    }
+
+    //! Количество символов, переданных в feed
+    std::size_t bytesFed() const { return m_bufOffset + m_buf.size(); }
+
+}; // class ChunkFeeder
+
+} // namespace details
+
+//----------------------------------------------------------------------------
+//! Инкрементальный парсер - принимает вход кусками
+/*! Куски разбираются на месте, между ними хранятся только завершённые поля и байты незавершённого
+    поля последней записи, поэтому память ограничена размером одной записи. Готовые строки отдаются
+    в callback, а если он не задан - складываются в очередь, откуда их забирают через popRow.
+    Позиции в ошибках считаются от начала всего потока.
+ */
+class CsvPushParser
+{
+
+public:
+
+    using RowCallback = std::function<void(const std::vector<std::string>&)>;
+
+private:
+
+    details::CsvParser                   m_parser;
+    RowCallback                          m_rowCallback;
+    details::ChunkFeeder<char>           m_feeder;
+    std::vector<std::string>             m_row;            // Буфер строки для callback, переиспользуется
+    std::deque< std::vector<std::string> > m_rows;
+    std::vector<ParseError>              m_errors;
+    bool                                 m_finished = false;
+
+    void handleRow(const details::FieldSpan *pFields, std::size_t numFields)
+    {
+        std::vector<std::string> &row = m_rowCallback ? m_row : (m_rows.emplace_back(), m_rows.back());
+        details::spansToStrings(pFields, numFields, m_parser.quot(), row);
+
+        if (m_rowCallback)
+            m_rowCallback(row);
+    }
+
+public:
+
+    CsvPushParser(char delim=',', char quot='\"', bool strict=true)
+    : m_parser(delim, quot, strict)
+    {}
+
+    CsvPushParser(RowCallback rowCallback, char delim=',', char quot='\"', bool strict=true)
+    : m_parser(delim, quot, strict)
+    , m_rowCallback(std::move(rowCallback))
+    {}
+
+    //! Очередной кусок входа
+    void feed(const char *pData, std::size_t size)
+    {
+        if (m_finished || !size)
+            return;
+
+        m_feeder.feed(m_parser, pData, size, m_errors, [&](const details::FieldSpan *pFields, std::size_t numFields) { handleRow(pFields, numFields); });
+    }
+
+    void feed(std::string_view data)
+    {
+        feed(data.data(), data.size());
+    }
+
+    //! Конец входа - разбирается последняя запись
+    void finish()
+    {
+        if (m_finished)
+            return;
+
+        m_feeder.finish(m_parser, m_errors, [&](const details::FieldSpan *pFields, std::size_t numFields) { handleRow(pFields, numFields); });
+        m_finished = true;
+    }
+
+    //! Забирает очередную готовую строку, если callback не задан
+    bool popRow(std::vector<std::string> &row)
+    {
+        if (m_rows.empty())
+            return false;
+
+        row.swap(m_rows.front());
+        m_rows.pop_front();
+        return true;
+    }
+
+    std::size_t rowsPending() const { return m_rows.size(); }
+
+    const std::vector<ParseError>& errors() const { return m_errors; }
+
+    //! Количество байт, переданных в feed
+    std::size_t bytesFed() const { return m_feeder.bytesFed(); }
+
+}; // class CsvPushParser
+
 //----------------------------------------------------------------------------
 
 
@@ -0,0 +1,364 @@
+/* \file
+   \brief marty_csv_parallel - многопоточный разбор CSV
+
+   Вход делится на куски, для каждого куска параллельно и спекулятивно (для обоих вариантов
+   состояния кавычек на его начале) ищется первая граница записи. Затем последовательный
+   проход по чётности кавычек выбирает верные варианты, и куски между границами разбираются
+   параллельно независимыми парсерами. Каждый кусок проверяется: если парсер не закончил его
+   ровно на границе записи (так бывает на некорректном CSV, где кавычки не парные),
+   остаток входа разбирается последовательно. Результат совпадает с последовательным разбором.
+   Потоки создаются один раз на вызов parseParallel и выполняют оба параллельных прохода.
+
+ */
+
+#pragma once
+
+#include "marty_csv_new.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+
+namespace marty {
+namespace csv {
+
+namespace details {
+
+//----------------------------------------------------------------------------
+//! Пул потоков на время одного многопоточного разбора - потоки создаются один раз на все проходы
+/*! run(numTasks, func) выполняет func(i) для i из [0, numTasks) на потоках пула и вызывающем потоке.
+    Исключение из func останавливает раздачу задач; run дожидается всех потоков и перебрасывает
+    первое исключение. Деструктор останавливает и присоединяет потоки.
+ */
+class TaskPool
+{
+    std::vector<std::thread>                m_threads;
+    std::mutex                              m_mutex;
+    std::condition_variable                 m_cvWork;
+    std::condition_variable                 m_cvDone;
+    std::function<void(std::size_t)>        m_func;
+    std::size_t                             m_numTasks   = 0;
+    std::atomic<std::size_t>                m_nextTask;
+    std::size_t                             m_generation = 0;   // Номер текущего run - по нему потоки видят новую работу
+    std::size_t                             m_busy       = 0;   // Потоков пула, ещё не закончивших текущий run
+    bool                                    m_stop       = false;
+    std::exception_ptr                      m_error;
+
+    void runTasks()
+    {
+        for(;;)
+        {
+            std::size_t taskIdx = m_nextTask++;
+            if (taskIdx>=m_numTasks)
+                break;
+
+            try
+            {
+                m_func(taskIdx);
+            }
+            catch(...)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_error)
+                    m_error = std::current_exception();
+                m_nextTask = m_numTasks; // Остальные задачи не раздаём
+            }
+        }
+    }
+
+    void workerLoop()
+    {
+        std::size_t seenGeneration = 0;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for(;;)
+        {
+            m_cvWork.wait(lock, [&]() { return m_stop || m_generation!=seenGeneration; });
+            if (m_stop)
+                return;
+
+            seenGeneration = m_generation;
+            lock.unlock();
+            runTasks();
+            lock.lock();
+
+            if (--m_busy==0)
+                m_cvDone.notify_all();
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cvWork.notify_all();
+
+        for(auto &t : m_threads)
+            t.join();
+        m_threads.clear();
+    }
+
+public:
+
+    //! numThreads - всего потоков, включая вызывающий
+    explicit TaskPool(unsigned numThreads)
+    : m_nextTask(0)
+    {
+        try
+        {
+            for(unsigned i=1; i<numThreads; ++i)
+                m_threads.emplace_back([this]() { workerLoop(); });
+        }
+        catch(...)
+        {
+            stop();
+            throw;
+        }
+    }
+
+    ~TaskPool()
+    {
+        stop();
+    }
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    template<typename Func>
+    void run(std::size_t numTasks, Func &&func)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_func     = [&func](std::size_t i) { func(i); };
+            m_numTasks = numTasks;
+            m_nextTask = 0;
+            m_error    = nullptr;
+            m_busy     = m_threads.size();
+            ++m_generation;
+        }
+        m_cvWork.notify_all();
+
+        runTasks();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cvDone.wait(lock, [&]() { return m_busy==0; });
+        m_func = nullptr;
+
+        if (m_error)
+            std::rethrow_exception(m_error);
+    }
+
+}; // class TaskPool
+
+//----------------------------------------------------------------------------
+inline
+unsigned getParallelThreadsCount(unsigned numThreads)
+{
+    if (numThreads)
+        return numThreads;
+
+    numThreads = std::thread::hardware_concurrency();
+    return numThreads ? numThreads : 1u;
+}
+
+//----------------------------------------------------------------------------
+//! Результат спекулятивного просмотра куска
+struct ChunkSpeculation
+{
+    std::size_t boundary[2];  //!< Первая граница записи в куске при старте вне кавычек [0] и внутри кавычек [1]; npos - не найдена
+    bool        quotParity;   //!< Нечётное количество кавычек в куске
+};
+
+//----------------------------------------------------------------------------
+//! Спекулятивный просмотр куска [chunkBegin, chunkEnd) для обоих начальных состояний кавычек
+/*! Граница записи - позиция после серии переводов строки, стоящих вне кавычек.
+ */
+inline
+ChunkSpeculation speculateChunk(std::string_view content, std::size_t chunkBegin, std::size_t chunkEnd, char delim, char quot)
+{
+    const std::size_t npos = std::string_view::npos;
+
+    ChunkSpeculation res;
+    res.boundary[0] = npos;
+    res.boundary[1] = npos;
+    res.quotParity  = false;
+
+    const char *pData = content.data();
+    bool inQuotes = false; // Состояние относительно начала куска "вне кавычек"
+
+    for(std::size_t blockPos=chunkBegin; blockPos<chunkEnd; blockPos+=simd::blockSize)
+    {
+        std::size_t blockLen = std::min(simd::blockSize, chunkEnd-blockPos);
+        simd::BlockMasks masks = simd::buildMasks(pData+blockPos, blockLen, delim, quot);
+
+        std::uint64_t inQuote = simd::inQuoteMask(masks.quot, inQuotes);
+        std::uint64_t nlMasks[2] = { masks.newline & ~inQuote, masks.newline & inQuote };
+
+        for(unsigned h=0; h!=2; ++h)
+        {
+            if (res.boundary[h]!=npos || !nlMasks[h])
+                continue;
+
+            std::size_t pos = blockPos + simd::countTrailingZeros(nlMasks[h]);
+            while(pos<content.size() && isNewlineChar(pData[pos]))
+                ++pos;
+            res.boundary[h] = pos;
+        }
+    }
+
+    res.quotParity = inQuotes;
+    return res;
+}
+
+//----------------------------------------------------------------------------
+//! Количество колонок первой непустой строки - с ним парсеры кусков проверяют строки на соответствие
+inline
+std::size_t firstRowColumnsCount(std::string_view content, char delim, char quot)
+{
+    std::size_t window = 64*1024;
+    for(;;)
+    {
+        std::size_t len = std::min(window, content.size());
+        bool bFinal = len==content.size();
+
+        std::size_t columnsCount = 0;
+        bool found = false;
+        std::vector<ParseError> errors;
+
+        CsvParser parser(delim, quot, false);
+        parser.resetState();
+        parser.parseChunk(content.data(), len, 0, bFinal, errors, [&](const FieldSpan*, std::size_t numFields)
+        {
+            if (!found)
+            {
+                columnsCount = numFields;
+                found = true;
+            }
+        });
+
+        if (found || bFinal)
+            return columnsCount;
+
+        window *= 2;
+    }
+}
+
+} // namespace details
+
+//----------------------------------------------------------------------------
+//! Многопоточный разбор. numThreads==0 - по числу ядер; minChunkSize - минимальный размер куска на поток
+/*! Результат, включая ошибки и их позиции, совпадает с parse()
+ */
+inline
+ParseResult parseParallel(std::string_view content, char delim=',', char quot='\"', bool strict=true, unsigned numThreads=0, std::size_t minChunkSize=4*1024*1024)
+{
+    const std::size_t npos = std::string_view::npos;
+
+    if (!delim)
+        delim = ';';
+    if (!quot)
+        quot = '\"';
+
+    numThreads = details::getParallelThreadsCount(numThreads);
+
+    std::size_t numChunks = std::min<std::size_t>(numThreads, minChunkSize ? content.size()/minChunkSize : numThreads);
+    if (numChunks<2)
+        return parse(content, delim, quot, strict);
+
+    // Потоки общие для спекулятивного просмотра и разбора
+    details::TaskPool pool(static_cast<unsigned>(numChunks));
+
+    // Спекулятивный просмотр кусков
+    std::vector<details::ChunkSpeculation> speculations(numChunks);
+    pool.run(numChunks, [&](std::size_t i)
+    {
+        speculations[i] = details::speculateChunk(content, content.size()*i/numChunks, content.size()*(i+1)/numChunks, delim, quot);
+    });
+
+    // Последовательная сшивка - выбираем вариант по чётности кавычек предыдущих кусков
+    std::vector<std::size_t> segmentStarts;
+    segmentStarts.push_back(0);
+    bool inQuotes = speculations[0].quotParity;
+    for(std::size_t i=1; i!=numChunks; ++i)
+    {
+        std::size_t boundary = speculations[i].boundary[inQuotes ? 1 : 0];
+        if (boundary!=npos && boundary<content.size() && boundary>segmentStarts.back())
+            segmentStarts.push_back(boundary);
+        inQuotes = inQuotes != speculations[i].quotParity;
+    }
+
+    std::size_t numSegments = segmentStarts.size();
+    segmentStarts.push_back(content.size());
+
+    std::size_t columnsCount = details::firstRowColumnsCount(content, delim, quot);
+
+    // Параллельный разбор сегментов
+    std::vector<ParseResult> results(numSegments);
+    std::vector<std::size_t> segmentLines(numSegments, 0);
+    std::vector<char>        segmentOk(numSegments, 0);
+
+    pool.run(numSegments, [&](std::size_t i)
+    {
+        std::size_t segBegin = segmentStarts[i];
+        std::size_t segEnd   = segmentStarts[i+1];
+
+        details::CsvParser parser(delim, quot, strict);
+        parser.resetState(details::lineStartForBoundary(content, segBegin), i ? columnsCount : 0);
+
+        bool bFinal = (i+1)==numSegments;
+        std::size_t parsed = parser.parseChunk(content.substr(segBegin, segEnd-segBegin), segBegin, bFinal, results[i]);
+
+        segmentOk[i]    = parsed==segEnd-segBegin && !parser.recordPending();
+        segmentLines[i] = parser.currentLine() - 1;
+    });
+
+    // Сборка результата; первый сегмент, закончившийся не на границе записи, означает неверную спекуляцию -
+    // его начало верное, поэтому остаток разбираем последовательно
+    ParseResult result;
+    result.data.reserve([&]() { std::size_t n = 0; for(const auto &r : results) n += r.data.size(); return n; }());
+
+    std::size_t lineBase = 0;
+    for(std::size_t i=0; i!=numSegments; ++i)
+    {
+        if (!segmentOk[i])
+        {
+            std::size_t segBegin = segmentStarts[i];
+
+            ParseResult tail;
+            details::CsvParser parser(delim, quot, strict);
+            parser.resetState(details::lineStartForBoundary(content, segBegin), i ? columnsCount : 0);
+            parser.parseChunk(content.substr(segBegin), segBegin, true, tail);
+
+            results[i] = std::move(tail);
+            numSegments = i+1;
+        }
+
+        auto &r = results[i];
+        for(auto &row : r.data)
+            result.data.emplace_back(std::move(row));
+        for(auto &e : r.errors)
+        {
+            e.line += lineBase;
+            result.errors.emplace_back(std::move(e));
+        }
+
+        lineBase += segmentLines[i];
+    }
+
+    return result;
+}
+
+//----------------------------------------------------------------------------
+
+} // namespace csv
+} // namespace marty
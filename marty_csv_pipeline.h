@@ -0,0 +1,471 @@
+/* \file
+   \brief marty_csv_pipeline - конвейерный разбор файла: чтение, разбор и обработка строк в трёх потоках
+
+   Поток чтения заполняет блоки кольцевого буфера позиционным чтением (pread, на Windows -
+   ReadFile с OVERLAPPED-смещением). Поток разбора разбирает блоки на месте, без копирования,
+   копируется только незавершённое поле на стыке блоков. Готовые строки пачками уходят через
+   неблокирующую очередь одного производителя и одного потребителя в вызывающий поток.
+   Пока медленный диск читает следующий блок, разбирается предыдущий, и наоборот.
+
+ */
+
+#pragma once
+
+#include "marty_csv_file.h"
+#include "marty_csv_new.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+
+namespace marty {
+namespace csv {
+
+namespace details {
+
+//----------------------------------------------------------------------------
+//! Неблокирующая очередь фиксированной ёмкости для одного производителя и одного потребителя
+/*! push/pop ждут, уступая процессор, а после серии неудачных попыток - засыпая ненадолго,
+    чтобы ожидание медленного диска не занимало ядро целиком.
+ */
+template<typename ItemType>
+class SpscQueue
+{
+    std::vector<ItemType>     m_slots;           // Ёмкость + 1, один слот всегда пуст
+    alignas(64) std::atomic<std::size_t> m_head; // Индекс чтения, меняет потребитель
+    alignas(64) std::atomic<std::size_t> m_tail; // Индекс записи, меняет производитель
+    std::atomic<bool>         m_closed;
+
+    static void backoff(unsigned &spins)
+    {
+        if (++spins<64)
+            std::this_thread::yield();
+        else
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+public:
+
+    explicit SpscQueue(std::size_t capacity)
+    : m_slots((capacity ? capacity : 1u) + 1)
+    , m_head(0)
+    , m_tail(0)
+    , m_closed(false)
+    {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    bool tryPush(ItemType &item)
+    {
+        std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        std::size_t next = tail+1==m_slots.size() ? 0 : tail+1;
+        if (next==m_head.load(std::memory_order_acquire))
+            return false;
+
+        m_slots[tail] = std::move(item);
+        m_tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(ItemType &item)
+    {
+        std::size_t head = m_head.load(std::memory_order_relaxed);
+        if (head==m_tail.load(std::memory_order_acquire))
+            return false;
+
+        item = std::move(m_slots[head]);
+        m_head.store(head+1==m_slots.size() ? 0 : head+1, std::memory_order_release);
+        return true;
+    }
+
+    //! false - очередь закрыта
+    bool push(ItemType &&item)
+    {
+        unsigned spins = 0;
+        while(!tryPush(item))
+        {
+            if (m_closed.load(std::memory_order_acquire))
+                return false;
+            backoff(spins);
+        }
+        return true;
+    }
+
+    //! false - очередь закрыта и пуста
+    bool pop(ItemType &item)
+    {
+        unsigned spins = 0;
+        while(!tryPop(item))
+        {
+            // Проверка закрытия, затем ещё одна попытка - элемент мог быть добавлен перед закрытием
+            if (m_closed.load(std::memory_order_acquire))
+                return tryPop(item);
+            backoff(spins);
+        }
+        return true;
+    }
+
+    void close()
+    {
+        m_closed.store(true, std::memory_order_release);
+    }
+
+}; // class SpscQueue
+
+//----------------------------------------------------------------------------
+//! Файл для позиционного чтения - чтения по смещению не зависят от текущей позиции
+class PositionalFile
+{
+#if defined(_WIN32)
+    HANDLE   m_hFile = INVALID_HANDLE_VALUE;
+#else
+    int      m_fd    = -1;
+#endif
+
+public:
+
+    PositionalFile() = default;
+    PositionalFile(const PositionalFile&) = delete;
+    PositionalFile& operator=(const PositionalFile&) = delete;
+
+    ~PositionalFile()
+    {
+        close();
+    }
+
+    bool open(const std::string &path)
+    {
+        close();
+#if defined(_WIN32)
+        m_hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+        return m_hFile!=INVALID_HANDLE_VALUE;
+#else
+        m_fd = ::open(path.c_str(), O_RDONLY);
+        if (m_fd<0)
+            return false;
+    #if defined(POSIX_FADV_SEQUENTIAL)
+        ::posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL); // Подсказка, ошибка не критична
+    #endif
+        return true;
+#endif
+    }
+
+    void close()
+    {
+#if defined(_WIN32)
+        if (m_hFile!=INVALID_HANDLE_VALUE)
+            CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+#else
+        if (m_fd>=0)
+            ::close(m_fd);
+        m_fd = -1;
+#endif
+    }
+
+    //! Читает до size байт с позиции offset; меньше size - конец файла. false - ошибка чтения
+    bool read(std::uint64_t offset, char *pBuf, std::size_t size, std::size_t &bytesRead)
+    {
+        bytesRead = 0;
+        while(bytesRead<size)
+        {
+#if defined(_WIN32)
+            OVERLAPPED ov;
+            std::memset(&ov, 0, sizeof(ov));
+            ov.Offset     = DWORD(offset & 0xFFFFFFFFu);
+            ov.OffsetHigh = DWORD(offset >> 32);
+
+            DWORD toRead = DWORD((size-bytesRead)>0x40000000u ? 0x40000000u : (size-bytesRead));
+            DWORD n = 0;
+            if (!ReadFile(m_hFile, pBuf+bytesRead, toRead, &n, &ov))
+                return GetLastError()==ERROR_HANDLE_EOF;
+#else
+            auto n = ::pread(m_fd, pBuf+bytesRead, size-bytesRead, off_t(offset));
+            if (n<0)
+            {
+                if (errno==EINTR)
+                    continue;
+                return false;
+            }
+#endif
+            if (!n)
+                break;
+
+            bytesRead += std::size_t(n);
+            offset    += std::uint64_t(n);
+        }
+        return true;
+    }
+
+}; // class PositionalFile
+
+} // namespace details
+
+//----------------------------------------------------------------------------
+//! Конвейерное чтение CSV файла
+/*! numBlocks блоков по blockSize байт читаются в отдельном потоке, разбираются в другом,
+    строки пачками до batchRows строк передаются в rowCallback в вызывающем потоке.
+    Память ограничена блоками и queueBatches пачками строк независимо от размера файла.
+    Нулевые delim/quot определяются по первому блоку. Результат и ошибки совпадают с parse,
+    ошибка чтения добавляется в errors() с типом InputError, line==0 и position - смещением в файле.
+ */
+class PipelinedCsvReader
+{
+
+public:
+
+    using RowCallback   = std::function<void(const std::vector<std::string>&)>;
+    using RowBatch      = std::vector< std::vector<std::string> >;
+    using BatchCallback = std::function<void(RowBatch&)>;
+
+private:
+
+    struct Block
+    {
+        std::vector<char>  data;
+        std::size_t        size   = 0;
+    };
+
+    char                     m_delim;
+    char                     m_quot;
+    bool                     m_strict;
+    std::size_t              m_blockSize;
+    std::size_t              m_numBlocks;
+    std::size_t              m_batchRows;
+    std::size_t              m_queueBatches;
+    std::vector<ParseError>  m_errors;
+
+    //----------------------------------------------------------------------------
+    void readBlocks( details::PositionalFile &file, std::vector<Block> &blocks
+                   , details::SpscQueue<std::size_t> &freeBlocks, details::SpscQueue<std::size_t> &filledBlocks
+                   , bool &readError, std::uint64_t &errorOffset
+                   )
+    {
+        std::uint64_t offset = 0;
+        std::size_t   idx    = 0;
+
+        while(freeBlocks.pop(idx))
+        {
+            Block &block = blocks[idx];
+            if (!file.read(offset, block.data.data(), block.data.size(), block.size))
+            {
+                readError   = true;
+                errorOffset = offset;
+                break;
+            }
+
+            if (!block.size)
+                break;
+
+            offset += block.size;
+
+            bool lastBlock = block.size<block.data.size();
+            filledBlocks.push(std::move(idx));
+            if (lastBlock)
+                break;
+        }
+
+        filledBlocks.close();
+    }
+
+    //----------------------------------------------------------------------------
+    void parseBlocks( std::vector<Block> &blocks
+                    , details::SpscQueue<std::size_t> &freeBlocks, details::SpscQueue<std::size_t> &filledBlocks
+                    , details::SpscQueue<RowBatch> &batches, std::vector<ParseError> &errors
+                    )
+    {
+        details::CsvParser         parser;
+        bool                       parserReady = false;
+        details::ChunkFeeder<char> feeder;  // Хранит только незавершённое поле с конца предыдущего блока
+        RowBatch                   batch;
+        bool                       stopped     = false; // Потребитель закрыл очередь пачек
+
+        auto rowHandler = [&](const details::FieldSpan *pFields, std::size_t numFields)
+        {
+            if (stopped)
+                return;
+
+            batch.emplace_back();
+            details::spansToStrings(pFields, numFields, parser.quot(), batch.back());
+
+            if (batch.size()>=m_batchRows)
+            {
+                stopped = !batches.push(std::move(batch));
+                batch = RowBatch();
+                batch.reserve(m_batchRows);
+            }
+        };
+
+        batch.reserve(m_batchRows);
+
+        std::size_t idx = 0;
+        while(!stopped && filledBlocks.pop(idx))
+        {
+            Block &block = blocks[idx];
+            const char        *p      = block.data.data();
+            const std::size_t  n      = block.size;
+
+            if (!parserReady)
+            {
+                char delim = m_delim, quot = m_quot;
+                details::resolveDialect(std::string_view(p, n), delim, quot);
+                parser      = details::CsvParser(delim, quot, m_strict);
+                parserReady = true;
+            }
+
+            // Блок разбирается на месте; запись на стыке блоков продолжается с сохранённого состояния парсера
+            feeder.feed(parser, p, n, errors, rowHandler);
+
+            freeBlocks.push(std::move(idx));
+        }
+
+        freeBlocks.close(); // Поток чтения мог остановиться на ошибке - больше блоков не будет
+
+        if (parserReady)
+            feeder.finish(parser, errors, rowHandler);
+
+        if (!batch.empty())
+            batches.push(std::move(batch));
+
+        batches.close();
+    }
+
+public:
+
+    explicit PipelinedCsvReader( char delim=0, char quot=0, bool strict=true
+                               , std::size_t blockSize=1024*1024, std::size_t numBlocks=4
+                               , std::size_t batchRows=4096, std::size_t queueBatches=16
+                               )
+    : m_delim(delim)
+    , m_quot(quot)
+    , m_strict(strict)
+    , m_blockSize(blockSize ? blockSize : 1u)
+    , m_numBlocks(numBlocks>2 ? numBlocks : 2u)
+    , m_batchRows(batchRows ? batchRows : 1u)
+    , m_queueBatches(queueBatches)
+    {}
+
+    //! Читает файл, на каждую строку вызывает rowCallback в вызывающем потоке; false - файл не удалось открыть
+    bool read(const std::string &path, const RowCallback &rowCallback)
+    {
+        return readBatches(path, [&](RowBatch &batch)
+        {
+            for(const auto &row : batch)
+                rowCallback(row);
+        });
+    }
+
+    //! Читает файл, пачки строк передаются в batchCallback в вызывающем потоке - строки можно забирать из пачки
+    bool readBatches(const std::string &path, const BatchCallback &batchCallback)
+    {
+        m_errors.clear();
+
+        details::PositionalFile file;
+        if (!file.open(path))
+            return false;
+
+        std::vector<Block> blocks(m_numBlocks);
+        details::SpscQueue<std::size_t> freeBlocks(m_numBlocks);
+        details::SpscQueue<std::size_t> filledBlocks(m_numBlocks);
+        details::SpscQueue<RowBatch>    batches(m_queueBatches);
+
+        for(std::size_t i=0; i!=m_numBlocks; ++i)
+        {
+            blocks[i].data.resize(m_blockSize);
+            freeBlocks.push(std::size_t(i));
+        }
+
+        bool          readError   = false;
+        std::uint64_t errorOffset = 0;
+
+        std::thread reader([&]() { readBlocks(file, blocks, freeBlocks, filledBlocks, readError, errorOffset); });
+        std::thread parser([&]() { parseBlocks(blocks, freeBlocks, filledBlocks, batches, m_errors); });
+
+        // Если batchCallback бросит исключение - все очереди закрываются, потоки чтения и разбора
+        // останавливаются на ближайшей операции с очередью и присоединяются до выхода из readBatches
+        struct ThreadsJoiner
+        {
+            std::thread                       &reader;
+            std::thread                       &parser;
+            details::SpscQueue<std::size_t>   &freeBlocks;
+            details::SpscQueue<std::size_t>   &filledBlocks;
+            details::SpscQueue<RowBatch>      &batches;
+
+            ~ThreadsJoiner()
+            {
+                if (!reader.joinable() && !parser.joinable())
+                    return;
+
+                batches.close();
+                filledBlocks.close();
+                freeBlocks.close();
+
+                if (parser.joinable())
+                    parser.join();
+                if (reader.joinable())
+                    reader.join();
+            }
+
+        } threadsJoiner{reader, parser, freeBlocks, filledBlocks, batches};
+
+        RowBatch batch;
+        while(batches.pop(batch))
+            batchCallback(batch);
+
+        reader.join();
+        parser.join();
+
+        if (readError)
+            m_errors.push_back({ ParseErrorType::InputError, "Read error", 0, std::size_t(errorOffset) });
+
+        return true;
+    }
+
+    const std::vector<ParseError>& errors() const { return m_errors; }
+
+}; // class PipelinedCsvReader
+
+//----------------------------------------------------------------------------
+//! Конвейерный разбор файла - чтение и разбор идут одновременно. Нулевые delim/quot определяются автоматически
+inline
+bool parseFilePipelined(const std::string &path, ParseResult &result, char delim=0, char quot=0, bool strict=true)
+{
+    result = ParseResult();
+
+    PipelinedCsvReader reader(delim, quot, strict);
+    auto batchHandler = [&](PipelinedCsvReader::RowBatch &batch)
+    {
+        for(auto &row : batch)
+            result.data.emplace_back(std::move(row));
+    };
+
+    if (!reader.readBatches(path, batchHandler))
+        return false;
+
+    result.errors = reader.errors();
+    return true;
+}
+
+//----------------------------------------------------------------------------
+
+} // namespace csv
+} // namespace marty
@@ -0,0 +1,318 @@
+/* \file
+   \brief marty_csv_typed - разбор CSV в типизированные колонки по схеме
+
+ */
+
+#pragma once
+
+#include "marty_csv_new.h"
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+
+namespace marty {
+namespace csv {
+
+//----------------------------------------------------------------------------
+enum class ColumnType
+{
+    String,
+    Int64 ,  //!< Десятичное целое с необязательным знаком '+' или '-'
+    Double,  //!< Десятичное число с необязательным знаком и экспонентой; nan и inf не принимаются
+    Bool  ,  //!< true/false, yes/no, t/f, y/n, 1/0 - без учёта регистра
+    Date     //!< YYYY-MM-DD, хранится как число дней от 1970-01-01
+};
+
+inline
+std::string to_string(ColumnType ct)
+{
+    switch(ct)
+    {
+        case ColumnType::String: return "String";
+        case ColumnType::Int64 : return "Int64";
+        case ColumnType::Double: return "Double";
+        case ColumnType::Bool  : return "Bool";
+        case ColumnType::Date  : return "Date";
+        default: return "Unknown";
+    }
+}
+
+//----------------------------------------------------------------------------
+struct Schema
+{
+    std::vector<ColumnType>  columns;
+    bool                     hasHeader = false; //!< Первая строка - заголовок, её значения не конвертируются
+};
+
+//----------------------------------------------------------------------------
+namespace details {
+
+//----------------------------------------------------------------------------
+//! Число дней от 1970-01-01 для даты григорианского календаря
+inline
+std::int32_t daysFromCivil(int y, unsigned m, unsigned d)
+{
+    y -= m<=2 ? 1 : 0;
+    const int      era = (y>=0 ? y : y-399) / 400;
+    const unsigned yoe = (unsigned)(y - era*400);
+    const unsigned doy = (153*(m>2 ? m-3 : m+9) + 2)/5 + d-1;
+    const unsigned doe = yoe*365 + yoe/4 - yoe/100 + doy;
+    return (std::int32_t)(era*146097 + (int)doe - 719468);
+}
+
+//----------------------------------------------------------------------------
+inline
+bool isDecimalDigit(char ch)
+{
+    return ch>='0' && ch<='9';
+}
+
+//----------------------------------------------------------------------------
+inline
+bool parseInt64(std::string_view str, std::int64_t &v)
+{
+    // from_chars не принимает '+'; снимаем его, только если за ним цифра - иначе "+-5" стало бы -5
+    if (str.size()>1 && str[0]=='+' && isDecimalDigit(str[1]))
+        str.remove_prefix(1);
+
+    auto res = std::from_chars(str.data(), str.data()+str.size(), v);
+    return res.ec==std::errc() && res.ptr==str.data()+str.size();
+}
+
+//----------------------------------------------------------------------------
+//! nan и inf (в любом регистре и со знаком) не принимаются - число должно начинаться с цифры или точки
+inline
+bool parseDouble(std::string_view str, double &v)
+{
+    if (str.size()>1 && str[0]=='+' && (isDecimalDigit(str[1]) || str[1]=='.'))
+        str.remove_prefix(1);
+
+    std::size_t first = !str.empty() && str[0]=='-' ? 1u : 0u;
+    if (first>=str.size() || !(isDecimalDigit(str[first]) || str[first]=='.'))
+        return false;
+
+    auto res = std::from_chars(str.data(), str.data()+str.size(), v);
+    return res.ec==std::errc() && res.ptr==str.data()+str.size();
+}
+
+//----------------------------------------------------------------------------
+inline
+bool parseBool(std::string_view str, std::uint8_t &v)
+{
+    if (str.size()>5)
+        return false;
+
+    char buf[5];
+    for(std::size_t i=0; i!=str.size(); ++i)
+        buf[i] = (str[i]>='A' && str[i]<='Z') ? char(str[i]-'A'+'a') : str[i];
+
+    std::string_view lower(buf, str.size());
+    if (lower=="1" || lower=="true" || lower=="yes" || lower=="t" || lower=="y")
+    {
+        v = 1;
+        return true;
+    }
+
+    if (lower=="0" || lower=="false" || lower=="no" || lower=="f" || lower=="n")
+    {
+        v = 0;
+        return true;
+    }
+
+    return false;
+}
+
+//----------------------------------------------------------------------------
+inline
+bool parseDate(std::string_view str, std::int32_t &v)
+{
+    if (str.size()!=10 || str[4]!='-' || str[7]!='-')
+        return false;
+
+    int y = 0; unsigned m = 0, d = 0;
+    auto r1 = std::from_chars(str.data()  , str.data()+4 , y);
+    auto r2 = std::from_chars(str.data()+5, str.data()+7 , m);
+    auto r3 = std::from_chars(str.data()+8, str.data()+10, d);
+    if ( r1.ec!=std::errc() || r1.ptr!=str.data()+4
+      || r2.ec!=std::errc() || r2.ptr!=str.data()+7
+      || r3.ec!=std::errc() || r3.ptr!=str.data()+10
+       )
+        return false;
+
+    static const unsigned daysInMonth[12] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    if (m<1 || m>12 || d<1 || d>daysInMonth[m-1])
+        return false;
+
+    bool leap = (y%4==0 && y%100!=0) || y%400==0;
+    if (m==2 && d==29 && !leap)
+        return false;
+
+    v = daysFromCivil(y, m, d);
+    return true;
+}
+
+} // namespace details
+
+//----------------------------------------------------------------------------
+//! Типизированная колонка - значения хранятся в векторе соответствующего типа
+/*! Пустые и некорректные значения отмечаются как null (isNull), в векторе значений на их месте - ноль
+ */
+class TypedColumn
+{
+    ColumnType                 m_type = ColumnType::String;
+    std::vector<std::int64_t>  m_int64s ;
+    std::vector<double>        m_doubles;
+    std::vector<std::uint8_t>  m_bools  ;
+    std::vector<std::int32_t>  m_dates  ;
+    ColumnarTable::Column      m_strings;
+    std::vector<std::uint8_t>  m_valid  ;
+
+public:
+
+    TypedColumn() = default;
+    explicit TypedColumn(ColumnType type) : m_type(type) {}
+
+    ColumnType  type () const { return m_type; }
+    std::size_t size () const { return m_valid.size(); }
+
+    bool isNull(std::size_t idx) const { return m_valid[idx]==0; }
+
+    const std::vector<std::int64_t>& int64s () const { return m_int64s ; }
+    const std::vector<double>      & doubles() const { return m_doubles; }
+    const std::vector<std::uint8_t>& bools  () const { return m_bools  ; }
+    const std::vector<std::int32_t>& dates  () const { return m_dates  ; } //!< Дни от 1970-01-01
+    const ColumnarTable::Column    & strings() const { return m_strings; }
+
+    //! Конвертирует и добавляет значение; false - значение не соответствует типу (добавлен null)
+    bool append(std::string_view str)
+    {
+        if (m_type==ColumnType::String)
+        {
+            m_strings.append(str);
+            m_valid.push_back(1);
+            return true;
+        }
+
+        if (str.empty())
+        {
+            appendNull();
+            return true;
+        }
+
+        bool ok = false;
+        switch(m_type)
+        {
+            case ColumnType::Int64 : { std::int64_t v = 0; ok = details::parseInt64 (str, v); m_int64s .push_back(ok ? v : 0); break; }
+            case ColumnType::Double: { double       v = 0; ok = details::parseDouble(str, v); m_doubles.push_back(ok ? v : 0); break; }
+            case ColumnType::Bool  : { std::uint8_t v = 0; ok = details::parseBool  (str, v); m_bools  .push_back(ok ? v : 0); break; }
+            case ColumnType::Date  : { std::int32_t v = 0; ok = details::parseDate  (str, v); m_dates  .push_back(ok ? v : 0); break; }
+            default: break;
+        }
+
+        m_valid.push_back(ok ? 1 : 0);
+        return ok;
+    }
+
+    void appendNull()
+    {
+        switch(m_type)
+        {
+            case ColumnType::String: m_strings.append(std::string_view()); break;
+            case ColumnType::Int64 : m_int64s .push_back(0); break;
+            case ColumnType::Double: m_doubles.push_back(0); break;
+            case ColumnType::Bool  : m_bools  .push_back(0); break;
+            case ColumnType::Date  : m_dates  .push_back(0); break;
+            default: break;
+        }
+        m_valid.push_back(0);
+    }
+
+}; // class TypedColumn
+
+//----------------------------------------------------------------------------
+struct TypedTable
+{
+    std::vector<std::string>  header ; //!< Заполняется, если Schema::hasHeader
+    std::vector<TypedColumn>  columns;
+    std::size_t               rowsCount = 0;
+};
+
+//----------------------------------------------------------------------------
+struct TypedParseResult
+{
+    TypedTable                data;
+    std::vector<ParseError>   errors;
+};
+
+//----------------------------------------------------------------------------
+//! Разбор по схеме - значения конвертируются прямо из входного буфера, без промежуточных строк
+/*! Число колонок задаёт схема: лишние поля строки отбрасываются, недостающие - null.
+    Значения, не соответствующие типу колонки, становятся null и отмечаются ошибкой ParseErrorType::InvalidValue.
+ */
+inline
+TypedParseResult parseTyped(std::string_view content, const Schema &schema, char delim=',', char quot='\"', bool strict=true)
+{
+    using std::to_string;
+
+    TypedParseResult result;
+    auto &table = result.data;
+
+    table.columns.reserve(schema.columns.size());
+    for(auto ct : schema.columns)
+        table.columns.emplace_back(ct);
+
+    auto parser = details::CsvParser(delim, quot, strict);
+
+    std::string unescapeBuf;
+    bool headerPending = schema.hasHeader;
+
+    parser.parseSpans(content.data(), content.size(), result.errors, [&](const details::FieldSpan *pFields, std::size_t numFields)
+    {
+        if (headerPending)
+        {
+            details::spansToStrings(pFields, numFields, parser.quot(), table.header);
+            headerPending = false;
+            return;
+        }
+
+        for(std::size_t i=0u; i!=table.columns.size(); ++i)
+        {
+            if (i>=numFields)
+            {
+                table.columns[i].appendNull();
+                continue;
+            }
+
+            const auto &fs = pFields[i];
+            auto fieldView = details::trimFieldSpan(fs);
+            if (fs.escaped())
+            {
+                unescapeBuf.clear();
+                details::appendUnescaped(unescapeBuf, fieldView, parser.quot());
+                fieldView = std::string_view(unescapeBuf);
+            }
+
+            if (!table.columns[i].append(fieldView))
+            {
+                parser.reportRowError(ParseErrorType::InvalidValue, std::size_t(fs.begin - content.data()), [&]()
+                {
+                    return "Invalid " + to_string(schema.columns[i]) + " value in column " + to_string(i);
+                });
+            }
+        }
+
+        ++table.rowsCount;
+    });
+
+    return result;
+}
+
+//----------------------------------------------------------------------------
+
+} // namespace csv
+} // namespace marty
@@ -0,0 +1,258 @@
+/* \file
+   \brief marty_csv_writer - потоковая запись CSV через буфер фиксированного размера
+
+ */
+
+#pragma once
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(_WIN32)
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+
+namespace marty {
+namespace csv {
+
+//----------------------------------------------------------------------------
+//! Запись CSV построчно или по полям
+/*! Данные накапливаются в буфере фиксированного размера и сбрасываются в файловый дескриптор,
+    FILE* или std::ostream. Память на поле не выделяется. Кавычки - по RFC 4180: поле берётся
+    в кавычки, если содержит кавычку, разделитель, CR или LF, кавычки внутри удваиваются.
+    Строки, в которые не записано ни одного символа, пропускаются - как в serializeToCsv.
+    Ошибки записи не бросают исключений - после первой ошибки good() возвращает false.
+ */
+class CsvWriter
+{
+    enum class OutputKind
+    {
+        Fd    ,
+        File  ,
+        Stream
+    };
+
+    OutputKind         m_outputKind;
+    int                m_fd        = -1;
+    std::FILE         *m_pFile     = 0;
+    std::ostream      *m_pStream   = 0;
+
+    char               m_sep       = ';';
+    std::string        m_lf        = "\n";
+
+    std::vector<char>  m_buf;
+    std::size_t        m_used      = 0;
+    std::size_t        m_rowFields = 0;  // Полей в текущей строке
+    std::size_t        m_rowBytes  = 0;  // Символов, записанных в текущей строке
+    bool               m_good      = true;
+
+    bool writeOut(const char *pData, std::size_t size)
+    {
+        if (!m_good || !size)
+            return m_good;
+
+        switch(m_outputKind)
+        {
+            case OutputKind::Fd:
+            {
+                while(size)
+                {
+#if defined(_WIN32)
+                    int n = _write(m_fd, pData, (unsigned)(size>0x40000000u ? 0x40000000u : size));
+#else
+                    auto n = ::write(m_fd, pData, size);
+#endif
+                    if (n<0 && errno==EINTR)
+                        continue; // Прервано сигналом - повторяем
+                    if (n<=0)
+                    {
+                        m_good = false;
+                        break;
+                    }
+                    pData += n; // Частичная запись - дописываем остаток
+                    size  -= std::size_t(n);
+                }
+                break;
+            }
+
+            case OutputKind::File:
+                m_good = std::fwrite(pData, 1, size, m_pFile)==size;
+                break;
+
+            case OutputKind::Stream:
+                m_pStream->write(pData, std::streamsize(size));
+                m_good = !m_pStream->fail();
+                break;
+        }
+
+        return m_good;
+    }
+
+    void put(const char *pData, std::size_t size)
+    {
+        m_rowBytes += size;
+
+        if (size > m_buf.size()-m_used)
+        {
+            flushBuffer();
+            if (size >= m_buf.size())
+            {
+                writeOut(pData, size); // Не влезает в пустой буфер - пишем напрямую
+                return;
+            }
+        }
+
+        std::memcpy(m_buf.data()+m_used, pData, size);
+        m_used += size;
+    }
+
+    void put(char ch)
+    {
+        if (m_used==m_buf.size())
+            flushBuffer();
+        m_buf[m_used++] = ch;
+        ++m_rowBytes;
+    }
+
+    bool flushBuffer()
+    {
+        bool res = writeOut(m_buf.data(), m_used);
+        m_used = 0;
+        return res;
+    }
+
+    bool needQuoting(std::string_view field) const
+    {
+        for(auto ch : field)
+        {
+            if (ch=='\"' || ch==m_sep || ch=='\r' || ch=='\n')
+                return true;
+        }
+        return false;
+    }
+
+    CsvWriter(OutputKind kind, const std::string &lf, char sep, std::size_t bufSize)
+    : m_outputKind(kind)
+    , m_sep(sep)
+    , m_lf(lf)
+    , m_buf(bufSize ? bufSize : 1u)
+    {}
+
+public:
+
+    //! Запись в файловый дескриптор; дескриптор не закрывается
+    /*! Порядок параметров lf, sep - как у serializeToCsv */
+    explicit CsvWriter(int fd, const std::string &lf="\n", char sep=';', std::size_t bufSize=64*1024)
+    : CsvWriter(OutputKind::Fd, lf, sep, bufSize)
+    {
+        m_fd = fd;
+    }
+
+    //! Запись в FILE*; файл не закрывается
+    explicit CsvWriter(std::FILE *pFile, const std::string &lf="\n", char sep=';', std::size_t bufSize=64*1024)
+    : CsvWriter(OutputKind::File, lf, sep, bufSize)
+    {
+        m_pFile = pFile;
+    }
+
+    explicit CsvWriter(std::ostream &os, const std::string &lf="\n", char sep=';', std::size_t bufSize=64*1024)
+    : CsvWriter(OutputKind::Stream, lf, sep, bufSize)
+    {
+        m_pStream = &os;
+    }
+
+    ~CsvWriter()
+    {
+        flush();
+    }
+
+    CsvWriter(const CsvWriter&) = delete;
+    CsvWriter& operator=(const CsvWriter&) = delete;
+
+    //! Добавляет поле в текущую строку
+    void writeField(std::string_view field)
+    {
+        if (m_rowFields++)
+            put(m_sep);
+
+        if (!needQuoting(field))
+        {
+            put(field.data(), field.size());
+            return;
+        }
+
+        put('\"');
+        for(;;)
+        {
+            auto qPos = field.find('\"');
+            if (qPos==field.npos)
+            {
+                put(field.data(), field.size());
+                break;
+            }
+
+            put(field.data(), qPos+1);
+            put('\"');
+            field.remove_prefix(qPos+1);
+        }
+        put('\"');
+    }
+
+    //! Завершает текущую строку
+    void endRow()
+    {
+        if (m_rowBytes)
+            put(m_lf.data(), m_lf.size());
+
+        m_rowFields = 0;
+        m_rowBytes  = 0;
+    }
+
+    //! Записывает строку целиком - любой диапазон значений, приводимых к std::string_view
+    template<typename RowType>
+    void writeRow(const RowType &row)
+    {
+        for(const auto &field : row)
+            writeField(std::string_view(field));
+        endRow();
+    }
+
+    template<typename RowsType>
+    void writeRows(const RowsType &rows)
+    {
+        for(const auto &row : rows)
+            writeRow(row);
+    }
+
+    //! Сбрасывает буфер в выход
+    bool flush()
+    {
+        flushBuffer();
+
+        if (m_good)
+        {
+            if (m_outputKind==OutputKind::File)
+                m_good = std::fflush(m_pFile)==0;
+            else if (m_outputKind==OutputKind::Stream)
+                m_good = !m_pStream->flush().fail();
+        }
+
+        return m_good;
+    }
+
+    bool good() const { return m_good; }
+
+}; // class CsvWriter
+
+//----------------------------------------------------------------------------
+
+} // namespace csv
+} // namespace marty
@@ -0,0 +1,450 @@
+/* \file
+   \brief Векторный поиск структурных символов CSV (кавычка, разделитель, перевод строки)
+
+   Реализация выбирается при компиляции: AVX-512BW, AVX2, SSE2/SSE4.2 или скалярный вариант.
+   MARTY_CSV_NO_SIMD принудительно включает скалярный вариант. Проверка UTF-8 использует SSSE3,
+   если он доступен при компиляции.
+
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if !defined(MARTY_CSV_NO_SIMD)
+    #if defined(__AVX512BW__)
+        #define MARTY_CSV_SIMD_AVX512
+    #elif defined(__AVX2__)
+        #define MARTY_CSV_SIMD_AVX2
+    #elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+        #define MARTY_CSV_SIMD_SSE
+    #endif
+#endif
+
+// PSHUFB (SSSE3) нужен для табличной проверки UTF-8; AVX2 и AVX-512 его подразумевают
+#if defined(MARTY_CSV_SIMD_AVX512) || defined(MARTY_CSV_SIMD_AVX2) || (defined(MARTY_CSV_SIMD_SSE) && (defined(__SSSE3__) || defined(__AVX__)))
+    #define MARTY_CSV_SIMD_SSSE3
+#endif
+
+#if defined(MARTY_CSV_SIMD_AVX512) || defined(MARTY_CSV_SIMD_AVX2) || defined(MARTY_CSV_SIMD_SSE)
+    #include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+
+namespace marty {
+namespace csv {
+namespace details {
+namespace simd {
+
+//----------------------------------------------------------------------------
+const std::size_t blockSize = 64; //!< Размер блока, для которого строятся битовые маски
+
+//----------------------------------------------------------------------------
+//! Битовые маски блока: бит N установлен, если символ с индексом N в блоке соответствующего класса
+struct BlockMasks
+{
+    std::uint64_t quot   ;
+    std::uint64_t delim  ;
+    std::uint64_t newline; //!< CR или LF
+
+    std::uint64_t structural() const { return quot | delim | newline; }
+};
+
+//----------------------------------------------------------------------------
+inline
+unsigned countTrailingZeros(std::uint64_t v)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long idx = 0;
+    _BitScanForward64(&idx, v);
+    return (unsigned)idx;
+#elif defined(_MSC_VER)
+    unsigned long idx = 0;
+    if (_BitScanForward(&idx, (unsigned long)v))
+        return (unsigned)idx;
+    _BitScanForward(&idx, (unsigned long)(v>>32));
+    return (unsigned)idx + 32u;
+#else
+    return (unsigned)__builtin_ctzll(v);
+#endif
+}
+
+//----------------------------------------------------------------------------
+#if defined(MARTY_CSV_SIMD_AVX512)
+
+inline
+BlockMasks buildMasksFull(const char *p, char delim, char quot)
+{
+    __m512i v = _mm512_loadu_si512((const void*)p);
+    BlockMasks m;
+    m.quot    = (std::uint64_t)_mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(quot));
+    m.delim   = (std::uint64_t)_mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8(delim));
+    m.newline = (std::uint64_t)( _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\r'))
+                               | _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('\n'))
+                               );
+    return m;
+}
+
+#elif defined(MARTY_CSV_SIMD_AVX2)
+
+inline
+std::uint64_t eqMask32(__m256i v, char ch)
+{
+    return (std::uint64_t)(std::uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(ch)));
+}
+
+inline
+BlockMasks buildMasksFull(const char *p, char delim, char quot)
+{
+    __m256i lo = _mm256_loadu_si256((const __m256i*)p);
+    __m256i hi = _mm256_loadu_si256((const __m256i*)(p+32));
+    BlockMasks m;
+    m.quot    = eqMask32(lo, quot ) | (eqMask32(hi, quot ) << 32);
+    m.delim   = eqMask32(lo, delim) | (eqMask32(hi, delim) << 32);
+    m.newline = eqMask32(lo, '\r' ) | (eqMask32(hi, '\r' ) << 32)
+              | eqMask32(lo, '\n' ) | (eqMask32(hi, '\n' ) << 32);
+    return m;
+}
+
+#elif defined(MARTY_CSV_SIMD_SSE)
+
+inline
+std::uint64_t eqMask16(__m128i v, char ch)
+{
+    return (std::uint64_t)(std::uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(ch)));
+}
+
+inline
+BlockMasks buildMasksFull(const char *p, char delim, char quot)
+{
+    BlockMasks m = { 0, 0, 0 };
+    for(unsigned i=0; i!=4; ++i)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p+16*i));
+        unsigned shift = 16*i;
+        m.quot    |= eqMask16(v, quot ) << shift;
+        m.delim   |= eqMask16(v, delim) << shift;
+        m.newline |= (eqMask16(v, '\r') | eqMask16(v, '\n')) << shift;
+    }
+    return m;
+}
+
+#else
+
+inline
+BlockMasks buildMasksFull(const char *p, char delim, char quot)
+{
+    BlockMasks m = { 0, 0, 0 };
+    for(unsigned i=0; i!=blockSize; ++i)
+    {
+        char ch = p[i];
+        std::uint64_t bit = std::uint64_t(1) << i;
+        if (ch==quot)
+            m.quot |= bit;
+        if (ch==delim)
+            m.delim |= bit;
+        if (ch=='\r' || ch=='\n')
+            m.newline |= bit;
+    }
+    return m;
+}
+
+#endif
+
+//----------------------------------------------------------------------------
+//! Маски для блока, который может быть короче 64 байт - хвост дополняется нулями
+/*! Нулевой символ не может быть разделителем - CsvParser заменяет его на ';'
+ */
+inline
+BlockMasks buildMasks(const char *p, std::size_t size, char delim, char quot)
+{
+    if (size>=blockSize)
+        return buildMasksFull(p, delim, quot);
+
+    char buf[blockSize] = { 0 };
+    std::memcpy(buf, p, size);
+    return buildMasksFull(buf, delim, quot);
+}
+
+//----------------------------------------------------------------------------
+//! Длина начального участка из символов ASCII (старший бит сброшен)
+inline
+std::size_t asciiPrefixLength(const char *p, std::size_t size)
+{
+    std::size_t pos = 0;
+
+#if defined(MARTY_CSV_SIMD_AVX512)
+    for(; pos+64<=size; pos+=64)
+    {
+        std::uint64_t m = (std::uint64_t)_mm512_movepi8_mask(_mm512_loadu_si512((const void*)(p+pos)));
+        if (m)
+            return pos + countTrailingZeros(m);
+    }
+#elif defined(MARTY_CSV_SIMD_AVX2)
+    for(; pos+32<=size; pos+=32)
+    {
+        std::uint32_t m = (std::uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(p+pos)));
+        if (m)
+            return pos + countTrailingZeros(m);
+    }
+#elif defined(MARTY_CSV_SIMD_SSE)
+    for(; pos+16<=size; pos+=16)
+    {
+        std::uint32_t m = (std::uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(p+pos)));
+        if (m)
+            return pos + countTrailingZeros(m);
+    }
+#else
+    // По 8 байт - проверяем старшие биты всех байт слова сразу
+    for(; pos+8<=size; pos+=8)
+    {
+        std::uint64_t w;
+        std::memcpy(&w, p+pos, 8);
+        if (w & 0x8080808080808080ull)
+            break;
+    }
+#endif
+
+    for(; pos<size && (unsigned char)p[pos]<0x80u; ++pos) {}
+    return pos;
+}
+
+//----------------------------------------------------------------------------
+#if defined(MARTY_CSV_SIMD_SSSE3)
+
+//! Ошибки UTF-8 в 16 байтах input; prev - предыдущие 16 байт входа
+/*! Табличный алгоритм Keiser-Lemire: класс ошибки определяется тремя поисками PSHUFB - по старшей
+    и младшей тетрадам предыдущего байта и старшей тетраде текущего; отдельно проверяется, что
+    третий и четвёртый байты трёх- и четырёхбайтовых последовательностей - продолжения.
+    Ненулевой байт результата - ошибка в соответствующей позиции input.
+ */
+inline
+__m128i utf8BlockErrors(__m128i input, __m128i prev)
+{
+    const char tooShort   = 1<<0; // 11______ 0_______ или 11______ 11______
+    const char tooLong    = 1<<1; // 0_______ 10______
+    const char overlong3  = 1<<2; // 11100000 100_____
+    const char tooLarge   = 1<<3; // 11110100 1001____ и больше
+    const char surrogate  = 1<<4; // 11101101 101_____
+    const char overlong2  = 1<<5; // 1100000_ 10______
+    const char tooLarge1000 = 1<<6; // 11110101 1000____ и больше
+    const char overlong4  = 1<<6; // 11110000 1000____
+    const char twoConts   = char(1<<7); // 10______ 10______
+    const char carry      = tooShort | tooLong | twoConts;
+
+    const __m128i lowNibble = _mm_set1_epi8(0x0F);
+
+    __m128i prev1 = _mm_alignr_epi8(input, prev, 15);
+
+    __m128i byte1High = _mm_shuffle_epi8(_mm_setr_epi8( tooLong, tooLong, tooLong, tooLong, tooLong, tooLong, tooLong, tooLong
+                                                      , twoConts, twoConts, twoConts, twoConts
+                                                      , tooShort | overlong2
+                                                      , tooShort
+                                                      , tooShort | overlong3 | surrogate
+                                                      , tooShort | tooLarge | tooLarge1000 | overlong4
+                                                      )
+                                        , _mm_and_si128(_mm_srli_epi16(prev1, 4), lowNibble)
+                                        );
+
+    __m128i byte1Low  = _mm_shuffle_epi8(_mm_setr_epi8( carry | overlong3 | overlong2 | overlong4
+                                                      , carry | overlong2
+                                                      , carry
+                                                      , carry
+                                                      , carry | tooLarge
+                                                      , carry | tooLarge | tooLarge1000
+                                                      , carry | tooLarge | tooLarge1000
+                                                      , carry | tooLarge | tooLarge1000
+                                                      , carry | tooLarge | tooLarge1000
+                                                      , carry | tooLarge | tooLarge1000
+                                                      , carry | tooLarge | tooLarge1000
+                                                      , carry | tooLarge | tooLarge1000
+                                                      , carry | tooLarge | tooLarge1000
+                                                      , carry | tooLarge | tooLarge1000 | surrogate
+                                                      , carry | tooLarge | tooLarge1000
+                                                      , carry | tooLarge | tooLarge1000
+                                                      )
+                                        , _mm_and_si128(prev1, lowNibble)
+                                        );
+
+    __m128i byte2High = _mm_shuffle_epi8(_mm_setr_epi8( tooShort, tooShort, tooShort, tooShort, tooShort, tooShort, tooShort, tooShort
+                                                      , tooLong | overlong2 | twoConts | overlong3 | tooLarge1000 | overlong4
+                                                      , tooLong | overlong2 | twoConts | overlong3 | tooLarge
+                                                      , tooLong | overlong2 | twoConts | surrogate | tooLarge
+                                                      , tooLong | overlong2 | twoConts | surrogate | tooLarge
+                                                      , tooShort, tooShort, tooShort, tooShort
+                                                      )
+                                        , _mm_and_si128(_mm_srli_epi16(input, 4), lowNibble)
+                                        );
+
+    __m128i special = _mm_and_si128(_mm_and_si128(byte1High, byte1Low), byte2High);
+
+    // Третий байт после 111_____ и четвёртый после 1111____ обязаны быть продолжениями;
+    // у таких позиций бит twoConts ожидается установленным, и XOR его снимает
+    __m128i prev2 = _mm_alignr_epi8(input, prev, 14);
+    __m128i prev3 = _mm_alignr_epi8(input, prev, 13);
+    __m128i must23 = _mm_or_si128( _mm_subs_epu8(prev2, _mm_set1_epi8(char(0xE0-0x80)))
+                                 , _mm_subs_epu8(prev3, _mm_set1_epi8(char(0xF0-0x80)))
+                                 );
+
+    return _mm_xor_si128(_mm_and_si128(must23, _mm_set1_epi8(char(0x80))), special);
+}
+
+#endif
+
+//----------------------------------------------------------------------------
+//! Длина начального участка корректного UTF-8, состоящего из целых последовательностей
+/*! p должен указывать на начало последовательности. Участок может оказаться короче максимально
+    возможного: последовательность на границе последнего проверенного блока и всё, что не
+    является ASCII или двухбайтовой последовательностью после него, остаются для побайтной проверки.
+ */
+inline
+std::size_t utf8ValidPrefixLength(const char *p, std::size_t size)
+{
+    std::size_t pos = 0;
+
+#if defined(MARTY_CSV_SIMD_SSSE3)
+    __m128i prev = _mm_setzero_si128();
+    for(; pos+16<=size; pos+=16)
+    {
+        __m128i input = _mm_loadu_si128((const __m128i*)(p+pos));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(utf8BlockErrors(input, prev), _mm_setzero_si128()))!=0xFFFF)
+            break;
+        prev = input;
+    }
+
+    // Последовательность, начатая до pos, могла не закончиться - её проверит следующий блок или вызывающий
+    if (pos)
+    {
+        std::size_t q = pos-1;
+        for(unsigned i=0; i!=3 && q && ((unsigned char)p[q]&0xC0u)==0x80u; ++i)
+            --q;
+        if ((unsigned char)p[q]>=0x80u)
+            pos = q;
+    }
+#endif
+
+    // ASCII и двухбайтовые последовательности (кириллица, латиница с диакритикой) - без вызова проверки на символ
+    for(;;)
+    {
+        unsigned char b = pos<size ? (unsigned char)p[pos] : 0u;
+        if (pos<size && b<0x80u)
+            ++pos;
+        else if (pos+1<size && b>=0xC2u && b<=0xDFu && ((unsigned char)p[pos+1]&0xC0u)==0x80u)
+            pos += 2;
+        else
+            break;
+    }
+
+    return pos;
+}
+
+//----------------------------------------------------------------------------
+//! Префиксный XOR: бит N результата равен XOR битов 0..N аргумента
+inline
+std::uint64_t prefixXor(std::uint64_t m)
+{
+#if (defined(__PCLMUL__) || (defined(_MSC_VER) && defined(__AVX2__))) && !defined(MARTY_CSV_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+    // Умножение без переносов на число из всех единиц - это и есть префиксный XOR
+    __m128i r = _mm_clmulepi64_si128(_mm_set_epi64x(0, (long long)m), _mm_set1_epi8((char)0xFF), 0);
+    return (std::uint64_t)_mm_cvtsi128_si64(r);
+#else
+    m ^= m << 1;
+    m ^= m << 2;
+    m ^= m << 4;
+    m ^= m << 8;
+    m ^= m << 16;
+    m ^= m << 32;
+    return m;
+#endif
+}
+
+//----------------------------------------------------------------------------
+//! Маска символов внутри кавычек для блока, исходя из чётности кавычек
+/*! inQuotes - состояние на входе в блок, обновляется состоянием на выходе.
+    Удвоенные кавычки переключают состояние дважды, поэтому на корректном CSV маска точная.
+    Кавычки, которые парсер считает обычными символами (кавычка посреди поля), маску сбивают -
+    поэтому она годится только для предположений, которые потом проверяются парсером.
+    Бит открывающей кавычки установлен, закрывающей - сброшен.
+ */
+inline
+std::uint64_t inQuoteMask(std::uint64_t quotMask, bool &inQuotes)
+{
+    std::uint64_t mask = prefixXor(quotMask);
+    if (inQuotes)
+        mask = ~mask;
+    inQuotes = (mask >> 63)!=0;
+    return mask;
+}
+
+//----------------------------------------------------------------------------
+//! Поиск ближайших структурных символов; маски блока кэшируются, поэтому последовательные вызовы в пределах блока дёшевы
+class StructuralIndexer
+{
+    const char   *m_pData     = 0;
+    std::size_t   m_size      = 0;
+    char          m_delim     = ',';
+    char          m_quot      = '\"';
+
+    std::size_t   m_blockPos  = std::size_t(-1);
+    std::uint64_t m_quotMask  = 0;
+    std::uint64_t m_structMask= 0;
+
+    void loadBlock(std::size_t blockPos)
+    {
+        BlockMasks m = buildMasks(m_pData+blockPos, m_size-blockPos, m_delim, m_quot);
+        m_blockPos   = blockPos;
+        m_quotMask   = m.quot;
+        m_structMask = m.structural();
+    }
+
+    template<typename MaskGetter>
+    std::size_t findNext(std::size_t pos, MaskGetter getMask)
+    {
+        while(pos<m_size)
+        {
+            std::size_t blockPos = pos - pos%blockSize;
+            if (blockPos!=m_blockPos)
+                loadBlock(blockPos);
+
+            std::uint64_t mask = getMask() >> (pos-blockPos);
+            if (mask)
+                return pos + countTrailingZeros(mask);
+
+            pos = blockPos + blockSize;
+        }
+
+        return m_size;
+    }
+
+public:
+
+    StructuralIndexer(const char *pData, std::size_t size, char delim, char quot)
+    : m_pData(pData), m_size(size), m_delim(delim), m_quot(quot)
+    {}
+
+    //! Позиция ближайшей кавычки, разделителя, CR или LF, начиная с pos; size, если не найдено
+    std::size_t nextStructural(std::size_t pos)
+    {
+        return findNext(pos, [&]() { return m_structMask; });
+    }
+
+    //! Позиция ближайшей кавычки, начиная с pos; size, если не найдено
+    std::size_t nextQuote(std::size_t pos)
+    {
+        return findNext(pos, [&]() { return m_quotMask; });
+    }
+
+}; // class StructuralIndexer
+
+//----------------------------------------------------------------------------
+
+} // namespace simd
+} // namespace details
+} // namespace csv
+} // namespace marty
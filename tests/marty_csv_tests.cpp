@@ -0,0 +1,1612 @@
+/* \file
+   \brief marty_csv_tests - тесты marty_csv, запускаются через CTest
+
+   Запуск: marty_csv_tests <test> [seed]; без аргументов печатается список тестов.
+   Код возврата 0 - тест пройден. Случайные тесты при расхождении печатают вход, на котором
+   оно найдено, тесты на фиксированных входах - не выполненные проверки.
+
+ */
+
+#include "marty_csv.h"
+#include "marty_csv_compressed.h"
+#include "marty_csv_encoding.h"
+#include "marty_csv_index.h"
+#include "marty_csv_parallel.h"
+#include "marty_csv_pipeline.h"
+#include "marty_csv_typed.h"
+#include "marty_csv_writer.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+using namespace marty::csv;
+
+//----------------------------------------------------------------------------
+static
+bool sameErrors(const std::vector<ParseError> &a, const std::vector<ParseError> &b)
+{
+    if (a.size()!=b.size())
+        return false;
+
+    for(std::size_t i=0; i!=a.size(); ++i)
+    {
+        if (a[i].type!=b[i].type || a[i].message!=b[i].message || a[i].line!=b[i].line || a[i].position!=b[i].position)
+            return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+static int g_failedChecks = 0;
+
+//! Проверка в тестах на фиксированных входах - при неудаче печатает what, тест продолжается
+static
+void expect(bool cond, const char *what)
+{
+    if (cond)
+        return;
+
+    ++g_failedChecks;
+    std::printf("check failed: %s\n", what);
+}
+
+//----------------------------------------------------------------------------
+static
+void printMismatch(const char *testName, const std::string &input, char delim, bool strict)
+{
+    std::printf("%s: mismatch, delim='%c', strict=%d, input:\n[", testName, delim, strict ? 1 : 0);
+    std::fwrite(input.data(), 1, input.size(), stdout);
+    std::printf("]\n");
+}
+
+//----------------------------------------------------------------------------
+static
+std::string randomInput(std::mt19937 &rng, const std::string &alphabet, std::size_t maxLen)
+{
+    std::string s;
+    std::size_t len = rng()%(maxLen+1);
+    for(std::size_t i=0; i!=len; ++i)
+        s.push_back(alphabet[rng()%alphabet.size()]);
+    return s;
+}
+
+//----------------------------------------------------------------------------
+//! Корректный CSV, на котором старый marty_csv::deserializeFieldsFromCsvLines и новый parse обязаны совпадать
+/*! Старый разбор не обрезает пробелы, выбрасывает CR и не завершает запись после закрывающей
+    кавычки перед LF - поэтому в полях нет пробелов и CR, а последнее поле записи не закавычено.
+ */
+static
+std::string randomWellFormedCsv(std::mt19937 &rng, char delim)
+{
+    static const char plainChars[]  = "abcxyz019._-";
+    static const char quotedChars[] = "ab,;\n\"";
+
+    std::string s;
+    std::size_t rows = rng()%12;
+    for(std::size_t r=0; r!=rows; ++r)
+    {
+        std::size_t fields = 1 + rng()%5;
+        for(std::size_t f=0; f!=fields; ++f)
+        {
+            if (f)
+                s.push_back(delim);
+
+            if (f+1!=fields && rng()%3==0)
+            {
+                s.push_back('\"');
+                for(std::size_t n=rng()%6; n; --n)
+                {
+                    char ch = quotedChars[rng()%(sizeof(quotedChars)-1)];
+                    s.push_back(ch);
+                    if (ch=='\"')
+                        s.push_back('\"');
+                }
+                s.push_back('\"');
+            }
+            else
+            {
+                // Последнее поле непустое - иначе запись из одного пустого поля была бы пустой строкой
+                std::size_t n = rng()%5 + (f+1==fields ? 1u : 0u);
+                for(; n; --n)
+                    s.push_back(plainChars[rng()%(sizeof(plainChars)-1)]);
+            }
+        }
+
+        if (r+1!=rows || rng()%2)
+            s.push_back('\n');
+    }
+
+    return s;
+}
+
+//----------------------------------------------------------------------------
+//! Новый разбор против marty_csv::deserializeFieldsFromCsvLines на корректных входах
+static
+bool testLegacyDifferential(unsigned seed)
+{
+    std::mt19937 rng(seed);
+
+    for(int it=0; it!=5000; ++it)
+    {
+        char delim = rng()%2 ? ',' : ';';
+        std::string s = randomWellFormedCsv(rng, delim);
+
+        auto legacy = marty_csv::deserializeFieldsFromCsvLines(s, delim);
+        auto res    = parse(s, delim, '\"', true);
+
+        bool onlyColumnsErrors = true;
+        for(const auto &e : res.errors)
+            onlyColumnsErrors = onlyColumnsErrors && e.type==ParseErrorType::InconsistentColumns;
+
+        if (res.data!=legacy || !onlyColumnsErrors)
+        {
+            printMismatch("legacy_differential", s, delim, true);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+//! CsvPushParser при любом разбиении входа на куски даёт те же строки и ошибки, что и parse
+static
+bool testPushChunkInvariance(unsigned seed)
+{
+    static const std::string alphabet = "ab ,;\"\t\r\n\r\nx";
+
+    std::mt19937 rng(seed);
+
+    for(int it=0; it!=20000; ++it)
+    {
+        std::string s = randomInput(rng, alphabet, it%10==0 ? 400 : 40);
+        char delim  = rng()%2 ? ',' : ';';
+        bool strict = rng()%2!=0;
+
+        auto ref = parse(s, delim, '\"', strict);
+
+        std::vector< std::vector<std::string> > rows;
+        CsvPushParser pp(delim, '\"', strict);
+        std::vector<std::string> row;
+
+        for(std::size_t pos=0; pos<s.size(); )
+        {
+            std::size_t n = 1 + rng()%(rng()%3==0 ? 64u : 4u);
+            if (n>s.size()-pos)
+                n = s.size()-pos;
+            pp.feed(s.data()+pos, n);
+            pos += n;
+
+            while(pp.popRow(row))
+                rows.push_back(row);
+        }
+
+        pp.finish();
+        while(pp.popRow(row))
+            rows.push_back(row);
+
+        if (rows!=ref.data || !sameErrors(ref.errors, pp.errors()))
+        {
+            printMismatch("push_chunk_invariance", s, delim, strict);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+//! parseParallel при любом числе потоков и размере сегментов совпадает с parse
+static
+bool testParallelEquivalence(unsigned seed)
+{
+    static const std::string alphabets[] = { "ab ,;\"\t\r\n\nx", "abc,,,\n\"\"", "a,b\n\"x\"\"y\",\n", "aaaa,bbbb,\"c\nd\",e\r\n" };
+
+    std::mt19937 rng(seed);
+
+    for(int it=0; it!=3000; ++it)
+    {
+        std::string s = randomInput(rng, alphabets[rng()%4], 600);
+        if (rng()%3==0)
+        {
+            s.clear();
+            for(unsigned r=rng()%40; r; --r)
+            {
+                s += "f1,\"q,\"\"x\n\",  3 ,4\n";
+                if (rng()%5==0)
+                    s += "\r\n\r\n";
+                if (rng()%7==0)
+                    s += "x,y\n";
+            }
+        }
+
+        char delim  = rng()%2 ? ',' : ';';
+        bool strict = rng()%2!=0;
+
+        auto ref = parse(s, delim, '\"', strict);
+        auto par = parseParallel(s, delim, '\"', strict, 1 + rng()%6, 1 + rng()%20);
+
+        if (par.data!=ref.data || !sameErrors(ref.errors, par.errors))
+        {
+            printMismatch("parallel_equivalence", s, delim, strict);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+//! Пул потоков parseParallel: исключение из задачи в любом потоке доходит до вызывающего, пул после него работает
+static
+bool testParallelTaskPool(unsigned seed)
+{
+    details::TaskPool pool(4);
+
+    for(std::size_t rep=0; rep!=200; ++rep)
+    {
+        const std::size_t throwAt = (rep*7 + seed)%100;
+
+        bool caught = false;
+        try
+        {
+            pool.run(100, [&](std::size_t i)
+            {
+                if (i==throwAt || (rep%10==0 && i%3==0))
+                    throw std::runtime_error("task failed");
+            });
+        }
+        catch(const std::runtime_error&)
+        {
+            caught = true;
+        }
+        expect(caught, "exception from a task is rethrown by run");
+
+        std::atomic<std::size_t> sum(0);
+        pool.run(1000, [&](std::size_t i) { sum += i; });
+        expect(sum==999u*1000u/2u, "all tasks run after an exception");
+    }
+
+    return !g_failedChecks;
+}
+
+//----------------------------------------------------------------------------
+//! Конвертеры parseTyped: знак '+', отказ от nan/inf, високосные даты
+static
+bool testTypedValueParsers(unsigned)
+{
+    std::int64_t i = 0;
+    expect(details::parseInt64("+5", i) && i==5   , "Int64 '+5'");
+    expect(details::parseInt64("-5", i) && i==-5  , "Int64 '-5'");
+    expect(!details::parseInt64("+-5", i)         , "Int64 '+-5' rejected");
+    expect(!details::parseInt64("+"  , i)         , "Int64 '+' rejected");
+    expect(!details::parseInt64("5x" , i)         , "Int64 '5x' rejected");
+    expect(!details::parseInt64(""   , i)         , "Int64 empty rejected");
+
+    double d = 0;
+    expect(details::parseDouble("+.5", d) && d==0.5 , "Double '+.5'");
+    expect(details::parseDouble("-.5", d) && d==-0.5, "Double '-.5'");
+    expect(details::parseDouble("1e3", d) && d==1000, "Double '1e3'");
+    expect(!details::parseDouble("1e" , d)          , "Double '1e' rejected");
+    expect(!details::parseDouble("+-1", d)          , "Double '+-1' rejected");
+    expect(!details::parseDouble("."  , d)          , "Double '.' rejected");
+
+    static const char * const notNumbers[] = { "nan", "NaN", "+nan", "-nan", "inf", "-inf", "+INF", "infinity" };
+    for(auto str : notNumbers)
+        expect(!details::parseDouble(str, d), "Double nan/inf rejected");
+
+    std::uint8_t b = 0;
+    expect(details::parseBool("YES", b) && b==1 , "Bool 'YES'");
+    expect(details::parseBool("n"  , b) && b==0 , "Bool 'n'");
+    expect(!details::parseBool("maybe" , b)     , "Bool 'maybe' rejected");
+    expect(!details::parseBool("false1", b)     , "Bool 'false1' rejected");
+
+    std::int32_t day = -1;
+    expect(details::parseDate("1970-01-01", day) && day==0     , "Date epoch");
+    expect(details::parseDate("2000-02-29", day) && day==11016 , "Date 2000-02-29 (leap, divisible by 400)");
+    expect(details::parseDate("2024-02-29", day) && day==19782 , "Date 2024-02-29 (leap)");
+    expect(details::parseDate("2024-12-31", day) && day==20088 , "Date 2024-12-31");
+    expect(!details::parseDate("2023-02-29", day)              , "Date 2023-02-29 rejected");
+    expect(!details::parseDate("1900-02-29", day)              , "Date 1900-02-29 rejected (divisible by 100)");
+    expect(!details::parseDate("2023-04-31", day)              , "Date 2023-04-31 rejected");
+    expect(!details::parseDate("2023-13-01", day)              , "Date month 13 rejected");
+    expect(!details::parseDate("2023-1-01" , day)              , "Date short month rejected");
+    expect(!details::parseDate("2023/01/01", day)              , "Date wrong separator rejected");
+
+    return !g_failedChecks;
+}
+
+//----------------------------------------------------------------------------
+//! parseTyped: заголовок, null для пустых и некорректных значений, ошибки InvalidValue с позицией поля
+static
+bool testTypedParse(unsigned)
+{
+    const std::string s = "id,val,flag,d,name\n"
+                          "1,2.5,true,1970-01-02,abc\n"
+                          "+7, 1e3 ,NO,2024-02-29,\"x\"\"y\"\n"
+                          "bad,nan,maybe,2023-02-29,z\n"
+                          ",,,,\n"
+                          "5\n";
+
+    Schema schema;
+    schema.columns   = { ColumnType::Int64, ColumnType::Double, ColumnType::Bool, ColumnType::Date, ColumnType::String };
+    schema.hasHeader = true;
+
+    auto res = parseTyped(s, schema);
+    const auto &table = res.data;
+    const auto &cols  = table.columns;
+
+    expect(table.header==std::vector<std::string>{ "id", "val", "flag", "d", "name" }, "header");
+    expect(table.rowsCount==5, "rows count");
+    expect(cols.size()==5 && cols[0].size()==5 && cols[4].size()==5, "column sizes");
+    if (g_failedChecks)
+        return false;
+
+    expect(cols[0].int64s()[0]==1 && cols[0].int64s()[1]==7 && cols[0].int64s()[4]==5, "Int64 values");
+    expect(cols[1].doubles()[0]==2.5 && cols[1].doubles()[1]==1000, "Double values (trimmed)");
+    expect(cols[2].bools()[0]==1 && cols[2].bools()[1]==0, "Bool values");
+    expect(cols[3].dates()[0]==1 && cols[3].dates()[1]==19782, "Date values");
+    expect(cols[4].strings()[1]=="x\"y", "unescaped String value");
+
+    for(std::size_t c=0; c!=4; ++c)
+    {
+        expect(!cols[c].isNull(0) && !cols[c].isNull(1), "valid values are not null");
+        expect(cols[c].isNull(2) && cols[c].isNull(3), "invalid and empty values are null");
+    }
+    expect(!cols[4].isNull(3), "empty String is not null");
+    expect(cols[1].isNull(4) && cols[4].isNull(4), "missing fields are null");
+
+    static const char * const messages[] =
+    {
+        "Invalid Int64 value in column 0",
+        "Invalid Double value in column 1",
+        "Invalid Bool value in column 2",
+        "Invalid Date value in column 3",
+    };
+    static const std::size_t positions[] = { 1, 5, 9, 15 };
+
+    // Короткая последняя строка дополнительно даёт InconsistentColumns
+    expect(res.errors.size()==5, "one error per invalid value");
+    for(std::size_t i=0; i<res.errors.size() && i!=4; ++i)
+    {
+        const auto &e = res.errors[i];
+        expect(e.type==ParseErrorType::InvalidValue && e.message==messages[i], "InvalidValue message");
+        expect(e.line==4 && e.position==positions[i], "InvalidValue line/position");
+    }
+    expect(res.errors.size()==5 && res.errors[4].type==ParseErrorType::InconsistentColumns, "short row reported");
+
+    return !g_failedChecks;
+}
+
+//----------------------------------------------------------------------------
+static
+std::string readWholeFile(std::FILE *pFile)
+{
+    std::string s;
+    std::rewind(pFile);
+
+    char buf[4096];
+    for(std::size_t n; (n=std::fread(buf, 1, sizeof(buf), pFile))!=0; )
+        s.append(buf, n);
+
+    return s;
+}
+
+//----------------------------------------------------------------------------
+//! CsvWriter в ostream, FILE* и дескриптор при любом размере буфера пишет одно и то же, и parse читает записанное обратно
+/*! serializeToCsv эталоном не годится - он не берёт в кавычки CR/LF и теряет разделитель после пустого первого поля */
+static
+bool testWriterRoundTrip(unsigned seed)
+{
+    // Без пробелов по краям - parse обрезает их у незакавыченных полей
+    static const char * const parts[] = { "a", "b c", "x\"y", "p;q", "m,n", "", "\"", "\r\n", "line\nbreak", "long field value here" };
+
+    std::mt19937 rng(seed);
+
+    for(int it=0; it!=3000; ++it)
+    {
+        const char sep = rng()%2 ? ',' : ';';
+        const std::string lf = rng()%2 ? "\n" : "\r\n";
+
+        std::vector< std::vector<std::string> > rows(rng()%8);
+        for(auto &row : rows)
+        {
+            row.resize(1 + rng()%5);
+            for(auto &field : row)
+                field = parts[rng()%(sizeof(parts)/sizeof(parts[0]))];
+        }
+
+        // Строка из одного пустого поля не пишется
+        std::vector< std::vector<std::string> > expectedRows;
+        for(const auto &row : rows)
+        {
+            if (!(row.size()==1 && row[0].empty()))
+                expectedRows.push_back(row);
+        }
+
+        std::ostringstream os;
+        {
+            CsvWriter writer(os, lf, sep, 1 + rng()%16);
+            writer.writeRows(rows);
+        }
+
+        std::string viaFile, viaFd;
+        if (std::FILE *pFile = std::tmpfile())
+        {
+            {
+                CsvWriter writer(pFile, lf, sep, 1 + rng()%64);
+                writer.writeRows(rows);
+            }
+            viaFile = readWholeFile(pFile);
+            std::fclose(pFile);
+        }
+
+        if (std::FILE *pFile = std::tmpfile())
+        {
+            {
+#if defined(_WIN32)
+                CsvWriter writer(_fileno(pFile), lf, sep, 1 + rng()%64);
+#else
+                CsvWriter writer(fileno(pFile), lf, sep, 1 + rng()%64);
+#endif
+                writer.writeRows(rows);
+            }
+            viaFd = readWholeFile(pFile);
+            std::fclose(pFile);
+        }
+
+        const std::string written = os.str();
+        if (viaFile!=written || viaFd!=written || parse(written, sep, '\"', false).data!=expectedRows)
+        {
+            printMismatch("writer_round_trip", written, sep, false);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+//! Пустое первое поле: разделитель после него пишется, строка из одного пустого поля пропускается
+static
+bool testWriterEmptyFields(unsigned)
+{
+    std::ostringstream os;
+    {
+        CsvWriter writer(os, "\n", ',', 4);
+        writer.writeRow(std::vector<std::string>{ "", "a" });
+        writer.writeRow(std::vector<std::string>{ "" });
+        writer.writeRow(std::vector<std::string>{ "", "" });
+        writer.writeField("");
+        writer.writeField("");
+        writer.writeField("b");
+        writer.endRow();
+        writer.writeRow(std::vector<std::string>{ "x\"y", "", "p,q" });
+        expect(writer.good(), "writer is good");
+    }
+
+    expect(os.str()==",a\n,\n,,b\n\"x\"\"y\",,\"p,q\"\n", "empty fields keep their separators");
+
+    return !g_failedChecks;
+}
+
+//----------------------------------------------------------------------------
+static
+bool writeWholeFile(const std::string &path, const std::string &data, const char *mode="wb")
+{
+    std::FILE *fp = std::fopen(path.c_str(), mode);
+    if (!fp)
+        return false;
+
+    bool ok = std::fwrite(data.data(), 1, data.size(), fp)==data.size();
+    return std::fclose(fp)==0 && ok;
+}
+
+//----------------------------------------------------------------------------
+//! RowIndex::readRows при любом шаге индекса даёт те же строки, что parse, и только ошибки запрошенных строк
+static
+bool testRowIndexSlices(unsigned seed)
+{
+    static const char * const parts[] = { "a", ",", "\"", "\n", "\r\n", " ", "\"\"", "b,c", "\n\n" };
+
+    std::mt19937 rng(seed);
+
+    for(int it=0; it!=2000; ++it)
+    {
+        std::string s;
+        for(std::size_t n=rng()%400; n; --n)
+            s += parts[rng()%(sizeof(parts)/sizeof(parts[0]))];
+
+        const bool strict = rng()%2!=0;
+
+        auto ref = parse(s, ',', '\"', strict);
+
+        RowIndex index;
+        index.build(s, ',', '\"', strict, 1 + rng()%7);
+        bool ok = index.rowsCount()==ref.data.size();
+
+        for(int k=0; ok && k!=20; ++k)
+        {
+            std::size_t first = ref.data.empty() ? 0u : std::size_t(rng()%ref.data.size());
+            std::size_t count = 1 + rng()%10;
+            std::size_t last  = first+count<ref.data.size() ? first+count : ref.data.size();
+
+            auto slice = index.readRows(s, first, count);
+            ok = slice.data.size()==last-first
+              && std::equal(slice.data.begin(), slice.data.end(), ref.data.begin()+std::ptrdiff_t(first));
+
+            for(const auto &e : slice.errors)
+            {
+                bool found = false;
+                for(const auto &re : ref.errors)
+                    found = found || (re.type==e.type && re.message==e.message && re.line==e.line && re.position==e.position);
+                ok = ok && found;
+            }
+        }
+
+        if (!ok)
+        {
+            printMismatch("row_index_slices", s, ',', strict);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+//! IndexedCsvFile: построение и сохранение индекса, загрузка, перестроение после изменения файла, отказ от испорченного индекса
+static
+bool testRowIndexFile(unsigned)
+{
+    const std::string path      = "marty_csv_tests_row_index.csv";
+    const std::string indexPath = path + ".idx";
+
+    std::string data = "id;name;note\n";
+    for(int i=0; i!=5000; ++i)
+        data += std::to_string(i) + ";name" + std::to_string(i) + ";\"multi\nline;" + std::to_string(i) + "\"\n";
+
+    std::remove(indexPath.c_str());
+    expect(writeWholeFile(path, data), "source file written");
+
+    const auto ref = parse(data, ';', '\"', true);
+
+    {
+        IndexedCsvFile file;
+        expect(file.open(path, 0, 0, true, 64), "open builds the index");
+        expect(file.rowsCount()==ref.data.size(), "rows count");
+        expect(file.index().delimiter()==';', "delimiter detected");
+
+        auto slice = file.readRows(1000, 5);
+        expect(slice.data.size()==5 && slice.data[0]==ref.data[1000] && slice.data[4]==ref.data[1004], "slice from the built index");
+    }
+
+    {
+        RowIndex index;
+        expect(index.load(indexPath, path), "saved index loads");
+        expect(index.rowsCount()==ref.data.size() && index.step()==64 && index.delimiter()==';', "loaded index header");
+
+        IndexedCsvFile file;
+        expect(file.open(path, 0, 0, true, 64), "open with the saved index");
+        auto slice = file.readRows(ref.data.size()-2, 10);
+        expect(slice.data.size()==2 && slice.data[1]==ref.data.back(), "tail slice from the loaded index");
+    }
+
+    // Файл изменился - сохранённый индекс не подходит, IndexedCsvFile строит его заново
+    expect(writeWholeFile(path, "x;y;z\n", "ab"), "source file appended");
+    {
+        RowIndex index;
+        expect(!index.load(indexPath, path), "stale index rejected");
+
+        IndexedCsvFile file;
+        expect(file.open(path, 0, 0, true, 64), "open rebuilds the stale index");
+        expect(file.rowsCount()==ref.data.size()+1, "rebuilt index sees the new row");
+        auto slice = file.readRows(ref.data.size(), 1);
+        expect(slice.data.size()==1 && slice.data[0]==std::vector<std::string>{ "x", "y", "z" }, "new row read");
+        expect(index.load(indexPath, path), "rebuilt index saved");
+    }
+
+    // Испорченный заголовок - rowsCount не соответствует размеру файла индекса
+    {
+        details::IndexFileHeader hdr;
+        std::FILE *fp = std::fopen(indexPath.c_str(), "r+b");
+        expect(fp && std::fread(&hdr, sizeof(hdr), 1, fp)==1, "index header read");
+        if (fp)
+        {
+            hdr.rowsCount    = ~0ull/2;
+            hdr.entriesCount = (hdr.rowsCount+hdr.step-1)/hdr.step;
+            std::fseek(fp, 0, SEEK_SET);
+            std::fwrite(&hdr, sizeof(hdr), 1, fp);
+            std::fclose(fp);
+        }
+
+        RowIndex index;
+        expect(!index.load(indexPath, path), "corrupt index rejected");
+    }
+
+    std::remove(indexPath.c_str());
+    std::remove(path.c_str());
+
+    return !g_failedChecks;
+}
+
+//----------------------------------------------------------------------------
+//! KeyIndexedCsvFile: поиск по ключу, повторное открытие с сохранённым индексом, перестроение после изменения файла
+static
+bool testKeyIndexFile(unsigned)
+{
+    const std::string path      = "marty_csv_tests_key_index.csv";
+    const std::string indexPath = path + ".kidx";
+
+    std::string data = "id,name,note\r\n";
+    for(int i=0; i!=20000; ++i)
+        data += std::to_string(i*7) + ",name" + std::to_string(i) + ",\"multi\nline " + std::to_string(i) + "\"\r\n";
+    data += "\"quoted \"\"key\"\"\",q,r\n";
+    data += "14,dup,second\n";
+    data += "short\n";
+
+    std::remove(indexPath.c_str());
+    expect(writeWholeFile(path, data), "source file written");
+
+    std::vector<std::string> row;
+
+    {
+        KeyIndexedCsvFile file;
+        expect(file.open(path, 0, 0, 0, true), "open builds the index");
+        expect(file.index().keysCount()==20003 && file.index().delimiter()==',', "index header");
+
+        expect(file.lookup("14", row) && row==std::vector<std::string>{ "14", "name2", "multi\nline 2" }, "first of duplicate keys");
+        expect(file.lookup("139993", row) && row[1]=="name19999", "last key");
+        expect(file.lookup("quoted \"key\"", row) && row[1]=="q", "quoted key");
+        expect(file.lookup("short", row) && row.size()==1, "single-field record");
+        expect(!file.lookup("15", row) && row.empty(), "missing key");
+        expect(!file.lookup("id", row), "header is not indexed");
+    }
+
+    {
+        KeyIndex index;
+        expect(index.open(indexPath, path) && index.keyColumn()==0 && index.hasHeader(), "saved index opens");
+
+        KeyIndexedCsvFile file;
+        expect(file.open(path, 0, 0, 0, true), "open with the saved index");
+
+        int bad = 0;
+        for(int i=0; i<20000; i+=37)
+            bad += file.lookup(std::to_string(i*7), row) && row[1]=="name"+std::to_string(i) ? 0 : 1;
+        expect(!bad, "lookups through the saved index");
+
+        KeyIndexedCsvFile byName;
+        expect(byName.open(path, 1, 0, 0, true) && byName.index().keyColumn()==1, "other key column rebuilds the index");
+        expect(byName.lookup("name5", row) && row[0]=="35", "lookup by the other key column");
+    }
+
+    // Файл изменился - сохранённый индекс не подходит, KeyIndexedCsvFile строит его заново
+    expect(writeWholeFile(path, "new,n,x\n", "ab"), "source file appended");
+    {
+        KeyIndex index;
+        expect(!index.open(indexPath, path), "stale index rejected");
+
+        KeyIndexedCsvFile file;
+        expect(file.open(path, 0, 0, 0, true), "open rebuilds the stale index");
+        expect(file.lookup("new", row) && row[1]=="n", "new record found");
+    }
+
+    // Испорченные слоты - все заняты чужими хешами: поиск отсутствующего ключа завершается
+    {
+        details::KeyIndexFileHeader hdr;
+        std::FILE *fp = std::fopen(indexPath.c_str(), "r+b");
+        expect(fp && std::fread(&hdr, sizeof(hdr), 1, fp)==1, "index header read");
+        if (fp)
+        {
+            std::vector<details::KeyIndexSlot> slots(std::size_t(hdr.capacity), details::KeyIndexSlot{ 1, 1 });
+            std::fseek(fp, long(sizeof(hdr)), SEEK_SET);
+            std::fwrite(slots.data(), sizeof(slots[0]), slots.size(), fp);
+            std::fclose(fp);
+        }
+
+        KeyIndex index;
+        MappedFile source;
+        expect(index.open(indexPath, path) && source.open(path), "index with corrupt slots opens");
+        expect(!index.lookup(source.view(), "absent", row), "lookup over full table terminates");
+    }
+
+    // Испорченный заголовок - ключей больше, чем допускает build
+    {
+        details::KeyIndexFileHeader hdr;
+        std::FILE *fp = std::fopen(indexPath.c_str(), "r+b");
+        expect(fp && std::fread(&hdr, sizeof(hdr), 1, fp)==1, "index header read");
+        if (fp)
+        {
+            hdr.keysCount = hdr.capacity;
+            std::fseek(fp, 0, SEEK_SET);
+            std::fwrite(&hdr, sizeof(hdr), 1, fp);
+            std::fclose(fp);
+        }
+
+        KeyIndex index;
+        expect(!index.open(indexPath, path), "corrupt header rejected");
+    }
+
+    std::remove(indexPath.c_str());
+    std::remove(path.c_str());
+
+    return !g_failedChecks;
+}
+
+//----------------------------------------------------------------------------
+//! parseLazy совпадает с parse при любом порядке обращения к полям, в том числе после перемещения таблицы
+static
+bool testLazyEquivalence(unsigned seed)
+{
+    static const char * const parts[] = { "a", ",", ";", "\"", "\n", "\r\n", " ", "\"\"", "b,c", "\t", "x\"y", " \" q \"\" \" " };
+
+    std::mt19937 rng(seed);
+
+    for(int it=0; it!=10000; ++it)
+    {
+        std::string s;
+        for(std::size_t n=rng()%60; n; --n)
+            s += parts[rng()%(sizeof(parts)/sizeof(parts[0]))];
+
+        char delim  = rng()%2 ? ',' : ';';
+        bool strict = rng()%2!=0;
+
+        auto ref  = parse(s, delim, '\"', strict);
+        auto lazy = parseLazy(s, delim, '\"', strict);
+
+        bool ok = lazy.data.size()==ref.data.size() && sameErrors(ref.errors, lazy.errors);
+
+        // Часть полей обрабатывается вразнобой и до перемещения, остальные - при полном обходе после него
+        for(int k=0; ok && k!=5 && !lazy.data.empty(); ++k)
+        {
+            std::size_t r = rng()%lazy.data.size();
+            if (lazy.data.rowSize(r))
+            {
+                std::size_t c = rng()%lazy.data.rowSize(r);
+                ok = lazy.data.field(r, c)==ref.data[r][c];
+            }
+        }
+
+        LazyParseResult moved = std::move(lazy);
+
+        // Повторное преобразование берёт уже обработанные поля
+        ok = ok && moved.data.toVector()==ref.data && moved.toParseResult().data==ref.data;
+
+        for(std::size_t r=0; ok && r!=moved.data.size(); ++r)
+        {
+            auto row = moved.data[r];
+            ok = row.size()==ref.data[r].size() && std::equal(row.begin(), row.end(), ref.data[r].begin());
+        }
+
+        if (!ok)
+        {
+            printMismatch("lazy_equivalence", s, delim, strict);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+//! Декодирует raw кусками случайной длины от 1 до maxChunk байт
+static
+std::string decodeInChunks(TextDecoder &decoder, const std::string &raw, std::mt19937 &rng, std::size_t maxChunk)
+{
+    std::string out;
+    auto sink = [&](const char *pData, std::size_t size) { out.append(pData, size); };
+
+    for(std::size_t pos=0; pos<raw.size(); )
+    {
+        std::size_t n = 1 + rng()%maxChunk;
+        if (n>raw.size()-pos)
+            n = raw.size()-pos;
+        decoder.decode(raw.data()+pos, n, false, sink);
+        pos += n;
+    }
+
+    decoder.decode("", 0, true, sink);
+    return out;
+}
+
+//----------------------------------------------------------------------------
+static
+void appendUtf16(std::string &out, std::uint32_t cp, bool bigEndian)
+{
+    auto putUnit = [&](std::uint32_t u)
+    {
+        char lo = char(u&0xFF), hi = char(u>>8);
+        out.push_back(bigEndian ? hi : lo);
+        out.push_back(bigEndian ? lo : hi);
+    };
+
+    if (cp<0x10000)
+    {
+        putUnit(cp);
+        return;
+    }
+
+    cp -= 0x10000;
+    putUnit(0xD800 + (cp>>10));
+    putUnit(0xDC00 + (cp&0x3FF));
+}
+
+//----------------------------------------------------------------------------
+//! TextDecoder на корректных UTF-8 и UTF-16 при любом разбиении на куски даёт тот же UTF-8 без ошибок
+static
+bool testDecoderRandomChunks(unsigned seed)
+{
+    static const std::uint32_t codePoints[] = { 'a', ',', '\n', '\"', 0x7F, 0x80, 0x43F, 0x451, 0x7FF, 0x800, 0x20AC, 0xD7FF, 0xE000, 0xFFFD, 0xFFFF, 0x10000, 0x1F600, 0x10FFFF };
+
+    std::mt19937 rng(seed);
+
+    for(int it=0; it!=5000; ++it)
+    {
+        std::string utf8, utf16le, utf16be;
+        for(std::size_t n=rng()%80; n; --n)
+        {
+            std::uint32_t cp = rng()%2 ? std::uint32_t('a' + rng()%26) : codePoints[rng()%(sizeof(codePoints)/sizeof(codePoints[0]))];
+            details::appendUtf8(utf8, cp);
+            appendUtf16(utf16le, cp, false);
+            appendUtf16(utf16be, cp, true);
+        }
+
+        // Кодировка задаётся либо BOM, либо по умолчанию
+        struct Variant { TextEncoding defaultEncoding; std::string raw; };
+        const Variant variants[] =
+        {
+            { TextEncoding::Utf8   , utf8                    },
+            { TextEncoding::Cp1251 , "\xEF\xBB\xBF" + utf8   },
+            { TextEncoding::Utf16LE, utf16le                 },
+            { TextEncoding::Utf8   , "\xFF\xFE" + utf16le    },
+            { TextEncoding::Utf16BE, utf16be                 },
+            { TextEncoding::Utf8   , "\xFE\xFF" + utf16be    },
+        };
+
+        for(const auto &v : variants)
+        {
+            TextDecoder decoder(v.defaultEncoding);
+            auto out = decodeInChunks(decoder, v.raw, rng, rng()%4==0 ? 64u : 5u);
+
+            if (out!=utf8 || !decoder.errors().empty())
+            {
+                std::printf("decoder_random_chunks: mismatch, default encoding %s, input:\n", to_string(v.defaultEncoding).c_str());
+                for(unsigned char ch : v.raw)
+                    std::printf(" %02x", ch);
+                std::printf("\n");
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+//! Эталонный декодер UTF-8 - побайтовый, замена по правилу maximal subpart, как decode(errors='replace') в Python
+static
+std::string referenceDecodeUtf8(const std::string &raw, std::vector<std::size_t> &errorPositions)
+{
+    std::string out;
+    const unsigned char *p = (const unsigned char*)raw.data();
+
+    for(std::size_t i=0; i<raw.size(); )
+    {
+        unsigned b = p[i];
+        if (b<0x80)
+        {
+            out.push_back(char(b));
+            ++i;
+            continue;
+        }
+
+        std::size_t len = 0;
+        unsigned lo = 0x80, hi = 0xBF;
+        if      (b>=0xC2 && b<=0xDF) len = 2;
+        else if (b==0xE0)          { len = 3; lo = 0xA0; }
+        else if (b==0xED)          { len = 3; hi = 0x9F; }
+        else if (b>=0xE1 && b<=0xEF) len = 3;
+        else if (b==0xF0)          { len = 4; lo = 0x90; }
+        else if (b==0xF4)          { len = 4; hi = 0x8F; }
+        else if (b>=0xF1 && b<=0xF3) len = 4;
+
+        std::size_t valid = 1;
+        while(len && valid<len && i+valid<raw.size())
+        {
+            unsigned c = p[i+valid];
+            if (c<(valid==1 ? lo : 0x80u) || c>(valid==1 ? hi : 0xBFu))
+                break;
+            ++valid;
+        }
+
+        if (len && valid==len)
+        {
+            out.append(raw, i, len);
+        }
+        else
+        {
+            out += "\xEF\xBF\xBD";
+            errorPositions.push_back(i);
+        }
+        i += valid;
+    }
+
+    return out;
+}
+
+//----------------------------------------------------------------------------
+//! TextDecoder на длинных входах со случайными корректными и некорректными последовательностями совпадает с эталоном
+/*! Длинные участки корректного текста проходят через быструю (в том числе SIMD) проверку UTF-8 */
+static
+bool testDecoderRandomUtf8(unsigned seed)
+{
+    static const char * const parts[] =
+    {
+        "a", "abcdefgh,ijklmnop;", "\n", "\xD0\x9F\xD1\x80\xD0\xB8\xD0\xB2\xD0\xB5\xD1\x82", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "\xEF\xBF\xBF",
+        "\x80", "\xBF", "\xC0\xAF", "\xC1", "\xC2", "\xE0\x80", "\xE0\xA0", "\xED\xA0\x80", "\xED\x9F\xBF", "\xF0\x8F", "\xF4\x90\x80\x80",
+        "\xF4\x8F\xBF\xBF", "\xF5", "\xFF", "\xE2\x82", "\xF0\x9F\x98",
+    };
+
+    std::mt19937 rng(seed);
+
+    for(int it=0; it!=5000; ++it)
+    {
+        std::string raw;
+        for(std::size_t n=rng()%60; n; --n)
+        {
+            // Чаще корректный текст - чтобы были длинные участки для быстрой проверки
+            std::size_t idx = rng()%3 ? rng()%7 : rng()%(sizeof(parts)/sizeof(parts[0]));
+            raw += parts[idx];
+        }
+
+        std::vector<std::size_t> refPositions;
+        const std::string expected = referenceDecodeUtf8(raw, refPositions);
+
+        for(std::size_t maxChunk : { raw.size()+1, std::size_t(3), std::size_t(40) })
+        {
+            TextDecoder decoder(TextEncoding::Utf8, false);
+            auto out = decodeInChunks(decoder, raw, rng, maxChunk);
+
+            bool ok = out==expected && decoder.errors().size()==refPositions.size();
+            for(std::size_t i=0; ok && i!=refPositions.size(); ++i)
+                ok = decoder.errors()[i].position==refPositions[i];
+
+            if (!ok)
+            {
+                std::printf("decoder_random_utf8: mismatch, max chunk %u, input:\n", unsigned(maxChunk));
+                for(unsigned char ch : raw)
+                    std::printf(" %02x", ch);
+                std::printf("\n");
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+//! Строковый литерал вместе с нулевыми байтами внутри
+template<std::size_t N>
+static
+std::string bytes(const char (&str)[N])
+{
+    return std::string(str, N-1);
+}
+
+//----------------------------------------------------------------------------
+//! TextDecoder: замена некорректных последовательностей на U+FFFD, BOM, CP1251, позиции ошибок
+static
+bool testDecoderInvalidInput(unsigned seed)
+{
+    struct Case
+    {
+        TextEncoding  defaultEncoding;
+        std::string   raw;
+        std::string   expected;
+        std::size_t   firstErrorPos; //!< Смещение первой ошибки во входе; число ошибок - по числу U+FFFD в expected
+        TextEncoding  detected;
+    };
+
+    const Case cases[] =
+    {
+        { TextEncoding::Utf8   , bytes("\xD0\x9F\xD1\x80\xD0\xB8, \xF0\x9F\x98\x80"), bytes("\xD0\x9F\xD1\x80\xD0\xB8, \xF0\x9F\x98\x80")               , 0, TextEncoding::Utf8 },
+        { TextEncoding::Utf8   , bytes("a\xFF" "b")                                 , bytes("a" "\xEF\xBF\xBD" "b")                                     , 1, TextEncoding::Utf8 },
+        { TextEncoding::Utf8   , bytes("ab\xE2\x82")                                , bytes("ab" "\xEF\xBF\xBD")                                        , 2, TextEncoding::Utf8 },
+        { TextEncoding::Utf8   , bytes("\xE2\x82x")                                 , bytes("\xEF\xBF\xBD" "x")                                         , 0, TextEncoding::Utf8 },
+        { TextEncoding::Utf8   , bytes("\xF0\x9F\x98")                              , bytes("\xEF\xBF\xBD")                                             , 0, TextEncoding::Utf8 },
+        { TextEncoding::Utf8   , bytes("\xC0\xAF")                                  , bytes("\xEF\xBF\xBD" "\xEF\xBF\xBD")                              , 0, TextEncoding::Utf8 },
+        { TextEncoding::Utf8   , bytes("\xED\xA0\x80")                              , bytes("\xEF\xBF\xBD" "\xEF\xBF\xBD" "\xEF\xBF\xBD")               , 0, TextEncoding::Utf8 },
+        { TextEncoding::Utf8   , bytes("\xF4\x90\x80\x80")                          , bytes("\xEF\xBF\xBD" "\xEF\xBF\xBD" "\xEF\xBF\xBD" "\xEF\xBF\xBD"), 0, TextEncoding::Utf8 },
+        { TextEncoding::Utf8   , bytes("\xEF\xBB\xBF" "a\x80")                      , bytes("a" "\xEF\xBF\xBD")                                         , 4, TextEncoding::Utf8 },
+        { TextEncoding::Utf8   , bytes("\xFF\xFE" "a\0\x3F\x04")                    , bytes("a\xD0\xBF")                                                , 0, TextEncoding::Utf16LE },
+        { TextEncoding::Utf8   , bytes("\xFE\xFF\0a\xD8\x3D\xDE\0")                 , bytes("a\xF0\x9F\x98\x80")                                        , 0, TextEncoding::Utf16BE },
+        { TextEncoding::Utf16LE, bytes("a\0\x3D\xD8")                               , bytes("a" "\xEF\xBF\xBD")                                         , 2, TextEncoding::Utf16LE },
+        { TextEncoding::Utf16LE, bytes("\x3D\xD8" "a\0")                            , bytes("\xEF\xBF\xBD" "a")                                         , 0, TextEncoding::Utf16LE },
+        { TextEncoding::Utf16LE, bytes("a\0\0\xDC")                                 , bytes("a" "\xEF\xBF\xBD")                                         , 2, TextEncoding::Utf16LE },
+        { TextEncoding::Utf16LE, bytes("a\0b")                                      , bytes("a" "\xEF\xBF\xBD")                                         , 2, TextEncoding::Utf16LE },
+        { TextEncoding::Cp1251 , bytes("\xCF\xF0\xE8;\xB8")                         , bytes("\xD0\x9F\xD1\x80\xD0\xB8;\xD1\x91")                        , 0, TextEncoding::Cp1251 },
+        { TextEncoding::Cp1251 , bytes("x\x98y")                                    , bytes("x" "\xEF\xBF\xBD" "y")                                     , 1, TextEncoding::Cp1251 },
+        { TextEncoding::Utf8   , bytes("\xEF\xBB")                                  , bytes("\xEF\xBF\xBD")                                             , 0, TextEncoding::Utf8 },
+    };
+
+    std::mt19937 rng(seed);
+
+    for(std::size_t i=0; i!=sizeof(cases)/sizeof(cases[0]); ++i)
+    {
+        const auto &c = cases[i];
+
+        std::size_t replacements = 0;
+        for(auto pos=c.expected.find("\xEF\xBF\xBD"); pos!=c.expected.npos; pos=c.expected.find("\xEF\xBF\xBD", pos+3))
+            ++replacements;
+
+        // Целиком и по байту, затем случайными кусками
+        for(std::size_t rep=0; rep!=8; ++rep)
+        {
+            TextDecoder decoder(c.defaultEncoding);
+            auto out = decodeInChunks(decoder, c.raw, rng, rep==0 ? c.raw.size()+1 : rep==1 ? 1u : 3u);
+
+            const auto &errors = decoder.errors();
+            bool ok = out==c.expected
+                   && errors.size()==replacements
+                   && decoder.encoding()==c.detected
+                   && (errors.empty() || (errors[0].type==ParseErrorType::InvalidEncoding && errors[0].line==0 && errors[0].position==c.firstErrorPos));
+            if (!ok)
+            {
+                std::printf("decoder_invalid_input: case %u, chunking %u failed\n", unsigned(i), unsigned(rep));
+                ++g_failedChecks;
+                break;
+            }
+        }
+    }
+
+    return !g_failedChecks;
+}
+
+//----------------------------------------------------------------------------
+//! parseEncoded при любом размере куска даёт то же, что parse над UTF-8 версией входа; ошибки кодировки идут первыми
+static
+bool testParseEncoded(unsigned)
+{
+    const std::string utf8 = "id,\xD0\xB8\xD0\xBC\xD1\x8F\r\n1,\"\xD0\x9F\xD1\x80\xD0\xB8, \xD0\xBC\xD0\xB8\xD1\x80\"\n2,\xD1\x91\xF0\x9F\x98\x80\n";
+    const auto ref = parse(utf8, ',', '\"', true);
+
+    std::string utf16le = "\xFF\xFE";
+    for(std::size_t pos=0; pos<utf8.size(); )
+    {
+        unsigned char ch = (unsigned char)utf8[pos];
+        std::size_t   len = ch<0x80 ? 1u : ch<0xE0 ? 2u : ch<0xF0 ? 3u : 4u;
+        std::uint32_t cp  = len==1 ? ch : len==2 ? (ch&0x1Fu) : len==3 ? (ch&0x0Fu) : (ch&0x07u);
+        for(std::size_t i=1; i!=len; ++i)
+            cp = (cp<<6) | ((unsigned char)utf8[pos+i]&0x3Fu);
+        appendUtf16(utf16le, cp, false);
+        pos += len;
+    }
+
+    for(std::size_t chunkSize : { std::size_t(0), std::size_t(1), std::size_t(3), std::size_t(7) })
+    {
+        auto r8  = parseEncoded(utf8   , TextEncoding::Utf8, ',', '\"', true, chunkSize);
+        auto r16 = parseEncoded(utf16le, TextEncoding::Utf8, ',', '\"', true, chunkSize);
+        expect(r8 .data==ref.data && r8 .errors.empty(), "parseEncoded UTF-8");
+        expect(r16.data==ref.data && r16.errors.empty(), "parseEncoded UTF-16LE with BOM");
+    }
+
+    auto cp1251 = parseEncoded("\xE8\xEC\xFF;\"a;\xB8\"\n", TextEncoding::Cp1251, ';', '\"', true, 2);
+    expect(cp1251.data==std::vector< std::vector<std::string> >{ { "\xD0\xB8\xD0\xBC\xD1\x8F", "a;\xD1\x91" } } && cp1251.errors.empty(), "parseEncoded CP1251");
+
+    auto bad = parseEncoded("a,\xFF\nb\n", TextEncoding::Utf8, ',', '\"', true, 1);
+    expect(bad.data==std::vector< std::vector<std::string> >{ { "a", "\xEF\xBF\xBD" }, { "b" } }, "invalid byte replaced in parsed data");
+    expect(bad.errors.size()==2 && bad.errors[0].type==ParseErrorType::InvalidEncoding && bad.errors[0].position==2
+        && bad.errors[1].type==ParseErrorType::InconsistentColumns, "encoding errors precede parse errors");
+
+    return !g_failedChecks;
+}
+
+//----------------------------------------------------------------------------
+//! Файл для тестов чтения файлов - несколько сотен КБ, с многострочными полями и ошибками разбора
+static
+std::string makeFileTestData(unsigned seed, int rowsCount=20000)
+{
+    std::mt19937 rng(seed);
+
+    std::string data = "id,name,value,note\n";
+    for(int i=0; i!=rowsCount; ++i)
+    {
+        data += std::to_string(i) + ",name" + std::to_string(rng()%1000) + "," + std::to_string(rng());
+        switch(rng()%8)
+        {
+            case 0 : data += ",\"multi\nline, \"\"quoted\"\"\"\n"; break;
+            case 1 : data += "\r\n"; break;                 // Меньше колонок - InconsistentColumns
+            case 2 : data += ",\"x\"y\n"; break;            // Символ после кавычки
+            default: data += ",plain\n"; break;
+        }
+    }
+
+    return data;
+}
+
+#if defined(MARTY_CSV_HAS_ZLIB)
+//----------------------------------------------------------------------------
+static
+std::string gzipCompress(const std::string &data)
+{
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY)!=Z_OK)
+        return std::string();
+
+    std::string out(deflateBound(&zs, uLong(data.size())), '\0');
+    zs.next_in   = (Bytef*)const_cast<char*>(data.data());
+    zs.avail_in  = uInt(data.size());
+    zs.next_out  = (Bytef*)&out[0];
+    zs.avail_out = uInt(out.size());
+
+    int res = deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+
+    return res==Z_STREAM_END ? out : std::string();
+}
+#endif
+
+//----------------------------------------------------------------------------
+//! CompressedCsvReader: несжатый вход при любых размерах блоков и очереди совпадает с parse
+static
+bool testCompressedPlain(unsigned seed)
+{
+    const std::string path = "marty_csv_tests_compressed.csv";
+
+    std::mt19937 rng(seed);
+
+    for(int it=0; it!=20; ++it)
+    {
+        // Мелкие блоки - на небольшом файле: каждый блок проходит через очередь между потоками
+        const bool        smallBlocks = it%2==0;
+        const std::string data        = makeFileTestData(seed+unsigned(it), smallBlocks ? 200 : 20000);
+        const auto        ref         = parse(data, ',', '\"', true);
+
+        std::size_t blockSize   = smallBlocks ? 1 + rng()%16 : 1 + rng()%8192;
+        std::size_t queueBlocks = 1 + rng()%3;
+
+        expect(writeWholeFile(path, data), "source file written");
+
+        ParseResult res;
+        CompressedCsvReader reader(',', '\"', true, blockSize, queueBlocks);
+        bool ok = reader.read(path, [&](const std::vector<std::string> &row) { res.data.push_back(row); });
+
+        expect(ok && reader.format()==CompressionFormat::None, "plain file read");
+        expect(res.data==ref.data && sameErrors(reader.errors(), ref.errors), "plain file rows and errors");
+        if (g_failedChecks)
+        {
+            std::printf("blockSize=%u, queueBlocks=%u\n", unsigned(blockSize), unsigned(queueBlocks));
+            break;
+        }
+    }
+
+    // Диалект определяется по первому блоку
+    const std::string data = makeFileTestData(seed);
+    expect(writeWholeFile(path, data), "source file written");
+
+    ParseResult detected;
+    expect(parseCompressedFile(path, detected) && detected.data==parse(data, ',', '\"', true).data, "parseCompressedFile detects the dialect");
+
+    std::remove(path.c_str());
+
+    ParseResult missing;
+    expect(!parseCompressedFile(path, missing), "missing file");
+
+    return !g_failedChecks;
+}
+
+//----------------------------------------------------------------------------
+//! CompressedCsvReader: исключение из rowCallback доходит до вызывающего, поток распаковки останавливается, reader можно использовать снова
+static
+bool testCompressedThrowingCallback(unsigned seed)
+{
+    const std::string path = "marty_csv_tests_compressed_throw.csv";
+    const std::string data = makeFileTestData(seed);
+    expect(writeWholeFile(path, data), "source file written");
+
+    const auto ref = parse(data, ',', '\"', true);
+
+    CompressedCsvReader reader(',', '\"', true, 4096, 2);
+
+    for(std::size_t throwAt : { std::size_t(1), std::size_t(1000), ref.data.size() })
+    {
+        std::size_t rows = 0;
+        bool caught = false;
+        try
+        {
+            reader.read(path, [&](const std::vector<std::string>&)
+            {
+                if (++rows==throwAt)
+                    throw std::runtime_error("stop");
+            });
+        }
+        catch(const std::runtime_error&)
+        {
+            caught = true;
+        }
+        expect(caught && rows==throwAt, "exception from rowCallback propagates");
+
+        ParseResult res;
+        expect(reader.read(path, [&](const std::vector<std::string> &row) { res.data.push_back(row); }), "reader reused after an exception");
+        expect(res.data==ref.data, "rows after an exception");
+    }
+
+    // Файл закрыт и после исключения - его можно удалить
+    expect(std::remove(path.c_str())==0, "file closed after an exception");
+
+    return !g_failedChecks;
+}
+
+//----------------------------------------------------------------------------
+//! CompressedCsvReader: gzip - один поток, несколько склеенных потоков, обрезанный и испорченный вход
+static
+bool testCompressedGzip(unsigned seed)
+{
+#if defined(MARTY_CSV_HAS_ZLIB)
+    const std::string path = "marty_csv_tests_compressed.csv.gz";
+    const std::string data = makeFileTestData(seed);
+    const auto ref = parse(data, ',', '\"', true);
+
+    const std::string gz = gzipCompress(data);
+    expect(!gz.empty(), "gzip compression");
+
+    auto readGz = [&](const std::string &content, std::size_t blockSize, ParseResult &res)
+    {
+        res = ParseResult();
+        if (!writeWholeFile(path, content))
+            return false;
+
+        CompressedCsvReader reader(',', '\"', true, blockSize, 2);
+        bool ok = reader.read(path, [&](const std::vector<std::string> &row) { res.data.push_back(row); });
+        res.errors = reader.errors();
+        return ok && reader.format()==CompressionFormat::Gzip;
+    };
+
+    ParseResult res;
+    for(std::size_t blockSize : { std::size_t(7), std::size_t(4096), std::size_t(256*1024) })
+    {
+        expect(readGz(gz, blockSize, res) && res.data==ref.data && sameErrors(res.errors, ref.errors), "gzip file");
+    }
+
+    // Склеенные gzip-потоки читаются как один вход
+    const std::size_t half = data.find('\n', data.size()/2) + 1;
+    expect(readGz(gzipCompress(data.substr(0, half)) + gzipCompress(data.substr(half)), 1000, res) && res.data==ref.data, "multi-member gzip");
+
+    expect(readGz(gz.substr(0, gz.size()/2), 4096, res), "truncated gzip opened");
+    expect(!res.errors.empty() && res.errors.back().type==ParseErrorType::InputError && res.errors.back().message=="Unexpected end of Gzip data", "truncated gzip reported");
+    // Последняя строка может быть обрезана посередине
+    expect(!res.data.empty() && res.data.size()<ref.data.size() && std::equal(res.data.begin(), res.data.end()-1, ref.data.begin()), "rows before truncation");
+
+    std::string corrupt = gz;
+    for(std::size_t i=gz.size()/3; i!=gz.size()/3+64; ++i)
+        corrupt[i] = char(~corrupt[i]);
+    expect(readGz(corrupt, 4096, res), "corrupt gzip opened");
+    expect(!res.errors.empty() && res.errors.back().type==ParseErrorType::InputError && res.errors.back().message=="Invalid Gzip data", "corrupt gzip reported");
+
+    std::remove(path.c_str());
+#else
+    (void)seed;
+    std::printf("compressed_gzip: built without MARTY_CSV_WITH_ZLIB, only the unsupported format is checked\n");
+
+    const std::string path = "marty_csv_tests_compressed.csv.gz";
+    expect(writeWholeFile(path, bytes("\x1F\x8B\x08\0\0\0\0\0")), "gzip signature written");
+
+    ParseResult res;
+    expect(!parseCompressedFile(path, res), "gzip not supported without zlib");
+
+    std::remove(path.c_str());
+#endif
+
+    return !g_failedChecks;
+}
+
+//----------------------------------------------------------------------------
+//! PipelinedCsvReader с крошечными блоками и пачками совпадает с parse - записи режутся границами блоков где угодно
+static
+bool testPipelineTinyBlocks(unsigned seed)
+{
+    static const char * const parts[] = { "a", ",", "\"", "\n", "\r\n", " ", "\"\"", "b,c", "\r", "x\"y", "1", "\n\n" };
+
+    const std::string path = "marty_csv_tests_pipeline.csv";
+
+    std::mt19937 rng(seed);
+
+    for(int it=0; it!=500; ++it)
+    {
+        std::string s;
+        for(std::size_t n=rng()%400; n; --n)
+            s += parts[rng()%(sizeof(parts)/sizeof(parts[0]))];
+
+        const bool strict = rng()%2!=0;
+        const auto ref    = parse(s, ',', '\"', strict);
+
+        // Блок ровно по размеру файла - последнее чтение возвращает 0 байт
+        std::size_t blockSize = it%10==0 && !s.empty() ? s.size() : 1 + rng()%40;
+
+        expect(writeWholeFile(path, s), "source file written");
+
+        ParseResult res;
+        PipelinedCsvReader reader(',', '\"', strict, blockSize, 2 + rng()%3, 1 + rng()%5, 1 + rng()%3);
+        bool ok = reader.read(path, [&](const std::vector<std::string> &row) { res.data.push_back(row); });
+
+        if (!ok || res.data!=ref.data || !sameErrors(reader.errors(), ref.errors))
+        {
+            printMismatch("pipeline_tiny_blocks", s, ',', strict);
+            return false;
+        }
+    }
+
+    // Пачки можно забирать целиком; parseFilePipelined на большом файле совпадает с parseFile
+    const std::string data = makeFileTestData(seed);
+    expect(writeWholeFile(path, data), "source file written");
+
+    ParseResult viaFile, pipelined;
+    expect(parseFile(path, viaFile, ',', '\"') && parseFilePipelined(path, pipelined), "big file read");
+    expect(pipelined.data==viaFile.data && sameErrors(pipelined.errors, viaFile.errors), "parseFilePipelined equals parseFile");
+
+    std::remove(path.c_str());
+
+    ParseResult missing;
+    expect(!parseFilePipelined(path, missing), "missing file");
+
+    return !g_failedChecks;
+}
+
+//----------------------------------------------------------------------------
+//! PipelinedCsvReader: исключение из rowCallback доходит до вызывающего, потоки останавливаются, reader можно использовать снова
+static
+bool testPipelineThrowingCallback(unsigned seed)
+{
+    const std::string path = "marty_csv_tests_pipeline_throw.csv";
+    const std::string data = makeFileTestData(seed);
+    expect(writeWholeFile(path, data), "source file written");
+
+    const auto ref = parse(data, ',', '\"', true);
+
+    PipelinedCsvReader reader(',', '\"', true, 4096, 3, 100, 2);
+
+    for(std::size_t throwAt : { std::size_t(1), std::size_t(100), std::size_t(1037), ref.data.size() })
+    {
+        std::size_t rows = 0;
+        bool caught = false;
+        try
+        {
+            reader.read(path, [&](const std::vector<std::string>&)
+            {
+                if (++rows==throwAt)
+                    throw std::runtime_error("stop");
+            });
+        }
+        catch(const std::runtime_error&)
+        {
+            caught = true;
+        }
+        expect(caught && rows==throwAt, "exception from rowCallback propagates");
+
+        ParseResult res;
+        expect(reader.read(path, [&](const std::vector<std::string> &row) { res.data.push_back(row); }), "reader reused after an exception");
+        expect(res.data==ref.data && sameErrors(reader.errors(), ref.errors), "rows and errors after an exception");
+    }
+
+    expect(std::remove(path.c_str())==0, "file closed after an exception");
+
+    return !g_failedChecks;
+}
+
+//----------------------------------------------------------------------------
+//! Политики ошибок против keepAll: compact восстанавливает те же ошибки, keepFirst/countOnly/stopAtFirst - их часть и те же счётчики
+static
+bool testErrorPolicies(unsigned seed)
+{
+    static const std::string alphabet = "ab,;\"\n\r x";
+
+    std::mt19937 rng(seed);
+
+    for(int it=0; it!=10000; ++it)
+    {
+        std::string s = randomInput(rng, alphabet, 100);
+        char delim  = rng()%2 ? ',' : ';';
+        bool strict = rng()%2!=0;
+
+        const auto ref = parse(s, delim, '\"', strict);
+
+        std::array<std::uint64_t, parseErrorTypesCount> refCounts = {};
+        for(const auto &e : ref.errors)
+            ++refCounts[std::size_t(e.type)];
+
+        bool ok = true;
+
+        ErrorLog compactLog;
+        auto compact = parse(s, ErrorPolicy::compact(), compactLog, delim, '\"', strict);
+        ok = ok && compact.data==ref.data && compact.errors.empty() && compactLog.counts==refCounts && compactLog.records.size()==ref.errors.size();
+        for(std::size_t i=0; ok && i!=ref.errors.size(); ++i)
+        {
+            auto pe = toParseError(compactLog, compactLog.records[i]);
+            ok = pe.type==ref.errors[i].type && pe.message==ref.errors[i].message && pe.line==ref.errors[i].line && pe.position==ref.errors[i].position;
+        }
+
+        ErrorLog countLog;
+        auto counted = parse(s, ErrorPolicy::countOnly(), countLog, delim, '\"', strict);
+        ok = ok && counted.data==ref.data && counted.errors.empty() && countLog.counts==refCounts && countLog.records.empty();
+
+        const std::size_t keep = rng()%3;
+        ErrorLog firstLog;
+        auto first = parse(s, ErrorPolicy::keepFirst(keep), firstLog, delim, '\"', strict);
+        std::vector<ParseError> refFirst(ref.errors.begin(), ref.errors.begin()+std::ptrdiff_t(keep<ref.errors.size() ? keep : ref.errors.size()));
+        ok = ok && first.data==ref.data && sameErrors(first.errors, refFirst) && firstLog.counts==refCounts;
+
+        ErrorLog flatLog;
+        auto flat = parseFlat(s, ErrorPolicy::keepFirst(keep), flatLog, delim, '\"', strict);
+        ok = ok && sameErrors(flat.errors, refFirst) && flatLog.counts==refCounts;
+
+        // stopAtFirst: строки до записи с первой ошибкой включительно, одна ошибка; кусками - то же самое
+        ErrorLog stopLog;
+        auto stop = parse(s, ErrorPolicy::stopAtFirst(), stopLog, delim, '\"', strict);
+        const bool hasErrors = !ref.errors.empty();
+        ok = ok && stopLog.stopped==hasErrors && stopLog.total()==(hasErrors ? 1u : 0u)
+                && sameErrors(stop.errors, std::vector<ParseError>(ref.errors.begin(), ref.errors.begin()+(hasErrors ? 1 : 0)))
+                && stop.data.size()<=ref.data.size() && std::equal(stop.data.begin(), stop.data.end(), ref.data.begin())
+                && (hasErrors || stop.data.size()==ref.data.size());
+
+        details::CsvParser parser(delim, '\"', strict);
+        ErrorLog chunkLog;
+        parser.setErrorPolicy(ErrorPolicy::stopAtFirst(), &chunkLog);
+
+        std::vector<ParseError> chunkErrors;
+        std::string  buf;
+        std::size_t  offset = 0, rows = 0;
+        for(std::size_t pos=0; ; pos+=4)
+        {
+            buf += s.substr(pos<s.size() ? pos : s.size(), 4);
+            const bool bFinal = pos+4>=s.size();
+            std::size_t consumed = parser.parseChunk(buf.data(), buf.size(), offset, bFinal, chunkErrors, [&](const details::FieldSpan*, std::size_t) { ++rows; });
+            buf.erase(0, consumed);
+            offset += consumed;
+            if (bFinal)
+                break;
+        }
+        ok = ok && rows==stop.data.size() && sameErrors(chunkErrors, stop.errors) && parser.stopped()==hasErrors;
+
+        if (!ok)
+        {
+            printMismatch("error_policies", s, delim, strict);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+//! reportRowError строит сообщение, только если ошибка сохраняется с сообщением
+static
+bool testErrorPolicyLazyMessages(unsigned)
+{
+    const std::string s = "a,b\nc,d\ne,f\n";
+
+    auto run = [&](const ErrorPolicy &policy, ErrorLog &log, std::vector<ParseError> &errors)
+    {
+        details::CsvParser parser;
+        parser.setErrorPolicy(policy, &log);
+
+        int made = 0;
+        parser.parseSpans(s.data(), s.size(), errors, [&](const details::FieldSpan *pFields, std::size_t numFields)
+        {
+            for(std::size_t i=0; i!=numFields; ++i)
+            {
+                parser.reportRowError(ParseErrorType::InvalidValue, std::size_t(pFields[i].begin - s.data()), [&]()
+                {
+                    ++made;
+                    return "bad " + std::string(pFields[i].begin, pFields[i].end);
+                });
+            }
+        });
+
+        return made;
+    };
+
+    {
+        ErrorLog log; std::vector<ParseError> errors;
+        expect(run(ErrorPolicy::keepAll(), log, errors)==6 && errors.size()==6 && log.total()==6, "keepAll builds every message");
+        expect(errors.size()==6 && errors[3].message=="bad d" && errors[3].line==2 && errors[3].position==3, "message, line and position");
+    }
+
+    {
+        ErrorLog log; std::vector<ParseError> errors;
+        expect(run(ErrorPolicy::keepFirst(1), log, errors)==1 && errors.size()==1 && log.total()==6, "keepFirst(1) builds one message");
+        expect(errors.size()==1 && errors[0].message=="bad a", "first message kept");
+    }
+
+    {
+        ErrorLog log; std::vector<ParseError> errors;
+        expect(run(ErrorPolicy::countOnly(), log, errors)==0 && errors.empty() && log.count(ParseErrorType::InvalidValue)==6, "countOnly builds no messages");
+    }
+
+    {
+        ErrorLog log; std::vector<ParseError> errors;
+        expect(run(ErrorPolicy::compact(), log, errors)==0 && errors.empty() && log.records.size()==6, "compact builds no messages");
+        expect(log.records.size()==6 && log.records[5].line==3 && log.records[5].position==3 && log.records[5].offset==10, "compact record position");
+    }
+
+    {
+        ErrorLog log; std::vector<ParseError> errors;
+        expect(run(ErrorPolicy::stopAtFirst(), log, errors)==1 && errors.size()==1 && log.stopped, "stopAtFirst builds one message");
+    }
+
+    return !g_failedChecks;
+}
+
+//----------------------------------------------------------------------------
+struct TestCase
+{
+    const char   *name;
+    bool        (*func)(unsigned seed);
+};
+
+static const TestCase testCases[] =
+{
+    { "legacy_differential"          , testLegacyDifferential         },
+    { "push_chunk_invariance"        , testPushChunkInvariance        },
+    { "parallel_equivalence"         , testParallelEquivalence        },
+    { "parallel_task_pool"           , testParallelTaskPool           },
+    { "typed_value_parsers"          , testTypedValueParsers          },
+    { "typed_parse"                  , testTypedParse                 },
+    { "writer_round_trip"            , testWriterRoundTrip            },
+    { "writer_empty_fields"          , testWriterEmptyFields          },
+    { "row_index_slices"             , testRowIndexSlices             },
+    { "row_index_file"               , testRowIndexFile               },
+    { "key_index_file"               , testKeyIndexFile               },
+    { "lazy_equivalence"             , testLazyEquivalence            },
+    { "decoder_random_chunks"        , testDecoderRandomChunks        },
+    { "decoder_invalid_input"        , testDecoderInvalidInput        },
+    { "decoder_random_utf8"          , testDecoderRandomUtf8          },
+    { "parse_encoded"                , testParseEncoded               },
+    { "compressed_plain"             , testCompressedPlain            },
+    { "compressed_throwing_callback" , testCompressedThrowingCallback },
+    { "compressed_gzip"              , testCompressedGzip             },
+    { "pipeline_tiny_blocks"         , testPipelineTinyBlocks         },
+    { "pipeline_throwing_callback"   , testPipelineThrowingCallback   },
+    { "error_policies"               , testErrorPolicies              },
+    { "error_policy_lazy_messages"   , testErrorPolicyLazyMessages    },
+};
+
+//----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+    if (argc<2)
+    {
+        std::printf("Usage: marty_csv_tests <test> [seed]\nTests:\n");
+        for(const auto &tc : testCases)
+            std::printf("    %s\n", tc.name);
+        return 2;
+    }
+
+    const unsigned seed = argc>2 ? unsigned(std::strtoul(argv[2], 0, 10)) : 1u;
+
+    for(const auto &tc : testCases)
+    {
+        if (std::strcmp(argv[1], tc.name)!=0)
+            continue;
+
+        bool ok = tc.func(seed);
+        std::printf("%s: %s\n", tc.name, ok ? "ok" : "FAILED");
+        return ok ? 0 : 1;
+    }
+
+    std::printf("Unknown test: %s\n", argv[1]);
+    return 2;
+}